@@ -0,0 +1,99 @@
+#include "simple_instruments.h"
+#include "simple_instruments/arena.h"
+#include "simple_instruments/instrument_family.h"
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct metadata {
+        using allocator_type = std::pmr::polymorphic_allocator<char>;
+        std::pmr::string name;
+        std::pmr::string help;
+
+        metadata(std::string_view n = {}, std::string_view h = {}, const allocator_type &allocator = {})
+                : name{n, allocator}, help{h, allocator} {}
+        metadata(const metadata &other, const allocator_type &allocator)
+                : name{other.name, allocator}, help{other.help, allocator} {}
+        metadata(metadata &&other, const allocator_type &allocator)
+                : name{std::move(other.name), allocator}, help{std::move(other.help), allocator} {}
+        metadata(const metadata &) = default;
+        metadata(metadata &&) = default;
+    };
+
+    template <std::size_t N>
+    metadata with_labels(const metadata &md, const std::array<csi::label, N> &labels) {
+        metadata result{md, md.name.get_allocator()};
+        for (const auto &l : labels) result.name.append(",").append(l.name).append("=").append(l.value);
+        return result;
+    }
+
+    class null_exporter {
+    public:
+        using metadata_type = metadata;
+
+        template <typename Tvalue>
+        void emit_init(const Tvalue &, const metadata_type &) {}
+
+        template <typename Tvalue>
+        void emit(const Tvalue &, const metadata_type &) {}
+    };
+
+    constexpr int iterations = 2000000;
+    constexpr std::string_view name = "http_server_request_duration_seconds";
+    constexpr std::string_view help = "Duration of HTTP server requests, measured from accept to the last byte";
+
+    template <typename F>
+    double nanoseconds_per_call(int count, F &&f) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < count; ++i) f(i);
+        auto stop = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(stop - start).count() / count;
+    }
+
+    /// Creates and destroys an instrument per request, with metadata built in the memory of the factory.
+    double instrument_churn(csi::instrument_factory<null_exporter> &factory) {
+        return nanoseconds_per_call(iterations, [&](int) {
+            auto counter = factory.make_atomic_monotonic_counter<std::uint64_t>(
+                    metadata{name, help, factory.memory_resource()});
+            counter.add();
+        });
+    }
+
+    /// Creates a child per connection and expires it after it was used in one interval.
+    double family_churn(csi::instrument_factory<null_exporter> &factory) {
+        auto family = factory.make_atomic_monotonic_counter_family<std::uint64_t>(
+                metadata{name, help, factory.memory_resource()}, {"connection"});
+        constexpr int per_interval = 1000;
+        std::string connection = "connection-0000000000";
+        auto ns = nanoseconds_per_call(iterations / per_interval, [&](int interval) {
+            for (int c = 0; c < per_interval; ++c) {
+                connection.replace(11, std::string::npos, std::to_string(interval * per_interval + c));
+                family.with(connection).add();
+            }
+            family.expire_idle(0);
+        });
+        return ns / per_interval;
+    }
+
+}
+
+int main() {
+    csi::instrument_factory<null_exporter> heap;
+    csi::instrument_arena arena;
+    csi::instrument_factory<null_exporter> pooled;
+    pooled.use_memory_resource(&arena);
+
+    std::printf("%-40s %8.1f ns\n", "create/destroy instrument, default", instrument_churn(heap));
+    std::printf("%-40s %8.1f ns\n", "create/destroy instrument, arena", instrument_churn(pooled));
+    std::printf("%-40s %8.1f ns\n", "create/expire family child, default", family_churn(heap));
+    std::printf("%-40s %8.1f ns\n", "create/expire family child, arena", family_churn(pooled));
+    std::printf("arena reserved %zu KiB\n", arena.reserved() / 1024);
+    return 0;
+}
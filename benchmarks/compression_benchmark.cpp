@@ -0,0 +1,116 @@
+#include "simple_instruments.h"
+#include "simple_instruments/line_protocol.h"
+#include "simple_instruments/zlib_sink.h"
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct metadata {
+        std::string series;
+    };
+
+    const std::string &unique_identifier(const metadata &md) {
+        return md.series;
+    }
+
+    struct counting_sink {
+        std::uint64_t bytes{0};
+
+        void write(std::string &&buffer) {
+            bytes += buffer.size();
+        }
+
+        void flush() {}
+    };
+
+    struct result {
+        double seconds;
+        std::uint64_t bytes_in;
+        std::uint64_t bytes_out;
+    };
+
+    constexpr std::size_t buffer_size = 64 * 1024;
+    constexpr int events = 2000000;
+
+    std::vector<std::string> series_names() {
+        std::vector<std::string> names;
+        for (auto host : {"web01", "web02", "web03", "web04"}) {
+            for (auto endpoint : {"/api/v1/items", "/api/v1/users", "/api/v1/orders", "/health", "/login"}) {
+                for (auto status : {"200", "201", "304", "404", "500"}) {
+                    names.push_back(std::string{"http_requests,host="} + host + ",endpoint=" + endpoint +
+                                    ",status=" + status);
+                }
+                names.push_back(std::string{"http_latency_seconds,host="} + host + ",endpoint=" + endpoint);
+            }
+        }
+        return names;
+    }
+
+    void measure(result &r, counting_sink &sink) {
+        r.bytes_in = r.bytes_out = sink.bytes;
+    }
+
+    void measure(result &r, csi::zlib_sink<counting_sink> &sink) {
+        r.bytes_in = sink.bytes_in();
+        r.bytes_out = sink.bytes_out();
+    }
+
+    /// Drives a realistic stream: request counters incremented in random order and latencies recorded. The time
+    /// includes waiting for the compression thread to finish.
+    template <typename Texporter, typename ...Args>
+    result run(Args ...args) {
+        csi::instrument_factory<Texporter> factory(buffer_size, args...);
+        using counter_type = decltype(factory.template make_atomic_monotonic_counter<std::uint64_t>());
+        using recorder_type = decltype(factory.template make_atomic_value_recorder_counter<double>());
+        std::vector<std::unique_ptr<counter_type>> counters;
+        std::vector<std::unique_ptr<recorder_type>> recorders;
+        for (const auto &name : series_names()) {
+            if (name.rfind("http_latency", 0) == 0) {
+                recorders.emplace_back(new auto(factory.template make_atomic_value_recorder_counter<double>({name})));
+            } else {
+                counters.emplace_back(new auto(factory.template make_atomic_monotonic_counter<std::uint64_t>({name})));
+            }
+        }
+        std::mt19937_64 random{42};
+        std::lognormal_distribution<double> latency{-4.0, 0.8};
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < events; ++i) {
+            auto r = random();
+            if (r % 4 == 0) {
+                recorders[(r >> 8) % recorders.size()]->set(latency(random));
+            } else {
+                counters[(r >> 8) % counters.size()]->add();
+            }
+        }
+        factory.exporter().flush();
+        auto stop = std::chrono::steady_clock::now();
+        result r{std::chrono::duration<double>(stop - start).count(), 0, 0};
+        measure(r, factory.exporter().sink());
+        return r;
+    }
+
+    void print(const char *name, const result &r) {
+        std::printf("%-16s %10.1f %10.1f %8.1f %12.0f %10.1f\n", name, r.bytes_in / 1e6, r.bytes_out / 1e6,
+                    static_cast<double>(r.bytes_in) / static_cast<double>(r.bytes_out), events / r.seconds,
+                    r.bytes_in / 1e6 / r.seconds);
+    }
+
+}
+
+int main() {
+    using raw_exporter = csi::line_protocol_exporter<metadata, counting_sink>;
+    using zlib_exporter = csi::line_protocol_exporter<metadata, csi::zlib_sink<counting_sink>>;
+    std::printf("%-16s %10s %10s %8s %12s %10s\n", "sink", "input MB", "output MB", "ratio", "events/s", "MB/s");
+    print("uncompressed", run<raw_exporter>());
+    print("zlib level 1", run<zlib_exporter>(Z_BEST_SPEED));
+    print("zlib level 6", run<zlib_exporter>(Z_DEFAULT_COMPRESSION));
+    print("zlib level 9", run<zlib_exporter>(Z_BEST_COMPRESSION));
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include "simple_instruments.h"
+#include "simple_instruments/counter_array.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct metadata {
+        std::string name;
+    };
+
+    class null_exporter {
+    public:
+        using metadata_type = metadata;
+
+        template <typename Tvalue>
+        void emit_init(const Tvalue &, const metadata_type &) {}
+
+        template <typename Tvalue>
+        void emit(const Tvalue &, const metadata_type &) {}
+    };
+
+    constexpr std::size_t series = 1000000;
+    constexpr int rounds = 100;
+
+    template <typename F>
+    double microseconds_per_round(F &&f) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; ++i) f(i);
+        auto stop = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::micro>(stop - start).count() / rounds;
+    }
+
+}
+
+int main() {
+    csi::instrument_factory<null_exporter> factory;
+
+    using counter = decltype(factory.make_atomic_monotonic_counter<std::uint64_t>());
+    std::vector<std::unique_ptr<counter>> instruments;
+    instruments.reserve(series);
+    for (std::size_t i = 0; i < series; ++i) {
+        instruments.emplace_back(new counter{factory.make_atomic_monotonic_counter<std::uint64_t>()});
+    }
+    std::vector<std::uint64_t> previous(series);
+    std::vector<std::uint64_t> deltas(series);
+    std::printf("%-50s %10.1f us\n", "1M instruments, load and delta per instrument",
+                microseconds_per_round([&](int r) {
+        instruments[static_cast<std::size_t>(r)]->add();
+        for (std::size_t i = 0; i < series; ++i) {
+            auto value = instruments[i]->value(std::memory_order_relaxed);
+            deltas[i] = value - previous[i];
+            previous[i] = value;
+        }
+    }));
+
+    auto counters = factory.make_atomic_counter_array({"counters"}, series);
+    std::vector<std::atomic<std::uint64_t>> raw(series);
+    std::printf("%-50s %10.1f us\n", "1M counter array, scalar snapshot", microseconds_per_round([&](int r) {
+        raw[static_cast<std::size_t>(r)]++;
+        csi::detail::snapshot_counters_scalar(raw.data(), previous.data(), deltas.data(), series);
+    }));
+    std::printf("%-50s %10.1f us\n", "1M counter array, collect", microseconds_per_round([&](int r) {
+        counters.add(static_cast<std::size_t>(r));
+        counters.collect();
+    }));
+    return 0;
+}
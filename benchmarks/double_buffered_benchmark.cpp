@@ -0,0 +1,76 @@
+#include "simple_instruments.h"
+#include "simple_instruments/double_buffered_exporter.h"
+#include "simple_instruments/line_protocol.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct metadata {
+        std::string series;
+    };
+
+    const std::string &unique_identifier(const metadata &md) {
+        return md.series;
+    }
+
+    /// Takes 200 microseconds per buffer, like a write to a slow disk or a network connection.
+    struct slow_sink {
+        void write(std::string &&) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+
+        void flush() {}
+    };
+
+    template <typename Tsink>
+    std::uint64_t dropped(csi::line_protocol_exporter<metadata, Tsink> &) {
+        return 0;
+    }
+
+    template <typename Tsink>
+    std::uint64_t dropped(csi::double_buffered_line_protocol_exporter<metadata, Tsink> &exporter) {
+        return exporter.dropped();
+    }
+
+    constexpr std::size_t buffer_size = 16 * 1024;
+    constexpr int emits = 200000;
+
+    /// Emits in bursts of 64 every 100 microseconds, a steady load the sink keeps up with, and reports the latency
+    /// distribution of the emits. Sleeping between bursts leaves the CPU to the flusher on machines with one core.
+    template <typename Texporter, typename ...Args>
+    void run(const char *name, Args ...args) {
+        csi::instrument_factory<Texporter> factory(buffer_size, args...);
+        auto requests = factory.template make_atomic_monotonic_counter<std::uint64_t>({"http_requests,host=web01"});
+        std::vector<double> latencies;
+        latencies.reserve(emits);
+        for (int i = 0; i < emits; ++i) {
+            if (i % 64 == 0) std::this_thread::sleep_for(std::chrono::microseconds(100));
+            auto before = std::chrono::steady_clock::now();
+            requests.add();
+            latencies.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - before)
+                                        .count());
+        }
+        std::sort(latencies.begin(), latencies.end());
+        auto at = [&latencies](double q) { return latencies[static_cast<std::size_t>(q * (latencies.size() - 1))]; };
+        std::printf("  %-28s p50 %6.0f ns  p99 %6.0f ns  p99.9 %8.0f ns  max %8.0f ns  dropped %llu\n", name,
+                    at(0.5), at(0.99), at(0.999), latencies.back(),
+                    static_cast<unsigned long long>(dropped(factory.exporter())));
+    }
+
+}
+
+int main() {
+    std::printf("%d emits into %zu KiB buffers, sink takes 200 us per buffer\n", emits, buffer_size / 1024);
+    run<csi::line_protocol_exporter<metadata, slow_sink>>("line_protocol_exporter");
+    run<csi::double_buffered_line_protocol_exporter<metadata, slow_sink>>("double_buffered, 2 buffers", 2);
+    run<csi::double_buffered_line_protocol_exporter<metadata, slow_sink>>("double_buffered, 3 buffers", 3);
+    return 0;
+}
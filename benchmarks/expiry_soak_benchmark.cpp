@@ -0,0 +1,90 @@
+#include "simple_instruments.h"
+#include "simple_instruments/instrument_family.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct metadata {
+        std::string name;
+    };
+
+    template <std::size_t N>
+    metadata with_labels(const metadata &md, const std::array<csi::label, N> &labels) {
+        auto result = md;
+        for (const auto &l : labels) result.name.append(",").append(l.name).append("=").append(l.value);
+        return result;
+    }
+
+    class null_exporter {
+    public:
+        using metadata_type = metadata;
+
+        template <typename Tvalue>
+        void emit_init(const Tvalue &, const metadata_type &) {}
+
+        template <typename Tvalue>
+        void emit(const Tvalue &, const metadata_type &) {}
+    };
+
+    constexpr int threads = 4;
+    constexpr int intervals = 200;
+    constexpr int connections_per_interval = 2000;
+
+    /// Resident set size in KiB, read from /proc/self/statm.
+    long resident_kib() {
+        std::ifstream statm{"/proc/self/statm"};
+        long size = 0;
+        long resident = 0;
+        statm >> size >> resident;
+        return resident * (sysconf(_SC_PAGESIZE) / 1024);
+    }
+
+}
+
+/// Simulates short lived connections that each get their own series, and expires idle series once per export
+/// interval. The number of series and the resident set size should stay flat instead of growing with the number of
+/// connections ever seen.
+int main() {
+    csi::instrument_factory<null_exporter> factory;
+    auto bytes = factory.make_atomic_monotonic_counter_family<std::uint64_t>({"bytes"}, {"connection"}, 0, 1u << 16);
+    std::atomic<int> interval{0};
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            while (!stop.load(std::memory_order_relaxed)) {
+                auto base = interval.load(std::memory_order_relaxed) * connections_per_interval;
+                for (int c = t; c < connections_per_interval; c += threads) {
+                    auto guard = bytes.pin();
+                    bytes.with(std::to_string(base + c)).add();
+                }
+            }
+        });
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < intervals; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        interval.fetch_add(1, std::memory_order_relaxed);
+        auto expired = bytes.expire_idle(1);
+        if (i % 20 == 0) {
+            std::printf("interval %4d series %6zu expired %6zu rejected %8llu rss %8ld KiB\n", i, bytes.size(),
+                        expired, static_cast<unsigned long long>(bytes.rejected()), resident_kib());
+        }
+    }
+    stop = true;
+    for (auto &w : workers) w.join();
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("%d connections in %.1f s, final series %zu rss %ld KiB\n", intervals * connections_per_interval,
+                seconds, bytes.size(), resident_kib());
+    return 0;
+}
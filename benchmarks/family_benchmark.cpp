@@ -0,0 +1,63 @@
+#include "simple_instruments.h"
+#include "simple_instruments/instrument_family.h"
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct metadata {
+        std::string name;
+    };
+
+    template <std::size_t N>
+    metadata with_labels(const metadata &md, const std::array<csi::label, N> &labels) {
+        auto result = md;
+        for (const auto &l : labels) result.name.append(",").append(l.name).append("=").append(l.value);
+        return result;
+    }
+
+    class null_exporter {
+    public:
+        using metadata_type = metadata;
+
+        template <typename Tvalue>
+        void emit_init(const Tvalue &, const metadata_type &) {}
+
+        template <typename Tvalue>
+        void emit(const Tvalue &, const metadata_type &) {}
+    };
+
+    constexpr int iterations = 20000000;
+
+    template <typename F>
+    double nanoseconds_per_call(F &&f) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) f(i);
+        auto stop = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(stop - start).count() / iterations;
+    }
+
+}
+
+int main() {
+    csi::instrument_factory<null_exporter> factory;
+    auto counter = factory.make_atomic_monotonic_counter<std::uint64_t>({"requests"});
+    auto family = factory.make_atomic_monotonic_counter_family<std::uint64_t>({"requests"}, {"endpoint", "status"});
+    std::vector<std::string> endpoints{"/api/v1/items", "/api/v1/users", "/api/v1/orders", "/health", "/login"};
+    std::vector<std::string> statuses{"200", "201", "304", "404", "500"};
+    for (const auto &e : endpoints) for (const auto &s : statuses) family.with(e, s);
+
+    auto plain = nanoseconds_per_call([&](int) { counter.add(); });
+    auto labeled = nanoseconds_per_call([&](int i) {
+        family.with(endpoints[static_cast<std::size_t>(i) % 5], statuses[static_cast<std::size_t>(i / 5) % 5]).add();
+    });
+    std::printf("%-32s %8.1f ns\n", "atomic_monotonic_counter::add", plain);
+    std::printf("%-32s %8.1f ns\n", "family.with(endpoint, status)", labeled);
+    std::printf("%-32s %8.1f ns\n", "lookup overhead", labeled - plain);
+    return 0;
+}
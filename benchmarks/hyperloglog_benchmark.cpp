@@ -0,0 +1,74 @@
+#include "simple_instruments.h"
+#include "simple_instruments/hyperloglog.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct metadata {
+        std::string name;
+    };
+
+    class null_exporter {
+    public:
+        using metadata_type = metadata;
+
+        template <typename Tvalue>
+        void emit_init(const Tvalue &, const metadata_type &) {}
+
+        template <typename Tvalue>
+        void emit(const Tvalue &, const metadata_type &) {}
+    };
+
+    template <typename F>
+    double nanoseconds_per_call(int calls, F &&f) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < calls; ++i) f();
+        auto stop = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(stop - start).count() / calls;
+    }
+
+    std::vector<std::uint8_t> random_registers(std::size_t size, std::uint64_t seed) {
+        std::mt19937_64 random{seed};
+        std::uniform_int_distribution<int> rank{0, 20};
+        std::vector<std::uint8_t> registers(size);
+        for (auto &r : registers) r = static_cast<std::uint8_t>(rank(random));
+        return registers;
+    }
+
+}
+
+int main() {
+    csi::instrument_factory<null_exporter> factory;
+    auto users = factory.make_atomic_distinct_counter({"users"});
+    std::uint64_t id = 0;
+    auto ns = nanoseconds_per_call(10000000, [&] { users.add(id++ % 1000000); });
+    std::printf("%-40s %8.1f ns\n", "add", ns);
+    std::printf("%-40s %8.1f ns\n", "collect", nanoseconds_per_call(1000, [&] { users.collect(); }));
+
+    auto size = std::size_t{1} << 14;
+    auto target = random_registers(size, 1);
+    auto source = random_registers(size, 2);
+    volatile double sink = 0;
+    std::printf("%-40s %8.1f ns\n", "merge, SIMD", nanoseconds_per_call(10000, [&] {
+        csi::detail::max_registers(target.data(), source.data(), size);
+        sink = sink + target[id++ % size];
+    }));
+    std::printf("%-40s %8.1f ns\n", "merge, scalar", nanoseconds_per_call(10000, [&] {
+        csi::detail::max_registers_scalar(target.data(), source.data(), size);
+        sink = sink + target[id++ % size];
+    }));
+    std::printf("%-40s %8.1f ns\n", "estimate sums, scalar", nanoseconds_per_call(10000, [&] {
+        sink = sink + csi::detail::sum_registers_scalar(target.data(), size).harmonic;
+    }));
+    std::printf("%-40s %8.1f ns\n", "estimate sums, SIMD", nanoseconds_per_call(10000, [&] {
+        sink = sink + csi::detail::sum_registers(target.data(), size).harmonic;
+    }));
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include "simple_instruments/line_protocol.h"
+#include "simple_instruments/number_format.h"
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    constexpr std::size_t count = 1000000;
+
+    template <typename F>
+    double nanoseconds_per_value(F &&f) {
+        auto start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < count; ++i) f(i);
+        auto stop = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(stop - start).count() / count;
+    }
+
+    template <typename Tvalue>
+    void compare(const char *name, const std::vector<Tvalue> &values) {
+        std::ostringstream stream;
+        char buffer[csi::max_number_chars];
+        std::size_t chars = 0;
+        std::printf("%s\n", name);
+        std::printf("  %-30s %8.1f ns\n", "std::ostream <<", nanoseconds_per_value([&](std::size_t i) {
+            stream.str({});
+            stream << values[i];
+            chars += stream.str().size();
+        }));
+        std::printf("  %-30s %8.1f ns\n", "std::to_chars", nanoseconds_per_value([&](std::size_t i) {
+            chars += static_cast<std::size_t>(std::to_chars(buffer, buffer + sizeof(buffer), values[i]).ptr - buffer);
+        }));
+        std::printf("  %-30s %8.1f ns\n", "format_number", nanoseconds_per_value([&](std::size_t i) {
+            chars += static_cast<std::size_t>(csi::format_number(buffer, values[i]) - buffer);
+        }));
+        if (chars == 0) std::printf("nothing was written\n");
+    }
+
+}
+
+int main() {
+    std::mt19937_64 random{1};
+    std::vector<std::uint64_t> counters(count);
+    for (auto &v : counters) v = random() >> (random() % 40 + 10);
+    std::vector<std::int64_t> timestamps(count);
+    auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    for (std::size_t i = 0; i < count; ++i) timestamps[i] = now + static_cast<std::int64_t>(i * 997);
+    std::vector<double> sums(count);
+    for (auto &v : sums) v = static_cast<double>(random() % 100000000);
+    std::vector<double> latencies(count);
+    std::lognormal_distribution<double> latency{-7, 1.5};
+    for (auto &v : latencies) v = latency(random);
+
+    compare("counters (uint64_t)", counters);
+    compare("nanosecond timestamps (int64_t)", timestamps);
+    compare("whole doubles", sums);
+    compare("fractional doubles", latencies);
+
+    std::string out;
+    out.reserve(64 * count);
+    std::printf("%-32s %8.1f ns\n", "append_line_protocol, counter", nanoseconds_per_value([&](std::size_t i) {
+        csi::append_line_protocol(out, "requests,host=a", counters[i], timestamps[i]);
+    }));
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include "simple_instruments.h"
+#include "simple_instruments/percpu_counter.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct metadata {
+        std::string name;
+    };
+
+    class null_exporter {
+    public:
+        using metadata_type = metadata;
+
+        template <typename Tvalue>
+        void emit_init(const Tvalue &, const metadata_type &) {}
+
+        template <typename Tvalue>
+        void emit(const Tvalue &, const metadata_type &) {}
+    };
+
+    constexpr int adds_per_thread = 20000000;
+
+    template <typename F>
+    double nanoseconds_per_add(int threads, F &&add) {
+        std::vector<std::thread> workers;
+        auto start = std::chrono::steady_clock::now();
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&add] {
+                for (int i = 0; i < adds_per_thread; ++i) add();
+            });
+        }
+        for (auto &w : workers) w.join();
+        auto stop = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(stop - start).count() / adds_per_thread / threads;
+    }
+
+}
+
+int main() {
+    csi::instrument_factory<null_exporter> factory;
+    auto bidirectional = factory.make_atomic_bidirectional_counter<std::int64_t>();
+    auto percpu = factory.make_atomic_percpu_counter();
+    std::atomic<std::int64_t> plain{0};
+    std::printf("rseq: %s, CPUs: %u\n", csi::atomic_percpu_counter<null_exporter>::uses_rseq() ? "yes" : "no",
+                std::thread::hardware_concurrency());
+
+    for (int threads : {1, 4, 16}) {
+        std::printf("%d thread(s)\n", threads);
+        std::printf("  %-40s %6.2f ns\n", "std::atomic fetch_add, relaxed", nanoseconds_per_add(threads, [&plain] {
+            plain.fetch_add(1, std::memory_order_relaxed);
+        }));
+        std::printf("  %-40s %6.2f ns\n", "atomic_bidirectional_counter::add", nanoseconds_per_add(threads, [&] {
+            bidirectional.add(1, std::memory_order_relaxed);
+        }));
+        std::printf("  %-40s %6.2f ns\n", "atomic_percpu_counter::add", nanoseconds_per_add(threads, [&percpu] {
+            percpu.add();
+        }));
+    }
+    if (percpu.collect() != plain.load()) std::printf("counts differ\n");
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "simple_instruments.h"
+#include "simple_instruments/quantile_sketch.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct metadata {
+        std::string name;
+    };
+
+    class null_exporter {
+    public:
+        using metadata_type = metadata;
+
+        template <typename Tvalue>
+        void emit_init(const Tvalue &, const metadata_type &) {}
+
+        template <typename Tvalue>
+        void emit(const Tvalue &, const metadata_type &) {}
+    };
+
+    constexpr std::size_t values_per_thread = 2000000;
+
+    std::vector<double> latencies(std::uint64_t seed) {
+        std::mt19937_64 random{seed};
+        std::lognormal_distribution<double> latency{-7, 1.5};
+        std::vector<double> values(values_per_thread);
+        for (auto &v : values) v = latency(random);
+        return values;
+    }
+
+    template <typename F>
+    double nanoseconds_per_value(int threads, F &&record) {
+        std::vector<std::vector<double>> values;
+        for (int t = 0; t < threads; ++t) values.push_back(latencies(static_cast<std::uint64_t>(t)));
+        std::vector<std::thread> workers;
+        auto start = std::chrono::steady_clock::now();
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&record, &v = values[static_cast<std::size_t>(t)]] {
+                for (auto value : v) record(value);
+            });
+        }
+        for (auto &w : workers) w.join();
+        auto stop = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(stop - start).count() /
+               static_cast<double>(values_per_thread * static_cast<std::size_t>(threads));
+    }
+
+}
+
+int main() {
+    csi::instrument_factory<null_exporter> factory;
+    auto recorder = factory.make_atomic_quantile_recorder<double>({"latency"});
+
+    for (int threads : {1, 4}) {
+        auto ns = nanoseconds_per_value(threads, [&recorder](double v) { recorder.record(v); });
+        recorder.collect();
+        std::printf("%-40s %8.1f ns\n", (std::to_string(threads) + " thread(s), sketch record").c_str(), ns);
+    }
+
+    auto values = latencies(99);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<double> exact;
+    for (auto v : values) exact.push_back(v);
+    std::sort(exact.begin(), exact.end());
+    auto stop = std::chrono::steady_clock::now();
+    std::printf("%-40s %8.1f ns\n", "1 thread, store and sort per value",
+                std::chrono::duration<double, std::nano>(stop - start).count() / static_cast<double>(values.size()));
+
+    for (auto v : values) recorder.record(v);
+    auto &sketch = recorder.collect();
+    std::printf("\n%-8s %14s %14s %10s\n", "quantile", "exact", "sketch", "error");
+    for (double q : {0.5, 0.9, 0.99, 0.999, 0.9999}) {
+        auto e = exact[static_cast<std::size_t>(q * static_cast<double>(exact.size() - 1))];
+        auto s = sketch.quantile(q);
+        std::printf("%-8g %14.9f %14.9f %9.4f%%\n", q, e, s, 100 * std::abs(s - e) / e);
+    }
+    std::printf("\nsketch buckets %zu, shard size %zu KiB\n", sketch.buckets(), sketch.buckets() * 8 / 1024);
+    return 0;
+}
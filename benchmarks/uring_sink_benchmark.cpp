@@ -0,0 +1,112 @@
+#include "simple_instruments/line_protocol.h"
+#include "simple_instruments/uring_sink.h"
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    constexpr std::size_t buffer_size = 64 * 1024;
+    constexpr std::size_t total_bytes = std::size_t{512} * 1024 * 1024;
+
+    struct result {
+        double write_seconds;
+        double total_seconds;
+    };
+
+    /// Time spent in write, which is what the exporter holding its lock waits for, and the time until everything
+    /// was written.
+    template <typename Tsink>
+    result run(Tsink &sink) {
+        std::string buffer(buffer_size, 'x');
+        for (std::size_t i = 0; i < buffer_size; i += 64) buffer[i] = '\n';
+        std::chrono::steady_clock::duration writing{};
+        auto start = std::chrono::steady_clock::now();
+        for (std::size_t written = 0; written < total_bytes; written += buffer_size) {
+            auto copy = buffer;
+            auto before = std::chrono::steady_clock::now();
+            sink.write(std::move(copy));
+            writing += std::chrono::steady_clock::now() - before;
+        }
+        sink.flush();
+        auto stop = std::chrono::steady_clock::now();
+        return {std::chrono::duration<double>(writing).count(), std::chrono::duration<double>(stop - start).count()};
+    }
+
+    void print(const char *name, result r) {
+        auto mib = static_cast<double>(total_bytes) / (1024 * 1024);
+        auto writes = static_cast<double>(total_bytes / buffer_size);
+        std::printf("  %-28s %8.0f MiB/s %8.2f us per write\n", name, mib / r.total_seconds,
+                    r.write_seconds * 1e6 / writes);
+    }
+
+    void file(const char *name, csi::sink_backend backend, std::size_t depth) {
+        auto path = (std::filesystem::temp_directory_path() / "uring_sink_benchmark.lp").string();
+        std::filesystem::remove(path);
+        result r{};
+        {
+            csi::uring_sink sink{path, depth, buffer_size, backend};
+            r = run(sink);
+        }
+        std::filesystem::remove(path);
+        print(name, r);
+    }
+
+    void file_stream() {
+        auto path = (std::filesystem::temp_directory_path() / "uring_sink_benchmark.lp").string();
+        std::filesystem::remove(path);
+        result r{};
+        {
+            csi::file_sink sink{path};
+            r = run(sink);
+        }
+        std::filesystem::remove(path);
+        print("file_sink (ofstream)", r);
+    }
+
+    void socket(const char *name, csi::sink_backend backend, std::size_t depth) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) return;
+        std::thread reader{[fd = fds[1]] {
+            static char chunk[256 * 1024];
+            while (::read(fd, chunk, sizeof(chunk)) > 0) {}
+        }};
+        result r{};
+        {
+            csi::uring_sink sink{fds[0], depth, buffer_size, backend};
+            r = run(sink);
+        }
+        shutdown(fds[0], SHUT_WR);
+        reader.join();
+        ::close(fds[0]);
+        ::close(fds[1]);
+        print(name, r);
+    }
+
+}
+
+int main() {
+    {
+        csi::uring_sink probe{STDOUT_FILENO, 1, 4096};
+        std::printf("io_uring available: %s, registered: %s\n",
+                    probe.backend() == csi::sink_backend::io_uring ? "yes" : "no", probe.registered() ? "yes" : "no");
+    }
+    std::printf("%zu MiB in %zu KiB buffers to a file in %s\n", total_bytes >> 20, buffer_size >> 10,
+                std::filesystem::temp_directory_path().c_str());
+    file_stream();
+    file("writev, 8 per call", csi::sink_backend::writev, 8);
+    file("io_uring, 1 in flight", csi::sink_backend::io_uring, 1);
+    file("io_uring, 8 in flight", csi::sink_backend::io_uring, 8);
+    file("io_uring, 32 in flight", csi::sink_backend::io_uring, 32);
+    std::printf("to a unix stream socket\n");
+    socket("writev, 8 per call", csi::sink_backend::writev, 8);
+    socket("io_uring, 1 in flight", csi::sink_backend::io_uring, 1);
+    socket("io_uring, 8 in flight", csi::sink_backend::io_uring, 8);
+    return 0;
+}
@@ -2,18 +2,193 @@
 #define CROSSCODE_SIMPLE_INSTRUMENTS_H
 #include <memory>
 #include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 
 namespace crosscode::simple_instruments {
 
+    namespace detail {
+        struct no_handle {};
+
+        template <typename Texporter, typename = void>
+        struct exporter_handle {
+            using type = no_handle;
+        };
+
+        template <typename Texporter>
+        struct exporter_handle<Texporter, std::void_t<typename Texporter::handle_type>> {
+            using type = typename Texporter::handle_type;
+        };
+
+        template <typename Texporter, typename = void>
+        struct exporter_has_release : std::false_type {};
+
+        template <typename Texporter>
+        struct exporter_has_release<Texporter, std::void_t<decltype(std::declval<Texporter &>().release(
+                std::declval<const typename exporter_handle<Texporter>::type &>(),
+                std::declval<const typename Texporter::metadata_type &>()))>> : std::true_type {};
+    }
+
+    /// The per instrument state an exporter asks instruments to keep. Exporters that define a handle_type return a
+    /// handle from emit_init, receive it again as last argument of every emit, and can optionally implement
+    /// release(handle, metadata) which is called when the instrument is destroyed.
+    template <typename Texporter>
+    using exporter_handle_t = typename detail::exporter_handle<Texporter>::type;
+
+    template <typename Texporter>
+    inline constexpr bool exporter_has_handle_v = !std::is_same_v<exporter_handle_t<Texporter>, detail::no_handle>;
+
+    namespace detail {
+        /// Calls emit_init on an exporter and returns its handle, or no_handle when the exporter has no handle_type.
+        template <typename Texporter, typename Tvalue>
+        exporter_handle_t<Texporter> emit_init(Texporter &exporter, const Tvalue &value,
+                                               const typename Texporter::metadata_type &md) {
+            if constexpr (exporter_has_handle_v<Texporter>) {
+                return exporter.emit_init(value, md);
+            } else {
+                exporter.emit_init(value, md);
+                return {};
+            }
+        }
+
+        template <typename Texporter, typename Tvalue>
+        void emit(Texporter &exporter, const Tvalue &value, const typename Texporter::metadata_type &md,
+                  const exporter_handle_t<Texporter> &handle) {
+            if constexpr (exporter_has_handle_v<Texporter>) {
+                exporter.emit(value, md, handle);
+            } else {
+                exporter.emit(value, md);
+            }
+        }
+
+        template <typename Texporter, typename Tvalue, typename = void>
+        struct exporter_has_emit_change : std::false_type {};
+
+        template <typename Texporter, typename Tvalue>
+        struct exporter_has_emit_change<Texporter, Tvalue, std::void_t<
+                decltype(std::declval<Texporter &>().emit_add(std::declval<const Tvalue &>(),
+                        std::declval<const Tvalue &>(), std::declval<const typename Texporter::metadata_type &>(),
+                        std::declval<const exporter_handle_t<Texporter> &>())),
+                decltype(std::declval<Texporter &>().emit_sub(std::declval<const Tvalue &>(),
+                        std::declval<const Tvalue &>(), std::declval<const typename Texporter::metadata_type &>(),
+                        std::declval<const exporter_handle_t<Texporter> &>()))>> : std::true_type {};
+
+        /// Sends the change of a counter by amount, which resulted in value. Exporters that keep their own copy of the
+        /// value can implement emit_add(amount, value, metadata, handle) and emit_sub(...) to apply the change instead
+        /// of storing value, which may be overtaken by a later change of another thread. Others receive emit(value).
+        template <typename Texporter, typename Tvalue>
+        void emit_add(Texporter &exporter, const Tvalue &amount, const Tvalue &value,
+                      const typename Texporter::metadata_type &md, const exporter_handle_t<Texporter> &handle) {
+            if constexpr (exporter_has_emit_change<Texporter, Tvalue>::value) {
+                exporter.emit_add(amount, value, md, handle);
+            } else {
+                emit(exporter, value, md, handle);
+            }
+        }
+
+        template <typename Texporter, typename Tvalue>
+        void emit_sub(Texporter &exporter, const Tvalue &amount, const Tvalue &value,
+                      const typename Texporter::metadata_type &md, const exporter_handle_t<Texporter> &handle) {
+            if constexpr (exporter_has_emit_change<Texporter, Tvalue>::value) {
+                exporter.emit_sub(amount, value, md, handle);
+            } else {
+                emit(exporter, value, md, handle);
+            }
+        }
+
+        template <typename Texporter>
+        void release(Texporter &exporter, const exporter_handle_t<Texporter> &handle,
+                     const typename Texporter::metadata_type &md) {
+            if constexpr (exporter_has_release<Texporter>::value) {
+                exporter.release(handle, md);
+            }
+        }
+    }
+
+    namespace detail {
+        template <typename Tmetadata>
+        inline constexpr bool metadata_uses_memory_resource_v =
+                std::uses_allocator_v<Tmetadata, std::pmr::polymorphic_allocator<std::byte>>;
+
+        /// Moves metadata into memory from resource when the metadata type is allocator aware, as std::pmr
+        /// containers are: it declares an allocator_type that a polymorphic_allocator converts to, and can be
+        /// constructed from (metadata, allocator). Otherwise, or when resource is nullptr, metadata is returned as is.
+        template <typename Tmetadata>
+        Tmetadata adopt_metadata(Tmetadata &&metadata, std::pmr::memory_resource *resource) {
+            if constexpr (metadata_uses_memory_resource_v<Tmetadata>) {
+                if (resource != nullptr) {
+                    return Tmetadata(std::move(metadata), std::pmr::polymorphic_allocator<std::byte>{resource});
+                }
+            }
+            return std::move(metadata);
+        }
+
+        /// Creates an object in memory from resource, or with new when resource is nullptr.
+        template <typename T, typename ...Args>
+        T *new_object(std::pmr::memory_resource *resource, Args &&...args) {
+            if (resource == nullptr) return new T(std::forward<Args>(args)...);
+            void *p = resource->allocate(sizeof(T), alignof(T));
+            try {
+                return ::new (p) T(std::forward<Args>(args)...);
+            } catch (...) {
+                resource->deallocate(p, sizeof(T), alignof(T));
+                throw;
+            }
+        }
+
+        template <typename T>
+        void delete_object(std::pmr::memory_resource *resource, T *object) {
+            if (resource == nullptr) {
+                delete object;
+            } else if (object != nullptr) {
+                object->~T();
+                resource->deallocate(object, sizeof(T), alignof(T));
+            }
+        }
+    }
+
     template <typename Tvalue, typename Texporter>
     struct data_block  {
         using value_type = Tvalue;
         using metadata_type = typename Texporter::metadata_type;
         using exporter_type = Texporter;
         using exporter_shared_ptr_type = std::shared_ptr<exporter_type>;
+        using handle_type = exporter_handle_t<exporter_type>;
         exporter_shared_ptr_type exporter_;
         metadata_type metadata_;
         value_type value_;
+        handle_type handle_{};
+
+        ~data_block() {
+            if (exporter_) detail::release(*exporter_, handle_, metadata_);
+        }
+
+        template <typename T>
+        void emit_init(const T &value) {
+            handle_ = detail::emit_init(*exporter_, value, metadata_);
+        }
+
+        template <typename T>
+        void emit(const T &value) const {
+            detail::emit(*exporter_, value, metadata_, handle_);
+        }
+
+        template <typename T>
+        void emit_add(const T &amount, const T &value) const {
+            detail::emit_add(*exporter_, amount, value, metadata_, handle_);
+        }
+
+        template <typename T>
+        void emit_sub(const T &amount, const T &value) const {
+            detail::emit_sub(*exporter_, amount, value, metadata_, handle_);
+        }
     };
 
     template <typename Tvalue, typename Texporter>
@@ -27,15 +202,15 @@ namespace crosscode::simple_instruments {
         template <typename ...Args>
         explicit atomic_value_recorder(Args ...args) : data_{std::forward<Args>(args)...} {
             value_type value = data_.value_.load();
-            data_.exporter_->emit_init(value, data_.metadata_);
+            data_.emit_init(value);
         }
 
-        void set(value_type amount, std::memory_order mem_order = std::memory_order::memory_order_seq_cst) {
+        void set(value_type amount, std::memory_order mem_order = std::memory_order_seq_cst) {
             data_.value_.store(amount,mem_order);
-            data_.exporter_->emit(amount, data_.metadata_);
+            data_.emit(amount);
         }
 
-        value_type value(std::memory_order mem_order = std::memory_order::memory_order_seq_cst) {
+        value_type value(std::memory_order mem_order = std::memory_order_seq_cst) {
             return data_.value_.load(mem_order);
         }
     };
@@ -51,42 +226,331 @@ namespace crosscode::simple_instruments {
         template <typename ...Args>
         explicit atomic_bidirectional_counter(Args ...args) : data_{std::forward<Args>(args)...} {
             value_type value = data_.value_.load();
-            data_.exporter_->emit_init(value, data_.metadata_);
+            data_.emit_init(value);
         }
 
-        void add(value_type amount=step, std::memory_order mem_order = std::memory_order::memory_order_seq_cst) {
+        void add(value_type amount=step, std::memory_order mem_order = std::memory_order_seq_cst) {
             value_type new_value = value_type{data_.value_.fetch_add(amount, mem_order)} + amount;
-            data_.exporter_->emit(new_value, data_.metadata_);
+            data_.emit_add(amount, new_value);
         }
 
-        void sub(value_type amount=step, std::memory_order mem_order = std::memory_order::memory_order_seq_cst) {
+        void sub(value_type amount=step, std::memory_order mem_order = std::memory_order_seq_cst) {
             value_type new_value = value_type{data_.value_.fetch_sub(amount, mem_order)} - amount;
-            data_.exporter_->emit(new_value, data_.metadata_);
+            data_.emit_sub(amount, new_value);
         }
 
-        value_type value(std::memory_order mem_order = std::memory_order::memory_order_seq_cst) {
+        value_type value(std::memory_order mem_order = std::memory_order_seq_cst) {
             return data_.value_.load(mem_order);
         }
     };
 
+    namespace detail {
+        /// Entry of the list of live local_counter_handles, which request_local_counter_flush() walks.
+        struct local_counter_node {
+            void (*flush_pending)(local_counter_node &){nullptr};
+            local_counter_node *prev{nullptr};
+            local_counter_node *next{nullptr};
+        };
+
+        struct local_counter_registry {
+            std::mutex mutex;
+            local_counter_node head;
+
+            local_counter_registry() {
+                head.prev = &head;
+                head.next = &head;
+            }
+
+            /// Call with mutex locked.
+            void link(local_counter_node &node) {
+                node.prev = head.prev;
+                node.next = &head;
+                head.prev->next = &node;
+                head.prev = &node;
+            }
+
+            /// Call with mutex locked.
+            void unlink(local_counter_node &node) {
+                node.prev->next = node.next;
+                node.next->prev = node.prev;
+                node.prev = nullptr;
+                node.next = nullptr;
+            }
+        };
+
+        inline local_counter_registry &local_counters() {
+            static local_counter_registry registry;
+            return registry;
+        }
+    }
+
+    /// Hands the pending increments of every live local_counter_handle to its counter, from the calling thread, so
+    /// increments of threads that went idle are counted too. Call it before collecting, for example as the first task
+    /// of a collector.
+    inline void request_local_counter_flush() {
+        auto &registry = detail::local_counters();
+        std::lock_guard lock{registry.mutex};
+        for (auto node = registry.head.next; node != &registry.head; node = node->next) node->flush_pending(*node);
+    }
+
+    /// Counts for one thread into an integer that only that thread writes, and adds the total to the counter it came
+    /// from every flush_every increments, on flush(), when it is destroyed, and when any thread calls
+    /// request_local_counter_flush(). For counters in loops so tight that even an uncontended atomic addition shows.
+    /// Between flushes the counter lags behind by the pending increments, at most flush_every - 1. Use a handle from
+    /// one thread only; creating, moving and destroying it take a lock shared by all handles.
+    ///
+    /// The handle publishes the number of increments it counted, and both the handle and
+    /// request_local_counter_flush() move the number already added to the counter forward with compare and swap, so
+    /// every increment is added exactly once.
+    template <typename Tcounter>
+    class local_counter_handle : detail::local_counter_node {
+    public:
+        using value_type = typename Tcounter::value_type;
+    private:
+        Tcounter *counter_;
+        std::size_t count_{0};
+        std::size_t flush_every_;
+        std::atomic<std::uint64_t> counted_{0};
+        std::atomic<std::uint64_t> added_{0};
+
+        static void flush_node(detail::local_counter_node &node) {
+            static_cast<local_counter_handle &>(node).add_counted();
+        }
+
+        void add_counted() {
+            auto counted = counted_.load(std::memory_order_relaxed);
+            auto added = added_.load(std::memory_order_relaxed);
+            while (added < counted && !added_.compare_exchange_weak(added, counted, std::memory_order_relaxed)) {}
+            if (added < counted && counter_ != nullptr) {
+                counter_->add_pending(static_cast<value_type>(static_cast<value_type>(counted - added) *
+                                                              Tcounter::step_value));
+            }
+        }
+
+    public:
+        local_counter_handle(Tcounter &counter, std::size_t flush_every)
+                : counter_{&counter}, flush_every_{flush_every == 0 ? 1 : flush_every} {
+            flush_pending = &flush_node;
+            auto &registry = detail::local_counters();
+            std::lock_guard lock{registry.mutex};
+            registry.link(*this);
+        }
+
+        local_counter_handle(local_counter_handle &&other) noexcept
+                : counter_{nullptr}, count_{std::exchange(other.count_, 0)}, flush_every_{other.flush_every_} {
+            flush_pending = &flush_node;
+            auto &registry = detail::local_counters();
+            std::lock_guard lock{registry.mutex};
+            counter_ = std::exchange(other.counter_, nullptr);
+            counted_.store(other.counted_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            added_.store(other.added_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            registry.unlink(other);
+            registry.link(*this);
+        }
+
+        local_counter_handle(const local_counter_handle &) = delete;
+        local_counter_handle &operator=(const local_counter_handle &) = delete;
+        local_counter_handle &operator=(local_counter_handle &&) = delete;
+
+        ~local_counter_handle() {
+            if (next != nullptr) {
+                auto &registry = detail::local_counters();
+                std::lock_guard lock{registry.mutex};
+                registry.unlink(*this);
+            }
+            flush();
+        }
+
+        void add() {
+            counted_.store(counted_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            if (++count_ >= flush_every_) flush();
+        }
+
+        /// Adds the pending increments to the counter, which sends the new value to the exporter.
+        void flush() {
+            count_ = 0;
+            add_counted();
+        }
+
+        /// Increments not added to the counter yet.
+        value_type pending() const {
+            auto counted = counted_.load(std::memory_order_relaxed);
+            auto added = added_.load(std::memory_order_relaxed);
+            return added < counted ? static_cast<value_type>(static_cast<value_type>(counted - added) *
+                                                             Tcounter::step_value) : value_type{0};
+        }
+    };
+
     template <typename Tvalue, typename Texporter, Tvalue step>
     class atomic_monotonic_counter {
     public:
         using value_type = Tvalue;
         using exporter_type = Texporter;
+        static constexpr value_type step_value = step;
     private:
         atomic_bidirectional_counter<value_type,exporter_type,step> counter_;
+
+        friend class local_counter_handle<atomic_monotonic_counter>;
+
+        void add_pending(value_type amount) {
+            counter_.add(amount);
+        }
     public:
         template <typename ...Args>
         explicit atomic_monotonic_counter(Args ...args) : counter_{std::forward<Args>(args)...} {}
 
-        void add(std::memory_order mem_order = std::memory_order::memory_order_seq_cst) {
+        void add(std::memory_order mem_order = std::memory_order_seq_cst) {
             counter_.add(step,mem_order);
         }
 
-        value_type value(std::memory_order mem_order = std::memory_order::memory_order_seq_cst) {
+        value_type value(std::memory_order mem_order = std::memory_order_seq_cst) {
             return counter_.value(mem_order);
         }
+
+        /// A handle that counts for the calling thread and adds to this counter every flush_every increments. The
+        /// counter must outlive it.
+        local_counter_handle<atomic_monotonic_counter> local(std::size_t flush_every = 1024) {
+            return {*this, flush_every};
+        }
+    };
+
+    /// A monotonic counter that keeps a narrow atomic of type Tnarrow on the hot path, but never wraps: it counts how
+    /// often the narrow value crosses half of its range, and reconstructs a 64 bit value from both. The exporter
+    /// receives that std::uint64_t value, so consumers computing rates never see the jumps of a wrapping counter.
+    ///
+    /// The count of crossings is updated after the narrow value, so a reader can see a narrow value that already
+    /// crossed. Readers load the count before the narrow value, so it is never ahead of it, and correct it from the
+    /// half the narrow value is in. That is exact as long as less than half of the range of Tnarrow is added while a
+    /// thread is between loading the count and its own update. Use 16 bit or wider types.
+    template <typename Tnarrow, typename Texporter, Tnarrow step>
+    class atomic_wide_monotonic_counter {
+        static_assert(std::is_integral_v<Tnarrow> && !std::is_same_v<Tnarrow, bool>, "Tnarrow must be an integer");
+        using narrow_type = std::make_unsigned_t<Tnarrow>;
+        static constexpr narrow_type half = narrow_type{1} << (sizeof(narrow_type) * 8 - 1);
+        static constexpr narrow_type increment = static_cast<narrow_type>(step);
+        static_assert(step > 0 && increment <= half, "step must be positive and at most half the range of Tnarrow");
+    public:
+        using value_type = std::uint64_t;
+        using exporter_type = Texporter;
+    private:
+        data_block<std::atomic<narrow_type>,exporter_type> data_;
+        std::atomic<std::uint64_t> crossings_;
+
+        static std::uint64_t crossings(value_type value) {
+            auto low = static_cast<narrow_type>(value);
+            return (value >> (sizeof(narrow_type) * 4) >> (sizeof(narrow_type) * 4)) * 2 + (low >= half ? 1 : 0);
+        }
+
+        static value_type combine(std::uint64_t crossings, narrow_type low) {
+            if ((low >= half) != ((crossings & 1u) != 0)) ++crossings;
+            return ((crossings / 2) << (sizeof(narrow_type) * 4) << (sizeof(narrow_type) * 4)) + low;
+        }
+    public:
+        atomic_wide_monotonic_counter(std::shared_ptr<exporter_type> exporter,
+                                      typename exporter_type::metadata_type metadata, value_type value = 0)
+                : data_{std::move(exporter), std::move(metadata), static_cast<narrow_type>(value)},
+                  crossings_{crossings(value)} {
+            data_.emit_init(value);
+        }
+
+        void add(std::memory_order mem_order = std::memory_order_seq_cst) {
+            // Loaded before the addition, so it never includes a crossing made by a later addition; combine() only
+            // corrects a count that is behind.
+            auto c = crossings_.load(std::memory_order_acquire);
+            auto old = data_.value_.fetch_add(increment, mem_order);
+            auto low = static_cast<narrow_type>(old + increment);
+            if ((old < half && low >= half) || low < old) crossings_.fetch_add(1, std::memory_order_acq_rel);
+            data_.emit_add(value_type{increment}, combine(c, low));
+        }
+
+        value_type value(std::memory_order mem_order = std::memory_order_seq_cst) {
+            auto c = crossings_.load(std::memory_order_acquire);
+            return combine(c, data_.value_.load(mem_order));
+        }
+    };
+
+    /// Defined in simple_instruments/aggregate_recorder.h
+    template <typename Tvalue, typename Texporter>
+    class atomic_aggregate_recorder;
+
+    /// Defined in simple_instruments/quantile_sketch.h
+    template <typename Tvalue, typename Texporter>
+    class atomic_quantile_recorder;
+
+    /// Defined in simple_instruments/ewma.h
+    template <typename Tvalue, typename Texporter>
+    class atomic_ewma;
+
+    enum class ewma_mode;
+
+    /// Defined in simple_instruments/top_k.h
+    template <typename Texporter>
+    class atomic_top_k;
+
+    /// Defined in simple_instruments/hyperloglog.h
+    template <typename Texporter>
+    class atomic_distinct_counter;
+
+    /// Defined in simple_instruments/counter_array.h
+    template <typename Texporter>
+    class atomic_counter_array;
+
+    /// Defined in simple_instruments/percpu_counter.h
+    template <typename Texporter>
+    class atomic_percpu_counter;
+
+    /// Defined in simple_instruments/instrument_group.h
+    template <typename Texporter>
+    class atomic_instrument_group;
+
+    /// Defined in simple_instruments/instrument_family.h
+    template <typename Tinstrument, std::size_t Nlabels>
+    class instrument_family;
+
+    /// Limits the number of series that all instrument families of a factory can create together.
+    class series_limit {
+        std::atomic<std::size_t> max_;
+        std::atomic<std::size_t> used_{0};
+        std::atomic<std::uint64_t> rejected_{0};
+    public:
+        explicit series_limit(std::size_t max = static_cast<std::size_t>(-1)) : max_{max} {}
+
+        bool try_acquire() {
+            auto used = used_.load(std::memory_order_relaxed);
+            do {
+                if (used >= max_.load(std::memory_order_relaxed)) return false;
+            } while (!used_.compare_exchange_weak(used, used + 1, std::memory_order_relaxed));
+            return true;
+        }
+
+        void release(std::size_t count) {
+            used_.fetch_sub(count, std::memory_order_relaxed);
+        }
+
+        bool exhausted() const {
+            return used_.load(std::memory_order_relaxed) >= max_.load(std::memory_order_relaxed);
+        }
+
+        void reject() {
+            rejected_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void max(std::size_t max) {
+            max_.store(max, std::memory_order_relaxed);
+        }
+
+        std::size_t max() const {
+            return max_.load(std::memory_order_relaxed);
+        }
+
+        std::size_t used() const {
+            return used_.load(std::memory_order_relaxed);
+        }
+
+        /// Number of lookups of a label combination that was folded into an overflow series.
+        std::uint64_t rejected() const {
+            return rejected_.load(std::memory_order_relaxed);
+        }
     };
 
     template <typename Texporter>
@@ -97,28 +561,144 @@ namespace crosscode::simple_instruments {
         using exporter_shared_ptr_type = std::shared_ptr<exporter_type>;
     private:
         exporter_shared_ptr_type impl_;
+        std::shared_ptr<series_limit> series_limit_{std::make_shared<series_limit>()};
+        std::pmr::memory_resource *memory_{nullptr};
+
+        metadata_type adopt(metadata_type &&metadata) const {
+            return detail::adopt_metadata(std::move(metadata), memory_);
+        }
     public:
         template <typename ...Args>
         explicit instrument_factory(Args ...args) : impl_{std::make_shared<exporter_type>(std::forward<Args>(args)...)} {}
 
         template<typename Tvalue, Tvalue step=1>
         auto make_atomic_bidirectional_counter(metadata_type metadata = {}, Tvalue value = 0) {
-            return atomic_bidirectional_counter<Tvalue,Texporter,step>{impl_, std::move(metadata), value};
+            return atomic_bidirectional_counter<Tvalue,Texporter,step>{impl_, adopt(std::move(metadata)), value};
         }
 
         template<typename Tvalue, Tvalue step=1>
         auto make_atomic_monotonic_counter(metadata_type metadata = {}, Tvalue value = 0) {
-            return atomic_monotonic_counter<Tvalue,Texporter,step>{impl_, std::move(metadata), value};
+            return atomic_monotonic_counter<Tvalue,Texporter,step>{impl_, adopt(std::move(metadata)), value};
+        }
+
+        /// A monotonic counter that exports std::uint64_t values while keeping a Tnarrow atomic on the hot path.
+        template<typename Tnarrow, Tnarrow step=1>
+        auto make_atomic_wide_monotonic_counter(metadata_type metadata = {}, std::uint64_t value = 0) {
+            return atomic_wide_monotonic_counter<Tnarrow,Texporter,step>{impl_, adopt(std::move(metadata)), value};
         }
 
         template<typename Tvalue>
         auto make_atomic_value_recorder_counter(metadata_type metadata = {}, Tvalue value = 0) {
-            return atomic_value_recorder<Tvalue,Texporter>{impl_, std::move(metadata), value};
+            return atomic_value_recorder<Tvalue,Texporter>{impl_, adopt(std::move(metadata)), value};
+        }
+
+        /// Include simple_instruments/aggregate_recorder.h to use it.
+        template<typename Tvalue>
+        auto make_atomic_aggregate_recorder(metadata_type metadata = {}) {
+            return atomic_aggregate_recorder<Tvalue,Texporter>{impl_, adopt(std::move(metadata))};
+        }
+
+        /// Include simple_instruments/quantile_sketch.h to use it. Quantiles are within relative_accuracy of the exact
+        /// value for values between min_value and max_value.
+        template<typename Tvalue>
+        auto make_atomic_quantile_recorder(metadata_type metadata = {}, double relative_accuracy = 0.01,
+                                           double min_value = 1e-9, double max_value = 1e9) {
+            return atomic_quantile_recorder<Tvalue,Texporter>{impl_, adopt(std::move(metadata)), relative_accuracy,
+                                                              min_value, max_value};
+        }
+
+        /// Include simple_instruments/ewma.h to use it. Averages with the 1, 5 and 15 minute half-lives by default.
+        template<typename Tvalue, typename ...Thalf_lives>
+        auto make_atomic_ewma(metadata_type metadata, ewma_mode mode, Thalf_lives ...half_lives) {
+            if constexpr (sizeof...(Thalf_lives) == 0) {
+                return make_atomic_ewma<Tvalue>(std::move(metadata), mode, std::chrono::minutes(1),
+                                                std::chrono::minutes(5), std::chrono::minutes(15));
+            } else {
+                return atomic_ewma<Tvalue,Texporter>{impl_, adopt(std::move(metadata)), mode,
+                                                     {std::chrono::duration<double>(half_lives)...}};
+            }
+        }
+
+        /// Include simple_instruments/top_k.h to use it. Keeps capacity counters for the keys, 8 * k when 0.
+        auto make_atomic_top_k(metadata_type metadata, std::size_t k, std::size_t capacity = 0) {
+            return atomic_top_k<Texporter>{impl_, adopt(std::move(metadata)), k, capacity};
+        }
+
+        /// Include simple_instruments/hyperloglog.h to use it. Uses 2^precision registers of one byte.
+        auto make_atomic_distinct_counter(metadata_type metadata = {}, unsigned precision = 14) {
+            return atomic_distinct_counter<Texporter>{impl_, adopt(std::move(metadata)), precision};
+        }
+
+        /// Include simple_instruments/counter_array.h to use it.
+        auto make_atomic_counter_array(metadata_type metadata, std::size_t size) {
+            return atomic_counter_array<Texporter>{impl_, adopt(std::move(metadata)), size};
+        }
+
+        /// Include simple_instruments/percpu_counter.h to use it. Linux only.
+        auto make_atomic_percpu_counter(metadata_type metadata = {}, std::int64_t value = 0) {
+            return atomic_percpu_counter<Texporter>{impl_, adopt(std::move(metadata)), value};
+        }
+
+        /// Include simple_instruments/instrument_group.h to use it.
+        auto make_atomic_instrument_group(metadata_type metadata, std::size_t size) {
+            return atomic_instrument_group<Texporter>{impl_, adopt(std::move(metadata)), size};
+        }
+
+        template<typename Tvalue, Tvalue step=1, std::size_t Nlabels>
+        auto make_atomic_bidirectional_counter_family(metadata_type metadata, const std::string_view (&label_names)[Nlabels],
+                                                      Tvalue value = 0, std::size_t max_series = 1024) {
+            using instrument_type = atomic_bidirectional_counter<Tvalue,Texporter,step>;
+            return instrument_family<instrument_type,Nlabels>{impl_, adopt(std::move(metadata)), label_names, value,
+                                                              max_series, series_limit_, memory_};
+        }
+
+        template<typename Tvalue, Tvalue step=1, std::size_t Nlabels>
+        auto make_atomic_monotonic_counter_family(metadata_type metadata, const std::string_view (&label_names)[Nlabels],
+                                                  Tvalue value = 0, std::size_t max_series = 1024) {
+            using instrument_type = atomic_monotonic_counter<Tvalue,Texporter,step>;
+            return instrument_family<instrument_type,Nlabels>{impl_, adopt(std::move(metadata)), label_names, value,
+                                                              max_series, series_limit_, memory_};
+        }
+
+        template<typename Tnarrow, Tnarrow step=1, std::size_t Nlabels>
+        auto make_atomic_wide_monotonic_counter_family(metadata_type metadata,
+                                                       const std::string_view (&label_names)[Nlabels],
+                                                       std::uint64_t value = 0, std::size_t max_series = 1024) {
+            using instrument_type = atomic_wide_monotonic_counter<Tnarrow,Texporter,step>;
+            return instrument_family<instrument_type,Nlabels>{impl_, adopt(std::move(metadata)), label_names, value,
+                                                              max_series, series_limit_, memory_};
+        }
+
+        template<typename Tvalue, std::size_t Nlabels>
+        auto make_atomic_value_recorder_family(metadata_type metadata, const std::string_view (&label_names)[Nlabels],
+                                               Tvalue value = 0, std::size_t max_series = 1024) {
+            using instrument_type = atomic_value_recorder<Tvalue,Texporter>;
+            return instrument_family<instrument_type,Nlabels>{impl_, adopt(std::move(metadata)), label_names, value,
+                                                              max_series, series_limit_, memory_};
         }
 
         exporter_type& exporter() {
             return *(impl_);
         }
+
+        /// The limit on the number of series all families created by this factory have together. Unlimited unless
+        /// changed with series().max(n).
+        series_limit& series() {
+            return *series_limit_;
+        }
+
+        /// Makes the factory allocate metadata and the children of families from resource, for example an
+        /// instrument_arena from simple_instruments/arena.h. Metadata is only moved into the resource when its type is
+        /// allocator aware, see detail::adopt_metadata. The resource must outlive every instrument of the factory.
+        /// Passing nullptr restores the default allocator.
+        void use_memory_resource(std::pmr::memory_resource *resource) {
+            memory_ = resource;
+        }
+
+        /// The resource instruments are allocated from, std::pmr::get_default_resource() unless changed.
+        std::pmr::memory_resource *memory_resource() const {
+            return memory_ != nullptr ? memory_ : std::pmr::get_default_resource();
+        }
     };
 
     /// deduction guide
@@ -0,0 +1,136 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_AGGREGATE_RECORDER_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_AGGREGATE_RECORDER_H
+#include "../simple_instruments.h"
+#include "detail/thread_index.h"
+#include "epoch.h"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+namespace crosscode::simple_instruments {
+
+    /// Minimum, maximum, sum and count of the values recorded in one export interval.
+    template <typename Tvalue>
+    struct value_aggregate {
+        using value_type = Tvalue;
+        using sum_type = std::conditional_t<std::is_floating_point_v<Tvalue>, double,
+                std::conditional_t<std::is_signed_v<Tvalue>, std::int64_t, std::uint64_t>>;
+        value_type min{};
+        value_type max{};
+        sum_type sum{};
+        std::uint64_t count{0};
+
+        double mean() const {
+            return count == 0 ? 0.0 : static_cast<double>(sum) / static_cast<double>(count);
+        }
+    };
+
+    /// A value recorder that keeps the minimum, maximum, sum and count of all values recorded since the last call of
+    /// collect(), so spikes between exports are not lost. collect() sends them to the exporter as one
+    /// value_aggregate<Tvalue>; intervals without values are not sent.
+    ///
+    /// Recording takes no lock. Minimum and maximum are updated with compare and swap, only when the value is a new
+    /// extreme. Sum and count are kept in shards, each on its own cache line, that threads are spread over. Values go
+    /// to one of two banks, chosen by the parity of an epoch_domain epoch that record() pins, like the banks of
+    /// atomic_instrument_group. collect() advances the epoch, waits until the records still pinned to the previous
+    /// epoch have finished and then drains that bank, so every value is counted with its extremes in one interval.
+    template <typename Tvalue, typename Texporter>
+    class atomic_aggregate_recorder {
+        static_assert(std::is_arithmetic_v<Tvalue> && !std::is_same_v<Tvalue, bool>, "Tvalue must be a number");
+    public:
+        using value_type = Tvalue;
+        using exporter_type = Texporter;
+        using aggregate_type = value_aggregate<value_type>;
+    private:
+        using sum_type = typename aggregate_type::sum_type;
+        static constexpr std::size_t shards = 8;
+
+        struct alignas(detail::cache_line_size) shard {
+            std::atomic<sum_type> sum{0};
+            std::atomic<std::uint64_t> count{0};
+        };
+
+        using limits = std::numeric_limits<value_type>;
+
+        static constexpr value_type highest() {
+            if constexpr (limits::has_infinity) return limits::infinity();
+            return limits::max();
+        }
+
+        static constexpr value_type lowest() {
+            if constexpr (limits::has_infinity) return -limits::infinity();
+            return limits::lowest();
+        }
+
+        struct bank {
+            std::atomic<value_type> min{highest()};
+            std::atomic<value_type> max{lowest()};
+            std::array<shard, shards> sums{};
+        };
+
+        data_block<aggregate_type, exporter_type> data_;
+        epoch_domain epochs_;
+        std::array<bank, 2> banks_{};
+        std::mutex collect_mutex_;
+
+    public:
+        atomic_aggregate_recorder(std::shared_ptr<exporter_type> exporter,
+                                  typename exporter_type::metadata_type metadata)
+                : data_{std::move(exporter), std::move(metadata), aggregate_type{}} {
+            data_.emit_init(data_.value_);
+        }
+
+        void record(value_type value) {
+            epoch_domain::guard guard{epochs_};
+            auto &b = banks_[guard.epoch() & 1u];
+            auto min = b.min.load(std::memory_order_relaxed);
+            while (value < min && !b.min.compare_exchange_weak(min, value, std::memory_order_relaxed)) {}
+            auto max = b.max.load(std::memory_order_relaxed);
+            while (value > max && !b.max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {}
+            auto &s = b.sums[detail::thread_index() % shards];
+            if constexpr (std::is_floating_point_v<value_type>) {
+                auto sum = s.sum.load(std::memory_order_relaxed);
+                while (!s.sum.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed)) {}
+            } else {
+                s.sum.fetch_add(static_cast<sum_type>(value), std::memory_order_relaxed);
+            }
+            s.count.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /// Ends the interval: sends the aggregate of the values recorded since the previous call, and starts over.
+        /// Waits for the records that are running when it is called.
+        aggregate_type collect() {
+            std::lock_guard lock{collect_mutex_};
+            auto previous = epochs_.epoch();
+            while (!epochs_.try_advance()) std::this_thread::yield();
+            while (!epochs_.previous_drained()) std::this_thread::yield();
+            auto &b = banks_[previous & 1u];
+            aggregate_type result;
+            for (auto &s : b.sums) {
+                result.count += s.count.exchange(0, std::memory_order_acquire);
+                result.sum += s.sum.exchange(0, std::memory_order_relaxed);
+            }
+            result.min = b.min.exchange(highest(), std::memory_order_relaxed);
+            result.max = b.max.exchange(lowest(), std::memory_order_relaxed);
+            if (result.count == 0) return {};
+            data_.value_ = result;
+            data_.emit(result);
+            return result;
+        }
+
+        /// The aggregate sent by the last collect() that had values. Only use it from the thread that calls collect().
+        const aggregate_type &last() const {
+            return data_.value_;
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_AGGREGATE_RECORDER_H
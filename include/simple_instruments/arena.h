@@ -0,0 +1,257 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_ARENA_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_ARENA_H
+#include "detail/thread_index.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace crosscode::simple_instruments {
+
+    /// A memory resource that serves small allocations from per size class free lists, carved in slabs from large
+    /// chunks of an upstream resource. Freed blocks are reused for allocations of the same size class and only returned upstream
+    /// when the arena is destroyed, so creating and destroying instruments and their metadata does not reach the
+    /// global allocator once the arena has warmed up. Allocations larger than max_block_size, or aligned stricter
+    /// than alignof(std::max_align_t), are passed to the upstream resource.
+    ///
+    /// Every thread keeps a small cache of free blocks per size class for the arena it last allocated from, so most
+    /// allocations and deallocations take no lock. Each size class of the arena has its own lock for the rest. When a
+    /// thread allocates from another arena, its cached blocks go back to the free lists of their arena, or are
+    /// forgotten when that arena was destroyed. Blocks cached by a thread that exits are not reused before the arena is
+    /// destroyed. The arena must outlive everything allocated from it.
+    class instrument_arena : public std::pmr::memory_resource {
+    public:
+        static constexpr std::size_t min_block_size = 16;
+        static constexpr std::size_t max_block_size = 2048;
+    private:
+        static constexpr std::size_t classes = 8;
+        static constexpr std::size_t cache_limit = 64;
+        static constexpr std::size_t batch = 16;
+
+        struct free_block {
+            free_block *next;
+        };
+
+        struct alignas(detail::cache_line_size) size_class {
+            std::mutex mutex;
+            free_block *free{nullptr};
+            char *cursor{nullptr};
+            char *end{nullptr};
+        };
+
+        struct thread_cache {
+            std::uint64_t arena{0};
+            std::array<free_block *, classes> free{};
+            std::array<std::size_t, classes> count{};
+        };
+
+        static thread_cache &local() {
+            thread_local thread_cache cache;
+            return cache;
+        }
+
+        static std::uint64_t next_id() {
+            static std::atomic<std::uint64_t> next{1};
+            return next.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /// The live arenas, so a thread cache can find the arena of its blocks.
+        struct registry {
+            std::mutex mutex;
+            std::vector<instrument_arena *> arenas;
+        };
+
+        static registry &arenas() {
+            static registry r;
+            return r;
+        }
+
+        std::uint64_t id_{next_id()};
+        std::pmr::memory_resource *upstream_;
+        std::size_t chunk_size_;
+        std::array<size_class, classes> classes_{};
+        std::mutex chunks_mutex_;
+        std::vector<void *> chunks_;
+        char *chunk_cursor_{nullptr};
+        char *chunk_end_{nullptr};
+
+        static std::size_t class_index(std::size_t bytes) {
+            std::size_t index = 0;
+            for (auto size = min_block_size; size < bytes; size <<= 1) ++index;
+            return index;
+        }
+
+        static std::size_t block_size(std::size_t index) {
+            return min_block_size << index;
+        }
+
+        static bool pooled(std::size_t bytes, std::size_t alignment) {
+            return bytes <= max_block_size && alignment <= alignof(std::max_align_t);
+        }
+
+        static std::size_t slab_size(std::size_t size) {
+            return size * 4 > 4096 ? size * 4 : 4096;
+        }
+
+        /// Gives a size class a slab of blocks from the current chunk. Called with the lock of the size class held.
+        void refill(size_class &c, std::size_t size) {
+            auto slab = slab_size(size);
+            std::lock_guard lock{chunks_mutex_};
+            if (static_cast<std::size_t>(chunk_end_ - chunk_cursor_) < slab) {
+                chunk_cursor_ = static_cast<char *>(upstream_->allocate(chunk_size_, alignof(std::max_align_t)));
+                chunk_end_ = chunk_cursor_ + chunk_size_;
+                chunks_.push_back(chunk_cursor_);
+            }
+            c.cursor = chunk_cursor_;
+            c.end = chunk_cursor_ + slab;
+            chunk_cursor_ += slab;
+        }
+
+        /// Puts the blocks of a thread cache back on the free lists of this arena.
+        void give_back(thread_cache &cache) {
+            for (std::size_t index = 0; index < classes; ++index) {
+                auto first = cache.free[index];
+                if (first == nullptr) continue;
+                auto last = first;
+                while (last->next != nullptr) last = last->next;
+                auto &c = classes_[index];
+                std::lock_guard lock{c.mutex};
+                last->next = c.free;
+                c.free = first;
+            }
+        }
+
+        /// Makes the cache of the calling thread hold blocks of this arena, giving the blocks it holds back to their
+        /// arena when it is still alive.
+        void adopt(thread_cache &cache) {
+            if (cache.arena != 0) {
+                auto &r = arenas();
+                std::lock_guard lock{r.mutex};
+                for (auto arena : r.arenas) {
+                    if (arena->id_ == cache.arena) {
+                        arena->give_back(cache);
+                        break;
+                    }
+                }
+            }
+            cache = {};
+            cache.arena = id_;
+        }
+
+    protected:
+        /// Called with the lock of the size class held.
+        void *take(size_class &c, std::size_t size) {
+            if (auto block = c.free) {
+                c.free = block->next;
+                return block;
+            }
+            if (c.cursor == c.end) refill(c, size);
+            auto block = c.cursor;
+            c.cursor += size;
+            return block;
+        }
+
+        void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+            if (!pooled(bytes, alignment)) return upstream_->allocate(bytes, alignment);
+            auto index = class_index(bytes);
+            auto &cache = local();
+            if (cache.arena == id_ && cache.free[index] != nullptr) {
+                auto block = cache.free[index];
+                cache.free[index] = block->next;
+                --cache.count[index];
+                return block;
+            }
+            if (cache.arena != id_) adopt(cache);
+            auto size = block_size(index);
+            auto &c = classes_[index];
+            std::lock_guard lock{c.mutex};
+            for (std::size_t i = 1; i < batch; ++i) {
+                cache.free[index] = ::new (take(c, size)) free_block{cache.free[index]};
+                ++cache.count[index];
+            }
+            return take(c, size);
+        }
+
+        void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override {
+            if (!pooled(bytes, alignment)) {
+                upstream_->deallocate(p, bytes, alignment);
+                return;
+            }
+            auto index = class_index(bytes);
+            auto &cache = local();
+            if (cache.arena != id_) {
+                auto &c = classes_[index];
+                std::lock_guard lock{c.mutex};
+                c.free = ::new (p) free_block{c.free};
+                return;
+            }
+            if (cache.count[index] == cache_limit) {
+                auto &c = classes_[index];
+                std::lock_guard lock{c.mutex};
+                for (std::size_t i = 0; i < cache_limit / 2; ++i) {
+                    auto block = cache.free[index];
+                    cache.free[index] = block->next;
+                    block->next = c.free;
+                    c.free = block;
+                }
+                cache.count[index] -= cache_limit / 2;
+            }
+            cache.free[index] = ::new (p) free_block{cache.free[index]};
+            ++cache.count[index];
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+            return this == &other;
+        }
+
+    public:
+        explicit instrument_arena(std::size_t chunk_size = 64 * 1024,
+                                  std::pmr::memory_resource *upstream = std::pmr::new_delete_resource())
+                : upstream_{upstream}, chunk_size_{chunk_size < slab_size(max_block_size) ? slab_size(max_block_size) : chunk_size} {
+            auto &r = arenas();
+            std::lock_guard lock{r.mutex};
+            r.arenas.push_back(this);
+        }
+
+        instrument_arena(const instrument_arena &) = delete;
+        instrument_arena &operator=(const instrument_arena &) = delete;
+
+        ~instrument_arena() override {
+            {
+                auto &r = arenas();
+                std::lock_guard lock{r.mutex};
+                r.arenas.erase(std::find(r.arenas.begin(), r.arenas.end(), this));
+            }
+            auto &cache = local();
+            if (cache.arena == id_) cache = {};
+            for (auto chunk : chunks_) upstream_->deallocate(chunk, chunk_size_, alignof(std::max_align_t));
+        }
+
+        /// Free blocks of this arena in the cache of the calling thread.
+        std::size_t cached() const {
+            const auto &cache = local();
+            if (cache.arena != id_) return 0;
+            std::size_t total = 0;
+            for (auto n : cache.count) total += n;
+            return total;
+        }
+
+        /// Bytes taken from the upstream resource for pooled blocks.
+        std::size_t reserved() {
+            std::lock_guard lock{chunks_mutex_};
+            return chunks_.size() * chunk_size_;
+        }
+
+        std::pmr::memory_resource *upstream() const {
+            return upstream_;
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_ARENA_H
@@ -0,0 +1,247 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_ASYNC_EXPORTER_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_ASYNC_EXPORTER_H
+#if __cplusplus < 202002L || !defined(__cpp_impl_coroutine) || !defined(__cpp_concepts) || !__has_include(<coroutine>)
+#error "simple_instruments/async_exporter.h requires C++20 coroutines and concepts"
+#endif
+#include "line_protocol.h"
+#include <chrono>
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace crosscode::simple_instruments {
+
+    namespace detail {
+        template <typename T>
+        concept awaiter = requires(T &a, std::coroutine_handle<> h) {
+            { a.await_ready() } -> std::convertible_to<bool>;
+            a.await_suspend(h);
+            a.await_resume();
+        };
+    }
+
+    /// Something a coroutine can co_await: an awaiter, or a type with operator co_await.
+    template <typename T>
+    concept awaitable = detail::awaiter<T> || requires(T &&a) {
+        { std::forward<T>(a).operator co_await() } -> detail::awaiter;
+    };
+
+    /// A sink for async exporters: write takes ownership of a completed buffer and returns an awaitable that finishes
+    /// when the buffer was written, for example after an io_uring completion.
+    template <typename T>
+    concept async_sink = requires(T &sink, std::string &&buffer) {
+        { sink.write(std::move(buffer)) } -> awaitable;
+    };
+
+    /// An exporter whose emits only buffer, and whose flush() returns an awaitable that writes the buffer, so an
+    /// event loop can ship metrics between its own I/O instead of a thread of the exporter doing it.
+    template <typename T>
+    concept async_exporter = requires(T &exporter) {
+        typename T::metadata_type;
+        { exporter.flush() } -> awaitable;
+    };
+
+    /// A lazily started coroutine without a result. Awaiting it starts it and resumes the awaiting coroutine when it
+    /// finishes. Code that is not a coroutine, like an event loop callback, can start() it and check done().
+    class async_task {
+    public:
+        struct promise_type {
+            std::coroutine_handle<> continuation{std::noop_coroutine()};
+            std::exception_ptr exception;
+
+            async_task get_return_object() {
+                return async_task{std::coroutine_handle<promise_type>::from_promise(*this)};
+            }
+
+            std::suspend_always initial_suspend() noexcept {
+                return {};
+            }
+
+            auto final_suspend() noexcept {
+                struct final_awaiter {
+                    bool await_ready() noexcept {
+                        return false;
+                    }
+
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                        return h.promise().continuation;
+                    }
+
+                    void await_resume() noexcept {}
+                };
+                return final_awaiter{};
+            }
+
+            void return_void() {}
+
+            void unhandled_exception() {
+                exception = std::current_exception();
+            }
+        };
+    private:
+        std::coroutine_handle<promise_type> handle_;
+
+        explicit async_task(std::coroutine_handle<promise_type> handle) : handle_{handle} {}
+
+    public:
+        async_task(async_task &&other) noexcept : handle_{std::exchange(other.handle_, {})} {}
+
+        async_task &operator=(async_task &&other) noexcept {
+            std::swap(handle_, other.handle_);
+            return *this;
+        }
+
+        async_task(const async_task &) = delete;
+        async_task &operator=(const async_task &) = delete;
+
+        ~async_task() {
+            if (handle_) handle_.destroy();
+        }
+
+        bool await_ready() const noexcept {
+            return !handle_ || handle_.done();
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            handle_.promise().continuation = awaiting;
+            return handle_;
+        }
+
+        void await_resume() const {
+            if (handle_ && handle_.promise().exception) std::rethrow_exception(handle_.promise().exception);
+        }
+
+        /// Runs the task until it first suspends.
+        void start() {
+            handle_.resume();
+        }
+
+        bool done() const {
+            return !handle_ || handle_.done();
+        }
+
+        /// Rethrows the exception the finished task ended with, if any.
+        void get() const {
+            await_resume();
+        }
+    };
+
+    /// Exporter that writes every value as InfluxDB line protocol into a buffer, like line_protocol_exporter, but
+    /// never writes from the emitting thread: flush() returns an async_task that hands the buffer to an async_sink and
+    /// awaits it. Drive it from an event loop, for example a timer that co_awaits flush(); call on_full to be told
+    /// when the buffer reached batch_size, from the emitting thread, so the loop can flush early. The series is
+    /// obtained by calling unique_identifier(metadata), found through argument dependent lookup.
+    ///
+    /// Emits may come from any thread. Run one flush() at a time.
+    template <typename Tmetadata, async_sink Tsink>
+    class async_line_protocol_exporter {
+    public:
+        using metadata_type = Tmetadata;
+        using sink_type = Tsink;
+    private:
+        std::mutex mutex_;
+        std::size_t batch_size_;
+        std::string buffer_;
+        bool full_notified_{false};
+        std::function<void()> on_full_;
+        std::shared_ptr<exporter_statistics> statistics_{std::make_shared<exporter_statistics>()};
+        sink_type sink_;
+
+        template <typename Tvalue>
+        void append(const Tvalue &value, const metadata_type &md) {
+            const auto &id = unique_identifier(md);
+            auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+            bool notify = false;
+            {
+                std::lock_guard lock{mutex_};
+                append_line_protocol(buffer_, std::string_view{id}, value, timestamp);
+                if (buffer_.size() >= batch_size_ && !full_notified_ && on_full_) {
+                    full_notified_ = true;
+                    notify = true;
+                }
+            }
+            if (notify) on_full_();
+        }
+
+        std::string take() {
+            std::string full;
+            full.reserve(batch_size_ + batch_size_ / 4);
+            std::lock_guard lock{mutex_};
+            std::swap(full, buffer_);
+            full_notified_ = false;
+            return full;
+        }
+
+    public:
+        template <typename ...Args>
+        explicit async_line_protocol_exporter(std::size_t batch_size, Args &&...args)
+                : batch_size_{batch_size}, sink_{std::forward<Args>(args)...} {
+            buffer_.reserve(batch_size_ + batch_size_ / 4);
+        }
+
+        async_line_protocol_exporter(const async_line_protocol_exporter &) = delete;
+        async_line_protocol_exporter &operator=(const async_line_protocol_exporter &) = delete;
+
+        template <typename Tvalue>
+        void emit_init(const Tvalue &value, const metadata_type &md) {
+            append(value, md);
+        }
+
+        template <typename Tvalue>
+        void emit(const Tvalue &value, const metadata_type &md) {
+            append(value, md);
+        }
+
+        /// Called once each time the buffer reaches batch_size, on the emitting thread, until the next flush(). It
+        /// should only wake the event loop, for example by writing to an eventfd. Set it before emitting.
+        void on_full(std::function<void()> callback) {
+            std::lock_guard lock{mutex_};
+            on_full_ = std::move(callback);
+        }
+
+        /// Takes everything buffered so far when started, and writes it to the sink.
+        async_task flush() {
+            auto buffer = take();
+            if (buffer.empty()) co_return;
+            auto size = buffer.size();
+            auto start = std::chrono::steady_clock::now();
+            try {
+                co_await sink_.write(std::move(buffer));
+            } catch (...) {
+                statistics_->add_error();
+                throw;
+            }
+            statistics_->add_batch(size, size, std::chrono::steady_clock::now() - start);
+        }
+
+        /// Bytes buffered and not flushed yet.
+        std::size_t buffered() {
+            std::lock_guard lock{mutex_};
+            return buffer_.size();
+        }
+
+        sink_type &sink() {
+            return sink_;
+        }
+
+        /// Bytes and buffers written, the time from starting a write until it completed, and errors; publish them
+        /// with self_metrics.
+        const std::shared_ptr<exporter_statistics> &statistics() const {
+            return statistics_;
+        }
+    };
+
+    static_assert(awaitable<async_task>);
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_ASYNC_EXPORTER_H
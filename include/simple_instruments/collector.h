@@ -0,0 +1,105 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_COLLECTOR_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_COLLECTOR_H
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace crosscode::simple_instruments {
+
+    /// Runs collection tasks once per export interval, for parts of the library that work per interval instead of
+    /// per value, like delta_exporter. A collector created without an interval has no thread; call collect() yourself.
+    /// Tasks run one at a time in the order they were added, and must not add or remove tasks themselves.
+    class collector {
+    public:
+        using clock = std::chrono::steady_clock;
+        using task_id = std::uint64_t;
+    private:
+        std::mutex tasks_mutex_;
+        std::vector<std::pair<task_id, std::function<void()>>> tasks_;
+        task_id next_id_{1};
+        clock::duration interval_{};
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        bool stop_{false};
+        std::thread thread_;
+
+        static clock::duration positive(clock::duration interval) {
+            if (interval <= clock::duration::zero()) throw std::invalid_argument("interval must be positive");
+            return interval;
+        }
+
+        void run() {
+            auto next = clock::now() + interval_;
+            std::unique_lock lock{mutex_};
+            for (;;) {
+                if (cv_.wait_until(lock, next, [this] { return stop_; })) return;
+                lock.unlock();
+                collect();
+                lock.lock();
+                next += interval_;
+                auto now = clock::now();
+                if (next < now) next = now + interval_;
+            }
+        }
+
+    public:
+        collector() = default;
+
+        /// Starts a thread that calls collect() every interval. Throws std::invalid_argument when interval is not
+        /// positive in clock::duration.
+        template <typename Rep, typename Period>
+        explicit collector(std::chrono::duration<Rep, Period> interval)
+                : interval_{positive(std::chrono::duration_cast<clock::duration>(interval))},
+                  thread_{[this] { run(); }} {}
+
+        collector(const collector &) = delete;
+        collector &operator=(const collector &) = delete;
+
+        ~collector() {
+            if (!thread_.joinable()) return;
+            {
+                std::lock_guard lock{mutex_};
+                stop_ = true;
+            }
+            cv_.notify_one();
+            thread_.join();
+        }
+
+        task_id add(std::function<void()> task) {
+            std::lock_guard lock{tasks_mutex_};
+            tasks_.emplace_back(next_id_, std::move(task));
+            return next_id_++;
+        }
+
+        /// Removes a task. When this returns the task is not running and will not run again.
+        void remove(task_id id) {
+            std::lock_guard lock{tasks_mutex_};
+            for (auto it = tasks_.begin(); it != tasks_.end(); ++it) {
+                if (it->first == id) {
+                    tasks_.erase(it);
+                    return;
+                }
+            }
+        }
+
+        /// Runs every task now.
+        void collect() {
+            std::lock_guard lock{tasks_mutex_};
+            for (auto &task : tasks_) task.second();
+        }
+
+        /// The interval of the collection thread, zero when there is none.
+        clock::duration interval() const {
+            return interval_;
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_COLLECTOR_H
@@ -0,0 +1,186 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_COUNTER_ARRAY_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_COUNTER_ARRAY_H
+#include "../simple_instruments.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CROSSCODE_SIMPLE_INSTRUMENTS_AVX2_DISPATCH
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define CROSSCODE_SIMPLE_INSTRUMENTS_COUNTERS_NEON
+#endif
+
+namespace crosscode::simple_instruments {
+
+    namespace detail {
+        static_assert(sizeof(std::atomic<std::uint64_t>) == sizeof(std::uint64_t) &&
+                      std::atomic<std::uint64_t>::is_always_lock_free,
+                      "counters are read as plain 64 bit words");
+
+        /// Copies counters into values and stores the increase since the previous values in deltas. Returns the
+        /// number of counters that changed.
+        inline std::size_t snapshot_counters_scalar(const std::atomic<std::uint64_t> *counters, std::uint64_t *values,
+                                                    std::uint64_t *deltas, std::size_t size) {
+            std::size_t changed = 0;
+            for (std::size_t i = 0; i < size; ++i) {
+                auto value = counters[i].load(std::memory_order_relaxed);
+                deltas[i] = value - values[i];
+                changed += deltas[i] != 0;
+                values[i] = value;
+            }
+            return changed;
+        }
+
+        /// Snapshots of more counters than this write their deltas around the cache: they would not fit in it anyway,
+        /// and that saves reading every cache line of deltas before writing it, which halves the time of big snapshots.
+        inline constexpr std::size_t streamed_snapshot_size = std::size_t{1} << 17;
+
+        // The vector versions read the counters with vector loads. Every 8 byte aligned lane of such a load is read
+        // at once on x86 and ARM, so no counter is torn; the lanes are not read at the same instant, which relaxed
+        // loads do not promise either.
+#if defined(CROSSCODE_SIMPLE_INSTRUMENTS_AVX2_DISPATCH)
+        template <bool Tstream>
+        __attribute__((target("avx2")))
+        inline std::size_t snapshot_counter_blocks_avx2(const std::atomic<std::uint64_t> *counters,
+                                                        std::uint64_t *values, std::uint64_t *deltas,
+                                                        std::size_t blocks) {
+            auto source = reinterpret_cast<const __m256i *>(counters);
+            auto previous = reinterpret_cast<__m256i *>(values);
+            auto increase = reinterpret_cast<__m256i *>(deltas);
+            auto zero = _mm256_setzero_si256();
+            std::size_t changed = 0;
+            for (std::size_t block = 0; block < blocks; ++block) {
+                auto value = _mm256_loadu_si256(source + block);
+                auto delta = _mm256_sub_epi64(value, _mm256_loadu_si256(previous + block));
+                _mm256_storeu_si256(previous + block, value);
+                if constexpr (Tstream) {
+                    _mm256_stream_si256(increase + block, delta);
+                } else {
+                    _mm256_storeu_si256(increase + block, delta);
+                }
+                auto unchanged = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(delta, zero)));
+                changed += 4 - static_cast<std::size_t>(__builtin_popcount(static_cast<unsigned>(unchanged)));
+            }
+            if constexpr (Tstream) _mm_sfence();
+            return changed;
+        }
+
+        inline std::size_t snapshot_counters_avx2(const std::atomic<std::uint64_t> *counters, std::uint64_t *values,
+                                                  std::uint64_t *deltas, std::size_t size) {
+            std::size_t done = 0;
+            std::size_t changed = 0;
+            if (size >= streamed_snapshot_size) {
+                // Streaming stores need deltas aligned to 32 bytes.
+                auto misaligned = (reinterpret_cast<std::uintptr_t>(deltas) / sizeof(std::uint64_t)) % 4;
+                done = misaligned == 0 ? 0 : 4 - misaligned;
+                changed = snapshot_counters_scalar(counters, values, deltas, done);
+                changed += snapshot_counter_blocks_avx2<true>(counters + done, values + done, deltas + done,
+                                                              (size - done) / 4);
+            } else {
+                changed = snapshot_counter_blocks_avx2<false>(counters, values, deltas, size / 4);
+            }
+            done += (size - done) / 4 * 4;
+            return changed + snapshot_counters_scalar(counters + done, values + done, deltas + done, size - done);
+        }
+#elif defined(CROSSCODE_SIMPLE_INSTRUMENTS_COUNTERS_NEON)
+        inline std::size_t snapshot_counters_neon(const std::atomic<std::uint64_t> *counters, std::uint64_t *values,
+                                                  std::uint64_t *deltas, std::size_t size) {
+            auto source = reinterpret_cast<const std::uint64_t *>(counters);
+            std::size_t changed = 0;
+            std::size_t i = 0;
+            for (; i + 2 <= size; i += 2) {
+                auto value = vld1q_u64(source + i);
+                auto delta = vsubq_u64(value, vld1q_u64(values + i));
+                vst1q_u64(values + i, value);
+                vst1q_u64(deltas + i, delta);
+                changed += 2 - static_cast<std::size_t>(vaddvq_u64(vshrq_n_u64(vceqzq_u64(delta), 63)));
+            }
+            return changed + snapshot_counters_scalar(counters + i, values + i, deltas + i, size - i);
+        }
+#endif
+
+        /// snapshot_counters_scalar with AVX2 when the CPU running it has it, or NEON on 64 bit ARM.
+        inline std::size_t snapshot_counters(const std::atomic<std::uint64_t> *counters, std::uint64_t *values,
+                                             std::uint64_t *deltas, std::size_t size) {
+#if defined(CROSSCODE_SIMPLE_INSTRUMENTS_AVX2_DISPATCH)
+            static const bool avx2 = __builtin_cpu_supports("avx2");
+            if (avx2) return snapshot_counters_avx2(counters, values, deltas, size);
+#elif defined(CROSSCODE_SIMPLE_INSTRUMENTS_COUNTERS_NEON)
+            return snapshot_counters_neon(counters, values, deltas, size);
+#endif
+            return snapshot_counters_scalar(counters, values, deltas, size);
+        }
+    }
+
+    /// The counters of an atomic_counter_array at one collect(), with the increase of each since the previous one.
+    struct counter_array_snapshot {
+        std::vector<std::uint64_t> values;
+        std::vector<std::uint64_t> deltas;
+        /// The number of counters with a delta that is not zero.
+        std::size_t changed{0};
+    };
+
+    /// A fixed number of monotonic counters in one contiguous block, for many series that are counted together, like
+    /// one counter per shard, per bucket or per client slot. Counters are addressed by index and count with one
+    /// atomic addition, like atomic_monotonic_counter. collect() copies the whole block and computes the deltas in
+    /// one pass with vector instructions, instead of one atomic load and one emit per instrument, and sends the
+    /// counter_array_snapshot; intervals in which nothing changed are not sent.
+    template <typename Texporter>
+    class atomic_counter_array {
+    public:
+        using value_type = std::uint64_t;
+        using exporter_type = Texporter;
+    private:
+        data_block<counter_array_snapshot, exporter_type> data_;
+        std::size_t size_;
+        std::unique_ptr<std::atomic<value_type>[]> counters_;
+
+    public:
+        atomic_counter_array(std::shared_ptr<exporter_type> exporter, typename exporter_type::metadata_type metadata,
+                             std::size_t size)
+                : data_{std::move(exporter), std::move(metadata), counter_array_snapshot{}}, size_{size},
+                  counters_{new std::atomic<value_type>[size]} {
+            if (size == 0) throw std::invalid_argument("size must be positive");
+            for (std::size_t i = 0; i < size; ++i) counters_[i].store(0, std::memory_order_relaxed);
+            data_.value_.values.resize(size);
+            data_.value_.deltas.resize(size);
+            data_.emit_init(data_.value_);
+        }
+
+        void add(std::size_t index, value_type amount = 1) {
+            counters_[index].fetch_add(amount, std::memory_order_relaxed);
+        }
+
+        value_type value(std::size_t index) const {
+            return counters_[index].load(std::memory_order_relaxed);
+        }
+
+        std::size_t size() const {
+            return size_;
+        }
+
+        /// Copies all counters, computes their increase since the previous call and sends them. Call it from one
+        /// thread at a time, for example from a collector.
+        const counter_array_snapshot &collect() {
+            auto &snapshot = data_.value_;
+            snapshot.changed = detail::snapshot_counters(counters_.get(), snapshot.values.data(),
+                                                         snapshot.deltas.data(), size_);
+            if (snapshot.changed != 0) data_.emit(snapshot);
+            return snapshot;
+        }
+
+        /// The snapshot of the last collect(). Only use it from the thread that calls collect().
+        const counter_array_snapshot &last() const {
+            return data_.value_;
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_COUNTER_ARRAY_H
@@ -0,0 +1,204 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_DELTA_EXPORTER_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_DELTA_EXPORTER_H
+#include "../simple_instruments.h"
+#include "encoded_value.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace crosscode::simple_instruments {
+
+    /// What a delta_exporter sends per export interval.
+    enum class delta_mode {
+        /// The increase since the previous interval, as std::uint64_t for integer counters and double otherwise.
+        delta,
+        /// The increase since the previous interval per second, as double.
+        rate
+    };
+
+    namespace detail {
+        struct counter_delta {
+            encoded_value delta;
+            /// False when the value went back a little, which is taken to be concurrent emits arriving out of order.
+            bool advanced;
+        };
+
+        inline double as_double(std::uint64_t bits) {
+            double value;
+            std::memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        /// The increase of a cumulative value from previous to current. Integer values of width bits that go back by
+        /// more than half their range are taken to have wrapped. Values that drop to half of the previous value or
+        /// less are taken to have been reset and increased by current. Smaller drops are not counted.
+        inline counter_delta compute_counter_delta(value_kind kind, unsigned width, std::uint64_t previous,
+                                                   std::uint64_t current) {
+            if (kind == value_kind::floating_point) {
+                auto p = as_double(previous);
+                auto c = as_double(current);
+                if (c >= p) return {encode_value(c - p), true};
+                if (c <= p / 2) return {encode_value(c), true};
+                return {encode_value(0.0), false};
+            }
+            auto mask = width >= 64 ? ~std::uint64_t{0} : (std::uint64_t{1} << width) - 1;
+            auto forward = (current - previous) & mask;
+            if (forward <= mask / 2) return {encode_value(forward), true};
+            bool reset;
+            if (kind == value_kind::signed_integer) {
+                auto p = static_cast<std::int64_t>(previous);
+                auto c = static_cast<std::int64_t>(current);
+                reset = c >= 0 && c <= p / 2;
+            } else {
+                reset = (current & mask) <= (previous & mask) / 2;
+            }
+            if (reset) return {encode_value(current & mask), true};
+            return {encode_value(std::uint64_t{0}), false};
+        }
+    }
+
+    /// Exporter that turns cumulative counters into deltas or rates per export interval. Instruments only store their
+    /// latest value; collect(), called once per interval, for example by a collector, sends the increase of every
+    /// series that changed to Texporter. Series that did not change are not sent, so downstream only receives what
+    /// happened. Only route counters to it: the increase of a value recorder has no meaning.
+    ///
+    /// Texporter receives emit_init with a zero delta when an instrument is created, and release after the last
+    /// delta of a destroyed instrument was sent.
+    template <typename Texporter>
+    class delta_exporter {
+    public:
+        using metadata_type = typename Texporter::metadata_type;
+        using exporter_type = Texporter;
+        using clock = std::chrono::steady_clock;
+    private:
+        struct series {
+            metadata_type metadata;
+            value_kind kind;
+            unsigned width;
+            std::atomic<std::uint64_t> latest;
+            std::uint64_t reported;
+            exporter_handle_t<exporter_type> handle{};
+            bool released{false};
+
+            series(const metadata_type &md, encoded_value value, unsigned w)
+                    : metadata{md}, kind{value.kind}, width{w}, latest{value.bits}, reported{value.bits} {}
+        };
+    public:
+        using handle_type = series *;
+    private:
+        delta_mode mode_;
+        std::mutex mutex_;
+        std::vector<series *> series_;
+        clock::time_point last_collect_{clock::now()};
+        exporter_type exporter_;
+
+        /// Calls f with a zero of the type sent for s.
+        template <typename F>
+        void with_zero(const series &s, F &&f) {
+            if (mode_ == delta_mode::rate || s.kind == value_kind::floating_point) {
+                f(double{});
+            } else {
+                f(std::uint64_t{});
+            }
+        }
+
+    public:
+        template <typename ...Args>
+        explicit delta_exporter(delta_mode mode, Args &&...args)
+                : mode_{mode}, exporter_{std::forward<Args>(args)...} {}
+
+        delta_exporter(const delta_exporter &) = delete;
+        delta_exporter &operator=(const delta_exporter &) = delete;
+
+        ~delta_exporter() {
+            for (auto s : series_) {
+                detail::release(exporter_, s->handle, s->metadata);
+                delete s;
+            }
+        }
+
+        template <typename Tvalue>
+        handle_type emit_init(const Tvalue &value, const metadata_type &md) {
+            static_assert(std::is_arithmetic_v<Tvalue>, "delta_exporter needs arithmetic values");
+            auto s = new series{md, encode_value(value), static_cast<unsigned>(sizeof(Tvalue) * 8)};
+            std::lock_guard lock{mutex_};
+            with_zero(*s, [&](auto zero) { s->handle = detail::emit_init(exporter_, zero, s->metadata); });
+            series_.push_back(s);
+            return s;
+        }
+
+        template <typename Tvalue>
+        void emit(const Tvalue &value, const metadata_type &, const handle_type &s) {
+            s->latest.store(encode_value(value).bits, std::memory_order_relaxed);
+        }
+
+        /// Applies the change of a counter to the latest value, so a value computed earlier but sent later never
+        /// makes it go back.
+        template <typename Tvalue>
+        void emit_add(const Tvalue &amount, const Tvalue &, const metadata_type &, const handle_type &s) {
+            detail::add_encoded(s->latest, amount, false);
+        }
+
+        template <typename Tvalue>
+        void emit_sub(const Tvalue &amount, const Tvalue &, const metadata_type &, const handle_type &s) {
+            detail::add_encoded(s->latest, amount, true);
+        }
+
+        void release(const handle_type &s, const metadata_type &) {
+            std::lock_guard lock{mutex_};
+            s->released = true;
+        }
+
+        /// Sends the increase of every series since the previous call.
+        void collect() {
+            auto now = clock::now();
+            std::lock_guard lock{mutex_};
+            auto seconds = std::chrono::duration<double>(now - last_collect_).count();
+            last_collect_ = now;
+            auto kept = series_.begin();
+            for (auto s : series_) {
+                auto current = s->latest.load(std::memory_order_relaxed);
+                auto result = detail::compute_counter_delta(s->kind, s->width, s->reported, current);
+                if (result.advanced && current != s->reported) {
+                    s->reported = current;
+                    bool floating = result.delta.kind == value_kind::floating_point;
+                    if (mode_ == delta_mode::rate) {
+                        auto delta = floating ? detail::as_double(result.delta.bits)
+                                              : static_cast<double>(result.delta.bits);
+                        detail::emit(exporter_, seconds > 0 ? delta / seconds : 0.0, s->metadata, s->handle);
+                    } else if (floating) {
+                        detail::emit(exporter_, detail::as_double(result.delta.bits), s->metadata, s->handle);
+                    } else {
+                        detail::emit(exporter_, result.delta.bits, s->metadata, s->handle);
+                    }
+                }
+                if (s->released) {
+                    detail::release(exporter_, s->handle, s->metadata);
+                    delete s;
+                } else {
+                    *kept++ = s;
+                }
+            }
+            series_.erase(kept, series_.end());
+        }
+
+        /// Number of series, including destroyed instruments whose last delta was not sent yet.
+        std::size_t size() {
+            std::lock_guard lock{mutex_};
+            return series_.size();
+        }
+
+        /// The wrapped exporter. Only access it when no collect() runs concurrently.
+        exporter_type &exporter() {
+            return exporter_;
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_DELTA_EXPORTER_H
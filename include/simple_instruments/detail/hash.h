@@ -0,0 +1,54 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_DETAIL_HASH_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_DETAIL_HASH_H
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace crosscode::simple_instruments::detail {
+
+    inline std::uint64_t mix(std::uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    inline std::uint64_t hash_bytes(std::uint64_t h, std::string_view bytes) {
+        auto data = bytes.data();
+        auto size = bytes.size();
+        while (size >= 8) {
+            std::uint64_t word;
+            std::memcpy(&word, data, 8);
+            h = (h ^ word) * 0x9e3779b97f4a7c15ull;
+            h ^= h >> 29;
+            data += 8;
+            size -= 8;
+        }
+        std::uint64_t tail = static_cast<std::uint64_t>(bytes.size()) << 56;
+        if (size >= 4) {
+            std::uint32_t first;
+            std::uint32_t last;
+            std::memcpy(&first, data, 4);
+            std::memcpy(&last, data + size - 4, 4);
+            tail ^= (static_cast<std::uint64_t>(first) << 24) ^ last;
+        } else if (size > 0) {
+            tail ^= (static_cast<std::uint64_t>(static_cast<unsigned char>(data[0])) << 16) |
+                    (static_cast<std::uint64_t>(static_cast<unsigned char>(data[size / 2])) << 8) |
+                    static_cast<unsigned char>(data[size - 1]);
+        }
+        return (h ^ tail) * 0x9e3779b97f4a7c15ull;
+    }
+
+    /// Smallest power of two that is at least twice entries, for open addressing tables.
+    inline std::size_t table_size(std::size_t entries) {
+        std::size_t size = 2;
+        while (size < entries * 2) size <<= 1;
+        return size;
+    }
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_DETAIL_HASH_H
@@ -0,0 +1,81 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_DETAIL_MAPPED_REGION_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_DETAIL_MAPPED_REGION_H
+#include <cerrno>
+#include <cstddef>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace crosscode::simple_instruments::detail {
+
+    [[noreturn]] inline void throw_errno(const std::string &what) {
+        throw std::system_error(errno, std::generic_category(), what);
+    }
+
+    /// Owns a POSIX file descriptor.
+    class file_descriptor {
+        int fd_{-1};
+    public:
+        file_descriptor() = default;
+        explicit file_descriptor(int fd) : fd_{fd} {}
+        file_descriptor(file_descriptor &&other) noexcept : fd_{std::exchange(other.fd_, -1)} {}
+        file_descriptor &operator=(file_descriptor &&other) noexcept {
+            std::swap(fd_, other.fd_);
+            return *this;
+        }
+        file_descriptor(const file_descriptor &) = delete;
+        file_descriptor &operator=(const file_descriptor &) = delete;
+        ~file_descriptor() {
+            if (fd_ >= 0) ::close(fd_);
+        }
+
+        int get() const {
+            return fd_;
+        }
+    };
+
+    /// Owns a shared memory mapping of a file descriptor.
+    class mapped_region {
+        void *data_{nullptr};
+        std::size_t size_{0};
+    public:
+        mapped_region() = default;
+        mapped_region(int fd, std::size_t size, bool writable) : size_{size} {
+            int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+            data_ = ::mmap(nullptr, size, protection, MAP_SHARED, fd, 0);
+            if (data_ == MAP_FAILED) {
+                data_ = nullptr;
+                throw_errno("mmap");
+            }
+        }
+        mapped_region(mapped_region &&other) noexcept
+                : data_{std::exchange(other.data_, nullptr)}, size_{std::exchange(other.size_, 0)} {}
+        mapped_region &operator=(mapped_region &&other) noexcept {
+            std::swap(data_, other.data_);
+            std::swap(size_, other.size_);
+            return *this;
+        }
+        mapped_region(const mapped_region &) = delete;
+        mapped_region &operator=(const mapped_region &) = delete;
+        ~mapped_region() {
+            if (data_) ::munmap(data_, size_);
+        }
+
+        void *data() const {
+            return data_;
+        }
+
+        std::size_t size() const {
+            return size_;
+        }
+
+        void sync(bool wait) {
+            if (::msync(data_, size_, wait ? MS_SYNC : MS_ASYNC) != 0) throw_errno("msync");
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_DETAIL_MAPPED_REGION_H
@@ -0,0 +1,21 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_DETAIL_THREAD_INDEX_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_DETAIL_THREAD_INDEX_H
+#include <atomic>
+#include <cstddef>
+
+namespace crosscode::simple_instruments::detail {
+
+    /// A small number unique to the calling thread, handed out in order of first use. Used to spread threads over
+    /// shards.
+    inline std::size_t thread_index() {
+        static std::atomic<std::size_t> next{0};
+        thread_local std::size_t index = next.fetch_add(1, std::memory_order_relaxed);
+        return index;
+    }
+
+    /// Size of a cache line, used to keep shards written by different threads apart.
+    inline constexpr std::size_t cache_line_size = 64;
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_DETAIL_THREAD_INDEX_H
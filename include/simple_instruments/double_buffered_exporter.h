@@ -0,0 +1,205 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_DOUBLE_BUFFERED_EXPORTER_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_DOUBLE_BUFFERED_EXPORTER_H
+#include "line_protocol.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace crosscode::simple_instruments {
+
+    /// Exporter that writes every value as InfluxDB line protocol, like line_protocol_exporter, but never calls the
+    /// sink from an emitting thread. Emits append to the active buffer; when it reaches buffer_size it is swapped with
+    /// a spare one and a flusher thread writes it to Tsink. The buffers are recycled, so with buffers set to 2 or 3 an
+    /// emit neither waits for I/O nor allocates as long as the sink keeps up.
+    ///
+    /// When the sink falls behind and no spare buffer is left, emits keep appending to the active buffer. Once it holds
+    /// buffers * buffer_size bytes new values are dropped and counted in dropped(); initial values are never dropped.
+    /// Only the flusher thread calls the sink, and exceptions it throws are rethrown by flush().
+    template <typename Tmetadata, typename Tsink>
+    class double_buffered_line_protocol_exporter {
+    public:
+        using metadata_type = Tmetadata;
+        using sink_type = Tsink;
+    private:
+        std::mutex mutex_;
+        std::condition_variable work_;
+        std::condition_variable progress_;
+        std::size_t buffer_size_;
+        std::size_t buffers_;
+        std::string active_;
+        std::vector<std::string> spare_;
+        std::deque<std::string> full_;
+        std::uint64_t flush_requested_{0};
+        std::uint64_t flush_done_{0};
+        bool stop_{false};
+        std::exception_ptr error_;
+        std::shared_ptr<exporter_statistics> statistics_{std::make_shared<exporter_statistics>()};
+        sink_type sink_;
+        std::thread flusher_;
+
+        std::string new_buffer() const {
+            std::string buffer;
+            buffer.reserve(buffer_size_ + buffer_size_ / 4);
+            return buffer;
+        }
+
+        /// Queues the active buffer for the flusher and continues with a spare one. Called with the lock held.
+        void swap_active() {
+            full_.push_back(std::move(active_));
+            statistics_->set_queue_depth(static_cast<std::int64_t>(full_.size()));
+            if (spare_.empty()) {
+                active_ = new_buffer();
+            } else {
+                active_ = std::move(spare_.back());
+                spare_.pop_back();
+            }
+        }
+
+        template <typename Tvalue>
+        void append(const Tvalue &value, const metadata_type &md, bool droppable) {
+            const auto &id = unique_identifier(md);
+            auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+            bool swapped = false;
+            {
+                std::lock_guard lock{mutex_};
+                if (droppable && active_.size() >= buffer_size_ * buffers_) {
+                    statistics_->add_dropped();
+                    return;
+                }
+                append_line_protocol(active_, std::string_view{id}, value, timestamp);
+                if (active_.size() >= buffer_size_ && !spare_.empty()) {
+                    swap_active();
+                    swapped = true;
+                }
+            }
+            if (swapped) work_.notify_one();
+        }
+
+        void run() {
+            std::unique_lock lock{mutex_};
+            for (;;) {
+                work_.wait(lock, [this] { return !full_.empty() || flush_requested_ > flush_done_ || stop_; });
+                if (!full_.empty()) {
+                    auto buffer = std::move(full_.front());
+                    full_.pop_front();
+                    statistics_->set_queue_depth(static_cast<std::int64_t>(full_.size()));
+                    lock.unlock();
+                    auto size = buffer.size();
+                    auto start = std::chrono::steady_clock::now();
+                    try {
+                        sink_.write(std::move(buffer));
+                        statistics_->add_batch(size, size, std::chrono::steady_clock::now() - start);
+                    } catch (...) {
+                        statistics_->add_error();
+                        lock.lock();
+                        if (!error_) error_ = std::current_exception();
+                        lock.unlock();
+                    }
+                    buffer.clear();
+                    if (buffer.capacity() < buffer_size_) buffer = new_buffer();
+                    lock.lock();
+                    if (spare_.size() + 1 < buffers_) spare_.push_back(std::move(buffer));
+                    // The active buffer grew past buffer_size while no spare was left.
+                    if (active_.size() >= buffer_size_ && !spare_.empty()) swap_active();
+                    continue;
+                }
+                auto target = flush_requested_;
+                auto stopping = stop_;
+                lock.unlock();
+                try {
+                    sink_.flush();
+                } catch (...) {
+                    statistics_->add_error();
+                    lock.lock();
+                    if (!error_) error_ = std::current_exception();
+                    lock.unlock();
+                }
+                lock.lock();
+                flush_done_ = target;
+                progress_.notify_all();
+                if (stopping && full_.empty()) return;
+            }
+        }
+
+    public:
+        template <typename ...Args>
+        double_buffered_line_protocol_exporter(std::size_t buffer_size, std::size_t buffers, Args &&...args)
+                : buffer_size_{buffer_size}, buffers_{buffers}, sink_{std::forward<Args>(args)...} {
+            if (buffers_ < 2) throw std::invalid_argument("at least 2 buffers are needed");
+            active_ = new_buffer();
+            for (std::size_t i = 1; i < buffers_; ++i) spare_.push_back(new_buffer());
+            flusher_ = std::thread{[this] { run(); }};
+        }
+
+        double_buffered_line_protocol_exporter(const double_buffered_line_protocol_exporter &) = delete;
+        double_buffered_line_protocol_exporter &operator=(const double_buffered_line_protocol_exporter &) = delete;
+
+        /// Writes what is still buffered and flushes the sink.
+        ~double_buffered_line_protocol_exporter() {
+            {
+                std::lock_guard lock{mutex_};
+                if (!active_.empty()) swap_active();
+                stop_ = true;
+            }
+            work_.notify_one();
+            flusher_.join();
+        }
+
+        template <typename Tvalue>
+        void emit_init(const Tvalue &value, const metadata_type &md) {
+            append(value, md, false);
+        }
+
+        template <typename Tvalue>
+        void emit(const Tvalue &value, const metadata_type &md) {
+            append(value, md, true);
+        }
+
+        /// Hands the active buffer to the flusher, even when it is not full, and waits until it and every buffer
+        /// before it are written and the sink is flushed. Rethrows the first exception of the sink since the last call.
+        void flush() {
+            std::unique_lock lock{mutex_};
+            if (!active_.empty()) swap_active();
+            auto target = ++flush_requested_;
+            work_.notify_one();
+            progress_.wait(lock, [this, target] { return flush_done_ >= target; });
+            if (error_) std::rethrow_exception(std::exchange(error_, nullptr));
+        }
+
+        /// Full buffers waiting for the flusher.
+        std::size_t pending() {
+            std::lock_guard lock{mutex_};
+            return full_.size();
+        }
+
+        std::uint64_t dropped() const {
+            return statistics_->dropped();
+        }
+
+        /// Full buffers waiting, dropped values, bytes and buffers written, write latencies and errors; publish them
+        /// with self_metrics.
+        const std::shared_ptr<exporter_statistics> &statistics() const {
+            return statistics_;
+        }
+
+        /// The sink. Only access it when it is safe to do so concurrently with the flusher thread.
+        sink_type &sink() {
+            return sink_;
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_DOUBLE_BUFFERED_EXPORTER_H
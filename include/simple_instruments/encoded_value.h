@@ -0,0 +1,91 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_ENCODED_VALUE_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_ENCODED_VALUE_H
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace crosscode::simple_instruments {
+
+    /// Kind of arithmetic value stored in an encoded_value.
+    enum class value_kind : std::uint8_t {
+        none = 0,
+        signed_integer = 1,
+        unsigned_integer = 2,
+        floating_point = 3
+    };
+
+    /// Type tagged 64 bit representation of an instrument value, used by exporters that store values in binary form.
+    struct encoded_value {
+        value_kind kind{value_kind::none};
+        std::uint64_t bits{0};
+
+        /// Calls f with the value as std::int64_t, std::uint64_t or double depending on kind.
+        template <typename F>
+        decltype(auto) visit(F &&f) const {
+            switch (kind) {
+                case value_kind::signed_integer:
+                    return f(static_cast<std::int64_t>(bits));
+                case value_kind::floating_point: {
+                    double value;
+                    std::memcpy(&value, &bits, sizeof(value));
+                    return f(value);
+                }
+                default:
+                    return f(bits);
+            }
+        }
+    };
+
+    template <typename Tvalue>
+    encoded_value encode_value(Tvalue value) {
+        static_assert(std::is_arithmetic_v<Tvalue>, "only arithmetic values can be encoded");
+        encoded_value result;
+        if constexpr (std::is_floating_point_v<Tvalue>) {
+            double d = value;
+            result.kind = value_kind::floating_point;
+            std::memcpy(&result.bits, &d, sizeof(d));
+        } else if constexpr (std::is_signed_v<Tvalue>) {
+            result.kind = value_kind::signed_integer;
+            result.bits = static_cast<std::uint64_t>(static_cast<std::int64_t>(value));
+        } else {
+            result.kind = value_kind::unsigned_integer;
+            result.bits = static_cast<std::uint64_t>(value);
+        }
+        return result;
+    }
+
+    namespace detail {
+        /// The value that encode_value turned into bits.
+        template <typename Tvalue>
+        Tvalue decode_value(std::uint64_t bits) {
+            if constexpr (std::is_floating_point_v<Tvalue>) {
+                double value;
+                std::memcpy(&value, &bits, sizeof(value));
+                return static_cast<Tvalue>(value);
+            } else {
+                return static_cast<Tvalue>(bits);
+            }
+        }
+
+        /// Adds amount to, or subtracts it from, the encoded value of type Tvalue in bits. Integers wrap at the width
+        /// of Tvalue, like the counter that sends the change, so bits always holds encode_value of the counter value.
+        template <typename Tvalue>
+        void add_encoded(std::atomic<std::uint64_t> &bits, Tvalue amount, bool subtract) {
+            if constexpr (std::is_integral_v<Tvalue> && sizeof(Tvalue) == sizeof(std::uint64_t)) {
+                auto change = static_cast<std::uint64_t>(amount);
+                bits.fetch_add(subtract ? 0 - change : change, std::memory_order_relaxed);
+            } else {
+                auto old = bits.load(std::memory_order_relaxed);
+                std::uint64_t updated;
+                do {
+                    auto value = decode_value<Tvalue>(old);
+                    updated = encode_value(static_cast<Tvalue>(subtract ? value - amount : value + amount)).bits;
+                } while (!bits.compare_exchange_weak(old, updated, std::memory_order_relaxed));
+            }
+        }
+    }
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_ENCODED_VALUE_H
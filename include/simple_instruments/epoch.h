@@ -0,0 +1,111 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_EPOCH_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_EPOCH_H
+#include "detail/thread_index.h"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <utility>
+
+namespace crosscode::simple_instruments {
+
+    /// Epoch based reclamation. Readers pin the current epoch while they use shared objects. A writer that unlinks an
+    /// object tags it with epoch() and may free it once reclaimable(tag) is true, which takes two successful calls of
+    /// try_advance(). Pinning is two uncontended atomic additions on a counter shared by a fraction of the threads.
+    class epoch_domain {
+        static constexpr std::size_t shards = 16;
+
+        struct alignas(detail::cache_line_size) shard {
+            std::array<std::atomic<std::uint64_t>, 2> readers{};
+        };
+
+        std::atomic<std::uint64_t> epoch_{0};
+        std::array<shard, shards> shards_{};
+
+        std::uint64_t readers(std::size_t parity) const {
+            std::uint64_t total = 0;
+            for (const auto &s : shards_) total += s.readers[parity].load(std::memory_order_seq_cst);
+            return total;
+        }
+
+    public:
+        class guard {
+            std::atomic<std::uint64_t> *readers_{nullptr};
+            std::uint64_t epoch_{0};
+        public:
+            guard() = default;
+
+            explicit guard(epoch_domain &domain) {
+                auto &s = domain.shards_[detail::thread_index() % shards];
+                for (;;) {
+                    epoch_ = domain.epoch_.load(std::memory_order_seq_cst);
+                    readers_ = &s.readers[epoch_ & 1u];
+                    readers_->fetch_add(1, std::memory_order_seq_cst);
+                    if (domain.epoch_.load(std::memory_order_seq_cst) == epoch_) break;
+                    readers_->fetch_sub(1, std::memory_order_release);
+                }
+            }
+
+            guard(guard &&other) noexcept
+                    : readers_{std::exchange(other.readers_, nullptr)}, epoch_{other.epoch_} {}
+
+            guard &operator=(guard &&other) noexcept {
+                std::swap(readers_, other.readers_);
+                std::swap(epoch_, other.epoch_);
+                return *this;
+            }
+
+            guard(const guard &) = delete;
+            guard &operator=(const guard &) = delete;
+
+            ~guard() {
+                if (readers_) readers_->fetch_sub(1, std::memory_order_release);
+            }
+
+            /// The epoch that was current when the guard was created.
+            std::uint64_t epoch() const {
+                return epoch_;
+            }
+        };
+
+        /// Pins the current epoch until the guard is destroyed.
+        guard pin() {
+            return guard{*this};
+        }
+
+        std::uint64_t epoch() const {
+            return epoch_.load(std::memory_order_seq_cst);
+        }
+
+        /// Advances the epoch when no reader is pinned to the previous epoch. Never blocks.
+        bool try_advance() {
+            auto current = epoch_.load(std::memory_order_seq_cst);
+            if (readers((current + 1) & 1u) != 0) return false;
+            return epoch_.compare_exchange_strong(current, current + 1, std::memory_order_seq_cst);
+        }
+
+        /// True when no reader is pinned to the epoch before the current one anymore. Readers that pinned it finish
+        /// without waiting; new readers pin the current epoch.
+        bool previous_drained() const {
+            return readers((epoch() + 1) & 1u) == 0;
+        }
+
+        /// True when no reader can still hold a reference to an object that was unlinked when epoch() returned tag.
+        bool reclaimable(std::uint64_t tag) const {
+            return epoch() >= tag + 2;
+        }
+
+        /// Waits until every reader that was pinned when called has left, and returns the epoch it was pinned to.
+        std::uint64_t synchronize() {
+            auto tag = epoch();
+            while (!reclaimable(tag)) {
+                if (!try_advance()) std::this_thread::yield();
+            }
+            return tag;
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_EPOCH_H
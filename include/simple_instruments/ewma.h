@@ -0,0 +1,114 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_EWMA_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_EWMA_H
+#include "../simple_instruments.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <initializer_list>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace crosscode::simple_instruments {
+
+    /// What an atomic_ewma averages.
+    enum class ewma_mode {
+        /// The rate per second of the amounts passed to mark(), like requests per second.
+        rate,
+        /// The value last passed to set(), sampled at every tick, like the length of a run queue for a load average.
+        level
+    };
+
+    /// The averages of an atomic_ewma, one per half-life, sent to the exporter at every tick.
+    struct ewma_values {
+        std::vector<double> half_lives;
+        std::vector<double> averages;
+    };
+
+    /// Exponentially weighted moving averages with configurable half-lives, like the 1, 5 and 15 minute load averages.
+    /// Marking or setting is one atomic operation; the averages are only decayed by tick(), which is meant to be
+    /// called once per interval by a collector. The decay uses the time that actually passed since the previous tick,
+    /// so ticks do not have to be exact.
+    template <typename Tvalue, typename Texporter>
+    class atomic_ewma {
+        static_assert(std::is_arithmetic_v<Tvalue> && !std::is_same_v<Tvalue, bool>, "Tvalue must be a number");
+    public:
+        using value_type = Tvalue;
+        using exporter_type = Texporter;
+        using clock = std::chrono::steady_clock;
+    private:
+        data_block<ewma_values, exporter_type> data_;
+        ewma_mode mode_;
+        std::atomic<value_type> input_{0};
+        std::unique_ptr<std::atomic<double>[]> averages_;
+        clock::time_point last_tick_{clock::now()};
+        bool started_{false};
+
+    public:
+        atomic_ewma(std::shared_ptr<exporter_type> exporter, typename exporter_type::metadata_type metadata,
+                    ewma_mode mode, std::initializer_list<std::chrono::duration<double>> half_lives)
+                : data_{std::move(exporter), std::move(metadata), ewma_values{}}, mode_{mode},
+                  averages_{new std::atomic<double>[half_lives.size()]} {
+            for (auto half_life : half_lives) {
+                if (!(half_life.count() > 0)) throw std::invalid_argument("half-lives must be positive");
+                data_.value_.half_lives.push_back(half_life.count());
+                data_.value_.averages.push_back(0);
+            }
+            for (std::size_t i = 0; i < half_lives.size(); ++i) averages_[i].store(0, std::memory_order_relaxed);
+            data_.emit_init(data_.value_);
+        }
+
+        /// Adds amount to the events of the current tick, in rate mode.
+        void mark(value_type amount = 1) {
+            if constexpr (std::is_floating_point_v<value_type>) {
+                auto current = input_.load(std::memory_order_relaxed);
+                while (!input_.compare_exchange_weak(current, current + amount, std::memory_order_relaxed)) {}
+            } else {
+                input_.fetch_add(amount, std::memory_order_relaxed);
+            }
+        }
+
+        /// Sets the level that is sampled at the next tick, in level mode.
+        void set(value_type value) {
+            input_.store(value, std::memory_order_relaxed);
+        }
+
+        /// Decays the averages towards the rate or level of the time since the previous tick, and sends them. The
+        /// first tick starts the averages at that rate or level. Call it from one thread at a time.
+        const ewma_values &tick(clock::time_point now = clock::now()) {
+            auto seconds = std::chrono::duration<double>(now - last_tick_).count();
+            if (seconds <= 0) return data_.value_;
+            last_tick_ = now;
+            double sample;
+            if (mode_ == ewma_mode::rate) {
+                sample = static_cast<double>(input_.exchange(0, std::memory_order_relaxed)) / seconds;
+            } else {
+                sample = static_cast<double>(input_.load(std::memory_order_relaxed));
+            }
+            auto &values = data_.value_;
+            for (std::size_t i = 0; i < values.half_lives.size(); ++i) {
+                auto &average = values.averages[i];
+                if (started_) {
+                    average += (1 - std::exp2(-seconds / values.half_lives[i])) * (sample - average);
+                } else {
+                    average = sample;
+                }
+                averages_[i].store(average, std::memory_order_relaxed);
+            }
+            started_ = true;
+            data_.emit(values);
+            return values;
+        }
+
+        /// The average with the half-life at index, as of the last tick. Safe to call from any thread.
+        double value(std::size_t index = 0) const {
+            return averages_[index].load(std::memory_order_relaxed);
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_EWMA_H
@@ -0,0 +1,88 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_EXPORTER_STATISTICS_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_EXPORTER_STATISTICS_H
+#include "quantile_sketch.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+namespace crosscode::simple_instruments {
+
+    /// What a buffering exporter reports about its own work: how many records or buffers wait, how many values it
+    /// dropped, the bytes and batches it wrote, the write errors, and the distributions of write latency and batch
+    /// size. The built-in buffering exporters update one through relaxed atomics, plus a lock once per written batch,
+    /// and never emit from it; self_metrics publishes it as instruments.
+    class exporter_statistics {
+    public:
+        static constexpr double relative_accuracy = 0.01;
+        static constexpr double min_seconds = 1e-7;
+        static constexpr double max_seconds = 1e3;
+        static constexpr double min_batch_size = 1;
+        static constexpr double max_batch_size = 1e12;
+    private:
+        std::atomic<std::int64_t> queue_depth_{0};
+        std::atomic<std::uint64_t> dropped_{0};
+        std::atomic<std::uint64_t> bytes_written_{0};
+        std::atomic<std::uint64_t> batches_written_{0};
+        std::atomic<std::uint64_t> errors_{0};
+        std::mutex mutex_;
+        quantile_sketch flush_seconds_{relative_accuracy, min_seconds, max_seconds};
+        quantile_sketch batch_sizes_{relative_accuracy, min_batch_size, max_batch_size};
+
+    public:
+        void set_queue_depth(std::int64_t depth) {
+            queue_depth_.store(depth, std::memory_order_relaxed);
+        }
+
+        void add_dropped(std::uint64_t count = 1) {
+            dropped_.fetch_add(count, std::memory_order_relaxed);
+        }
+
+        void add_error() {
+            errors_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /// A batch of size items, bytes for line protocol and records for queued_exporter, was written in latency.
+        void add_batch(std::uint64_t size, std::uint64_t bytes, std::chrono::steady_clock::duration latency) {
+            bytes_written_.fetch_add(bytes, std::memory_order_relaxed);
+            batches_written_.fetch_add(1, std::memory_order_relaxed);
+            std::lock_guard lock{mutex_};
+            flush_seconds_.add(std::chrono::duration<double>(latency).count());
+            batch_sizes_.add(static_cast<double>(size));
+        }
+
+        /// Records or buffers waiting to be written, as last set by the exporter.
+        std::int64_t queue_depth() const {
+            return queue_depth_.load(std::memory_order_relaxed);
+        }
+
+        std::uint64_t dropped() const {
+            return dropped_.load(std::memory_order_relaxed);
+        }
+
+        std::uint64_t bytes_written() const {
+            return bytes_written_.load(std::memory_order_relaxed);
+        }
+
+        std::uint64_t batches_written() const {
+            return batches_written_.load(std::memory_order_relaxed);
+        }
+
+        std::uint64_t errors() const {
+            return errors_.load(std::memory_order_relaxed);
+        }
+
+        /// Merges the write latencies, in seconds, and batch sizes recorded since the previous call into the given
+        /// sketches, which need the parameters of this class.
+        void take_distributions(quantile_sketch &flush_seconds, quantile_sketch &batch_sizes) {
+            std::lock_guard lock{mutex_};
+            flush_seconds.merge(flush_seconds_);
+            batch_sizes.merge(batch_sizes_);
+            flush_seconds_.clear();
+            batch_sizes_.clear();
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_EXPORTER_STATISTICS_H
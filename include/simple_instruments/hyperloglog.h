@@ -0,0 +1,280 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_HYPERLOGLOG_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_HYPERLOGLOG_H
+#include "../simple_instruments.h"
+#include "detail/hash.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CROSSCODE_SIMPLE_INSTRUMENTS_HLL_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define CROSSCODE_SIMPLE_INSTRUMENTS_HLL_NEON
+#endif
+
+namespace crosscode::simple_instruments {
+
+    namespace detail {
+        inline unsigned leading_zeros(std::uint64_t value) {
+#if defined(__GNUC__)
+            return value == 0 ? 64 : static_cast<unsigned>(__builtin_clzll(value));
+#else
+            unsigned zeros = 0;
+            for (auto bit = std::uint64_t{1} << 63; bit != 0 && (value & bit) == 0; bit >>= 1) ++zeros;
+            return zeros;
+#endif
+        }
+
+        struct register_sum {
+            /// Sum of 2^-register over all registers.
+            double harmonic;
+            std::size_t zeros;
+        };
+
+        inline void max_registers_scalar(std::uint8_t *target, const std::uint8_t *source, std::size_t size) {
+            for (std::size_t i = 0; i < size; ++i) target[i] = std::max(target[i], source[i]);
+        }
+
+        inline register_sum sum_registers_scalar(const std::uint8_t *registers, std::size_t size) {
+            register_sum result{0, 0};
+            for (std::size_t i = 0; i < size; ++i) {
+                result.harmonic += std::ldexp(1.0, -static_cast<int>(registers[i]));
+                result.zeros += registers[i] == 0;
+            }
+            return result;
+        }
+
+        /// Element wise maximum of two register arrays, 16 registers per instruction where the CPU has SIMD.
+        inline void max_registers(std::uint8_t *target, const std::uint8_t *source, std::size_t size) {
+            std::size_t i = 0;
+#if defined(CROSSCODE_SIMPLE_INSTRUMENTS_HLL_SSE2)
+            for (; i + 16 <= size; i += 16) {
+                auto a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(target + i));
+                auto b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(target + i), _mm_max_epu8(a, b));
+            }
+#elif defined(CROSSCODE_SIMPLE_INSTRUMENTS_HLL_NEON)
+            for (; i + 16 <= size; i += 16) vst1q_u8(target + i, vmaxq_u8(vld1q_u8(target + i), vld1q_u8(source + i)));
+#endif
+            max_registers_scalar(target + i, source + i, size - i);
+        }
+
+        /// The sums the estimate needs. 2^-register is built directly as the bits of a float and added four at a
+        /// time; float rounding changes the sum by less than a millionth, far below the error of the estimate.
+        inline register_sum sum_registers(const std::uint8_t *registers, std::size_t size) {
+            register_sum result{0, 0};
+            std::size_t i = 0;
+#if defined(CROSSCODE_SIMPLE_INSTRUMENTS_HLL_SSE2)
+            auto zero = _mm_setzero_si128();
+            auto bias = _mm_set1_epi32(127);
+            for (; i + 16 <= size; i += 16) {
+                auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(registers + i));
+                auto zeros = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, zero)));
+                for (; zeros != 0; zeros &= zeros - 1) ++result.zeros;
+                auto low = _mm_unpacklo_epi8(bytes, zero);
+                auto high = _mm_unpackhi_epi8(bytes, zero);
+                __m128i words[4] = {_mm_unpacklo_epi16(low, zero), _mm_unpackhi_epi16(low, zero),
+                                    _mm_unpacklo_epi16(high, zero), _mm_unpackhi_epi16(high, zero)};
+                auto sum = _mm_setzero_ps();
+                for (auto w : words) {
+                    sum = _mm_add_ps(sum, _mm_castsi128_ps(_mm_slli_epi32(_mm_sub_epi32(bias, w), 23)));
+                }
+                alignas(16) float lanes[4];
+                _mm_store_ps(lanes, sum);
+                result.harmonic += static_cast<double>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+            }
+#elif defined(CROSSCODE_SIMPLE_INSTRUMENTS_HLL_NEON)
+            auto bias = vdupq_n_u32(127);
+            for (; i + 16 <= size; i += 16) {
+                auto bytes = vld1q_u8(registers + i);
+                result.zeros += vaddvq_u8(vandq_u8(vceqq_u8(bytes, vdupq_n_u8(0)), vdupq_n_u8(1)));
+                auto low = vmovl_u8(vget_low_u8(bytes));
+                auto high = vmovl_u8(vget_high_u8(bytes));
+                uint32x4_t words[4] = {vmovl_u16(vget_low_u16(low)), vmovl_u16(vget_high_u16(low)),
+                                       vmovl_u16(vget_low_u16(high)), vmovl_u16(vget_high_u16(high))};
+                auto sum = vdupq_n_f32(0);
+                for (auto w : words) {
+                    sum = vaddq_f32(sum, vreinterpretq_f32_u32(vshlq_n_u32(vsubq_u32(bias, w), 23)));
+                }
+                result.harmonic += static_cast<double>(vaddvq_f32(sum));
+            }
+#endif
+            auto rest = sum_registers_scalar(registers + i, size - i);
+            result.harmonic += rest.harmonic;
+            result.zeros += rest.zeros;
+            return result;
+        }
+    }
+
+    /// A HyperLogLog sketch: estimates the number of distinct values added to it with 2^precision registers of one
+    /// byte, with a standard error of about 1.04 / sqrt(2^precision), 0.8% for the default precision of 14. Sketches
+    /// with the same precision can be merged, so sketches of several intervals or processes give the number of
+    /// distinct values of all of them together.
+    class hyperloglog_sketch {
+        unsigned precision_;
+        std::vector<std::uint8_t> registers_;
+
+    public:
+        static constexpr unsigned min_precision = 4;
+        static constexpr unsigned max_precision = 18;
+
+        explicit hyperloglog_sketch(unsigned precision = 14) : precision_{precision} {
+            if (precision < min_precision || precision > max_precision) {
+                throw std::invalid_argument("precision must be between 4 and 18");
+            }
+            registers_.resize(std::size_t{1} << precision);
+        }
+
+        /// A sketch from registers sent by another process.
+        hyperloglog_sketch(unsigned precision, std::vector<std::uint8_t> registers)
+                : hyperloglog_sketch{precision} {
+            if (registers.size() != registers_.size()) throw std::invalid_argument("registers do not match precision");
+            registers_ = std::move(registers);
+        }
+
+        /// The register a hash updates and the value it is updated to.
+        static std::pair<std::size_t, std::uint8_t> position(std::uint64_t hash, unsigned precision) {
+            auto rest = (hash << precision) | (std::uint64_t{1} << (precision - 1));
+            return {static_cast<std::size_t>(hash >> (64 - precision)),
+                    static_cast<std::uint8_t>(detail::leading_zeros(rest) + 1)};
+        }
+
+        static std::uint64_t hash(std::string_view value) {
+            return detail::mix(detail::hash_bytes(0x2545f4914f6cdd1dull, value));
+        }
+
+        static std::uint64_t hash(std::uint64_t value) {
+            return detail::mix(value ^ 0x2545f4914f6cdd1dull);
+        }
+
+        void add_hash(std::uint64_t hash) {
+            auto [index, rank] = position(hash, precision_);
+            registers_[index] = std::max(registers_[index], rank);
+        }
+
+        void add(std::string_view value) {
+            add_hash(hash(value));
+        }
+
+        void add(std::uint64_t value) {
+            add_hash(hash(value));
+        }
+
+        void merge(const hyperloglog_sketch &other) {
+            if (other.precision_ != precision_) {
+                throw std::invalid_argument("sketches with different precisions can not be merged");
+            }
+            detail::max_registers(registers_.data(), other.registers_.data(), registers_.size());
+        }
+
+        /// The estimated number of distinct values.
+        double estimate() const {
+            auto m = static_cast<double>(registers_.size());
+            auto sums = detail::sum_registers(registers_.data(), registers_.size());
+            double alpha;
+            switch (precision_) {
+                case 4: alpha = 0.673; break;
+                case 5: alpha = 0.697; break;
+                case 6: alpha = 0.709; break;
+                default: alpha = 0.7213 / (1 + 1.079 / m);
+            }
+            auto estimate = alpha * m * m / sums.harmonic;
+            if (estimate <= 2.5 * m && sums.zeros != 0) {
+                // Linear counting is more accurate for small numbers of values.
+                return m * std::log(m / static_cast<double>(sums.zeros));
+            }
+            return estimate;
+        }
+
+        void clear() {
+            std::fill(registers_.begin(), registers_.end(), std::uint8_t{0});
+        }
+
+        unsigned precision() const {
+            return precision_;
+        }
+
+        /// The registers, to send the sketch elsewhere.
+        const std::vector<std::uint8_t> &registers() const {
+            return registers_;
+        }
+
+        /// The registers, for merging register arrays filled elsewhere.
+        std::uint8_t *data() {
+            return registers_.data();
+        }
+    };
+
+    /// Counts the distinct values, like user ids or addresses, added since the last call of collect(), without keeping
+    /// the values. collect() sends a hyperloglog_sketch to the exporter, whose estimate() is the number of distinct
+    /// values and which can be merged downstream; intervals without values are not sent.
+    ///
+    /// Adding is lock free: it raises one register with compare and swap, and only when the value raises it, which
+    /// becomes rare once the registers fill up.
+    template <typename Texporter>
+    class atomic_distinct_counter {
+    public:
+        using value_type = std::uint64_t;
+        using exporter_type = Texporter;
+    private:
+        data_block<hyperloglog_sketch, exporter_type> data_;
+        std::unique_ptr<std::atomic<std::uint8_t>[]> registers_;
+
+    public:
+        atomic_distinct_counter(std::shared_ptr<exporter_type> exporter, typename exporter_type::metadata_type metadata,
+                                unsigned precision = 14)
+                : data_{std::move(exporter), std::move(metadata), hyperloglog_sketch{precision}},
+                  registers_{new std::atomic<std::uint8_t>[std::size_t{1} << precision]} {
+            for (std::size_t i = 0; i < data_.value_.registers().size(); ++i) {
+                registers_[i].store(0, std::memory_order_relaxed);
+            }
+            data_.emit_init(data_.value_);
+        }
+
+        void add_hash(std::uint64_t hash) {
+            auto [index, rank] = hyperloglog_sketch::position(hash, data_.value_.precision());
+            auto &reg = registers_[index];
+            auto current = reg.load(std::memory_order_relaxed);
+            while (rank > current && !reg.compare_exchange_weak(current, rank, std::memory_order_relaxed)) {}
+        }
+
+        void add(std::string_view value) {
+            add_hash(hyperloglog_sketch::hash(value));
+        }
+
+        void add(std::uint64_t value) {
+            add_hash(hyperloglog_sketch::hash(value));
+        }
+
+        /// Ends the interval: sends the sketch of the values added since the previous call, and starts over. Call it
+        /// from one thread at a time, for example from a collector.
+        const hyperloglog_sketch &collect() {
+            auto &sketch = data_.value_;
+            auto registers = sketch.data();
+            std::uint8_t any = 0;
+            for (std::size_t i = 0; i < sketch.registers().size(); ++i) {
+                registers[i] = registers_[i].load(std::memory_order_relaxed);
+                if (registers[i] != 0) registers[i] = registers_[i].exchange(0, std::memory_order_relaxed);
+                any |= registers[i];
+            }
+            if (any != 0) data_.emit(sketch);
+            return sketch;
+        }
+
+        /// The sketch of the last collect(). Only use it from the thread that calls collect().
+        const hyperloglog_sketch &last() const {
+            return data_.value_;
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_HYPERLOGLOG_H
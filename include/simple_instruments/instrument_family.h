@@ -0,0 +1,391 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_INSTRUMENT_FAMILY_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_INSTRUMENT_FAMILY_H
+#include "../simple_instruments.h"
+#include "epoch.h"
+#include "detail/hash.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace crosscode::simple_instruments {
+
+    /// A label of a child of an instrument_family.
+    struct label {
+        std::string_view name;
+        std::string_view value;
+    };
+
+    namespace detail {
+        template <std::size_t Nlabels>
+        std::uint64_t hash_labels(const std::array<std::string_view, Nlabels> &values) {
+            std::uint64_t h = 0x2545f4914f6cdd1dull;
+            for (const auto &value : values) {
+                h = hash_bytes(h, value);
+            }
+            return mix(h);
+        }
+    }
+
+    /// A set of instruments of the same type that share metadata and differ only in the values of Nlabels labels, for
+    /// example requests per endpoint and status. A child is created the first time its label values are used, with
+    /// metadata obtained from with_labels(metadata, std::array<label, Nlabels>), which is found through argument
+    /// dependent lookup and has to be provided with the metadata type.
+    ///
+    /// Children are kept in an open addressing hash table that readers probe without taking a lock; only creating a
+    /// child locks. The table starts small and is replaced by one twice as large when it is half full, so max_series
+    /// can be large, or std::numeric_limits<std::size_t>::max() for no limit, without allocating for it up front.
+    /// Children, their label values and their metadata are allocated from the memory resource of the factory, when it
+    /// has one.
+    ///
+    /// The number of children is bounded by max_series and by the series_limit of the factory. Label combinations
+    /// beyond that are folded into a single overflow child, so hostile label values can not grow memory or the
+    /// number of exported series without bound.
+    ///
+    /// Children that are not used for a number of export intervals can be removed with expire_idle(). Removed
+    /// children are freed once no thread can still use them, which is tracked with an epoch_domain. A family on which
+    /// expire_idle() is called must only be used while pinned: either hold the guard returned by pin() while using
+    /// the reference returned by with(), or use apply(). Without expire_idle() children live as long as the family
+    /// and references returned by with() stay valid.
+    template <typename Tinstrument, std::size_t Nlabels>
+    class instrument_family {
+    public:
+        using instrument_type = Tinstrument;
+        using value_type = typename instrument_type::value_type;
+        using exporter_type = typename instrument_type::exporter_type;
+        using metadata_type = typename exporter_type::metadata_type;
+        using exporter_shared_ptr_type = std::shared_ptr<exporter_type>;
+        using label_values_type = std::array<std::string_view, Nlabels>;
+        static constexpr std::string_view overflow_label_value = "__overflow__";
+    private:
+        /// Number of children the first table has room for.
+        static constexpr std::size_t initial_series = 16;
+
+        struct child {
+            std::uint64_t hash;
+            std::array<std::pmr::string, Nlabels> label_values;
+            std::atomic<std::uint64_t> last_used;
+            instrument_type instrument;
+
+            template <std::size_t ...I>
+            static std::array<std::pmr::string, Nlabels> copy(const label_values_type &values,
+                                                              std::pmr::memory_resource *resource,
+                                                              std::index_sequence<I...>) {
+                if (resource == nullptr) resource = std::pmr::get_default_resource();
+                return {std::pmr::string{values[I], resource}...};
+            }
+
+            template <typename ...Args>
+            child(std::uint64_t h, const label_values_type &values, std::pmr::memory_resource *resource,
+                  std::uint64_t interval, Args &&...args)
+                    : hash{h}, label_values{copy(values, resource, std::make_index_sequence<Nlabels>{})},
+                      last_used{interval}, instrument{std::forward<Args>(args)...} {}
+
+            bool matches(std::uint64_t h, const label_values_type &values) const {
+                if (hash != h) return false;
+                for (std::size_t i = 0; i < Nlabels; ++i) {
+                    if (label_values[i] != values[i]) return false;
+                }
+                return true;
+            }
+        };
+
+        struct table {
+            std::size_t mask;
+            std::unique_ptr<std::atomic<child *>[]> slots;
+
+            explicit table(std::size_t size) : mask{size - 1}, slots{new std::atomic<child *>[size]} {
+                for (std::size_t i = 0; i < size; ++i) slots[i].store(nullptr, std::memory_order_relaxed);
+            }
+        };
+
+        template <typename T>
+        struct retired {
+            T *object;
+            std::uint64_t tag;
+        };
+
+        /// Marks a slot of a removed child, so probing continues past it.
+        static child *tombstone() {
+            alignas(child) static char marker;
+            return reinterpret_cast<child *>(&marker);
+        }
+
+        exporter_shared_ptr_type exporter_;
+        metadata_type metadata_;
+        std::array<std::string, Nlabels> label_names_;
+        value_type initial_value_;
+        std::size_t max_series_;
+        std::shared_ptr<series_limit> limit_;
+        std::pmr::memory_resource *memory_;
+        std::atomic<table *> table_;
+        std::mutex mutex_;
+        std::size_t size_{0};
+        std::size_t tombstones_{0};
+        std::atomic<bool> full_{false};
+        std::atomic<child *> overflow_{nullptr};
+        std::atomic<std::uint64_t> rejected_{0};
+        std::atomic<std::uint64_t> interval_{0};
+        epoch_domain epochs_;
+        std::vector<retired<child>> retired_children_;
+        std::vector<retired<table>> retired_tables_;
+
+        static child *find(const table &t, std::uint64_t hash, const label_values_type &values) {
+            for (auto index = hash & t.mask;; index = (index + 1) & t.mask) {
+                auto existing = t.slots[index].load(std::memory_order_acquire);
+                if (existing == nullptr) return nullptr;
+                if (existing != tombstone() && existing->matches(hash, values)) return existing;
+            }
+        }
+
+        child *make_child(std::uint64_t hash, const label_values_type &values) {
+            std::array<label, Nlabels> labels;
+            for (std::size_t i = 0; i < Nlabels; ++i) labels[i] = {label_names_[i], values[i]};
+            auto metadata = detail::adopt_metadata(with_labels(metadata_, labels), memory_);
+            return detail::new_object<child>(memory_, hash, values, memory_, interval_.load(std::memory_order_relaxed),
+                                             exporter_, std::move(metadata), initial_value_);
+        }
+
+        /// Called with mutex_ locked, after size_ was incremented for the new child.
+        child *insert(std::uint64_t hash, const label_values_type &values) {
+            auto created = make_child(hash, values);
+            auto current = table_.load(std::memory_order_relaxed);
+            if ((size_ + tombstones_) * 2 > current->mask + 1) rebuild(detail::table_size(size_));
+            auto &t = *table_.load(std::memory_order_relaxed);
+            for (auto index = hash & t.mask;; index = (index + 1) & t.mask) {
+                auto existing = t.slots[index].load(std::memory_order_relaxed);
+                if (existing == nullptr || existing == tombstone()) {
+                    if (existing == tombstone()) --tombstones_;
+                    t.slots[index].store(created, std::memory_order_release);
+                    return created;
+                }
+            }
+        }
+
+        /// The overflow child is kept outside the table, so it is never expired and never counted in size(). with()
+        /// only returns it when the limits are reached or all label values are overflow_label_value. Called with mutex_
+        /// locked.
+        instrument_type &overflow_locked() {
+            auto o = overflow_.load(std::memory_order_relaxed);
+            if (o == nullptr) {
+                label_values_type values;
+                values.fill(overflow_label_value);
+                o = make_child(detail::hash_labels(values), values);
+                overflow_.store(o, std::memory_order_release);
+            }
+            return o->instrument;
+        }
+
+        instrument_type &reject() {
+            rejected_.fetch_add(1, std::memory_order_relaxed);
+            limit_->reject();
+            auto o = overflow_.load(std::memory_order_acquire);
+            if (o != nullptr) return o->instrument;
+            std::lock_guard lock{mutex_};
+            return overflow_locked();
+        }
+
+        static bool is_overflow(const label_values_type &values) {
+            for (const auto &value : values) {
+                if (value != overflow_label_value) return false;
+            }
+            return true;
+        }
+
+        instrument_type &create(std::uint64_t hash, const label_values_type &values) {
+            if (is_overflow(values)) return overflow();
+            if (full_.load(std::memory_order_relaxed) || limit_->exhausted()) return reject();
+            {
+                std::lock_guard lock{mutex_};
+                if (auto existing = find(*table_.load(std::memory_order_relaxed), hash, values)) {
+                    return existing->instrument;
+                }
+                if (size_ >= max_series_) {
+                    full_.store(true, std::memory_order_relaxed);
+                } else if (limit_->try_acquire()) {
+                    ++size_;
+                    return insert(hash, values)->instrument;
+                }
+            }
+            return reject();
+        }
+
+        /// Replaces the table by one of size slots without tombstones. Readers that still probe the old table find no
+        /// children created after this, and create() finds them in the new table. The old table is retired like a
+        /// removed child; without expire_idle() it is kept until the family is destroyed, which together with the
+        /// earlier tables is never more than the current table. Called with mutex_ locked.
+        void rebuild(std::size_t size) {
+            auto old = table_.load(std::memory_order_relaxed);
+            auto replacement = std::make_unique<table>(size);
+            for (std::size_t i = 0; i <= old->mask; ++i) {
+                auto c = old->slots[i].load(std::memory_order_relaxed);
+                if (c == nullptr || c == tombstone()) continue;
+                for (auto index = c->hash & replacement->mask;; index = (index + 1) & replacement->mask) {
+                    if (replacement->slots[index].load(std::memory_order_relaxed) == nullptr) {
+                        replacement->slots[index].store(c, std::memory_order_relaxed);
+                        break;
+                    }
+                }
+            }
+            table_.store(replacement.release(), std::memory_order_release);
+            retired_tables_.push_back({old, epochs_.epoch()});
+            tombstones_ = 0;
+        }
+
+        template <typename T, typename F>
+        void reclaim(std::vector<retired<T>> &list, F &&free) {
+            auto kept = list.begin();
+            for (auto &r : list) {
+                if (epochs_.reclaimable(r.tag)) {
+                    free(r.object);
+                } else {
+                    *kept++ = r;
+                }
+            }
+            list.erase(kept, list.end());
+        }
+
+        /// Frees retired children and tables no thread can use anymore. Called with mutex_ locked.
+        void reclaim() {
+            epochs_.try_advance();
+            reclaim(retired_children_, [this](child *c) { detail::delete_object(memory_, c); });
+            reclaim(retired_tables_, [](table *t) { delete t; });
+        }
+
+    public:
+        instrument_family(exporter_shared_ptr_type exporter, metadata_type metadata,
+                          const std::string_view (&label_names)[Nlabels], value_type initial_value,
+                          std::size_t max_series, std::shared_ptr<series_limit> limit,
+                          std::pmr::memory_resource *memory = nullptr)
+                : exporter_{std::move(exporter)}, metadata_{std::move(metadata)}, label_names_{},
+                  initial_value_{initial_value}, max_series_{max_series}, limit_{std::move(limit)}, memory_{memory},
+                  table_{new table{detail::table_size(std::min(max_series, initial_series))}} {
+            for (std::size_t i = 0; i < Nlabels; ++i) label_names_[i] = label_names[i];
+        }
+
+        instrument_family(const instrument_family &) = delete;
+        instrument_family &operator=(const instrument_family &) = delete;
+
+        ~instrument_family() {
+            limit_->release(size_);
+            std::unique_ptr<table> t{table_.load(std::memory_order_relaxed)};
+            for (std::size_t i = 0; i <= t->mask; ++i) {
+                auto c = t->slots[i].load(std::memory_order_relaxed);
+                if (c != tombstone()) detail::delete_object(memory_, c);
+            }
+            detail::delete_object(memory_, overflow_.load(std::memory_order_relaxed));
+            for (auto &r : retired_children_) detail::delete_object(memory_, r.object);
+            for (auto &r : retired_tables_) delete r.object;
+        }
+
+        /// Returns the child with the given label values, creating it when it does not exist yet. When the family
+        /// already has max_series children, or the series limit of the factory is reached, the overflow child is
+        /// returned instead; it is exported with all label values set to overflow_label_value. Passing
+        /// overflow_label_value for all labels also returns the overflow child, so no child is exported as it.
+        instrument_type &with(const label_values_type &values) {
+            auto hash = detail::hash_labels(values);
+            auto existing = find(*table_.load(std::memory_order_acquire), hash, values);
+            if (existing == nullptr) return create(hash, values);
+            auto now = interval_.load(std::memory_order_relaxed);
+            if (existing->last_used.load(std::memory_order_relaxed) != now) {
+                existing->last_used.store(now, std::memory_order_relaxed);
+            }
+            return existing->instrument;
+        }
+
+        template <typename ...Tlabels>
+        instrument_type &with(const Tlabels &...values) {
+            static_assert(sizeof...(Tlabels) == Nlabels, "a value is needed for every label");
+            return with(label_values_type{std::string_view{values}...});
+        }
+
+        /// The child that label combinations beyond the limits are folded into.
+        instrument_type &overflow() {
+            auto o = overflow_.load(std::memory_order_acquire);
+            if (o != nullptr) return o->instrument;
+            std::lock_guard lock{mutex_};
+            return overflow_locked();
+        }
+
+        /// Pins the family, so children returned by with() are not freed until the guard is destroyed.
+        epoch_domain::guard pin() {
+            return epochs_.pin();
+        }
+
+        /// Calls f with the child for the given label values while the family is pinned.
+        template <typename F>
+        decltype(auto) apply(const label_values_type &values, F &&f) {
+            auto guard = pin();
+            return f(with(values));
+        }
+
+        /// Ends the current export interval and removes children that were not used through with() in the last
+        /// intervals export intervals. Call it once per export interval, from one thread at a time. The overflow
+        /// child is never removed. Returns the number of removed children.
+        std::size_t expire_idle(std::uint64_t intervals) {
+            std::lock_guard lock{mutex_};
+            auto now = interval_.fetch_add(1, std::memory_order_relaxed) + 1;
+            auto &t = *table_.load(std::memory_order_relaxed);
+            std::size_t removed = 0;
+            for (std::size_t i = 0; i <= t.mask; ++i) {
+                auto c = t.slots[i].load(std::memory_order_relaxed);
+                if (c == nullptr || c == tombstone()) continue;
+                if (now - c->last_used.load(std::memory_order_relaxed) <= intervals) continue;
+                t.slots[i].store(tombstone(), std::memory_order_release);
+                retired_children_.push_back({c, epochs_.epoch()});
+                ++tombstones_;
+                ++removed;
+            }
+            if (removed > 0) {
+                size_ -= removed;
+                limit_->release(removed);
+                full_.store(false, std::memory_order_relaxed);
+            }
+            if (tombstones_ > (t.mask + 1) / 4) rebuild(t.mask + 1);
+            reclaim();
+            return removed;
+        }
+
+        /// Calls f(label_values, instrument) for every child, including the overflow child once it exists.
+        template <typename F>
+        void for_each(F &&f) {
+            auto guard = pin();
+            auto &t = *table_.load(std::memory_order_acquire);
+            label_values_type values;
+            auto visit = [&values, &f](child &c) {
+                for (std::size_t l = 0; l < Nlabels; ++l) values[l] = c.label_values[l];
+                f(values, c.instrument);
+            };
+            for (std::size_t i = 0; i <= t.mask; ++i) {
+                auto c = t.slots[i].load(std::memory_order_acquire);
+                if (c == nullptr || c == tombstone()) continue;
+                visit(*c);
+            }
+            if (auto o = overflow_.load(std::memory_order_acquire)) visit(*o);
+        }
+
+        /// Number of children, not counting the overflow child.
+        std::size_t size() {
+            std::lock_guard lock{mutex_};
+            return size_;
+        }
+
+        /// Number of calls of with() that were folded into the overflow child because of the limits. Every call counts,
+        /// so a label combination that is used often counts often; it is not the number of distinct combinations.
+        std::uint64_t rejected() const {
+            return rejected_.load(std::memory_order_relaxed);
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_INSTRUMENT_FAMILY_H
@@ -0,0 +1,118 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_INSTRUMENT_GROUP_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_INSTRUMENT_GROUP_H
+#include "../simple_instruments.h"
+#include "epoch.h"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace crosscode::simple_instruments {
+
+    /// The counters of an atomic_instrument_group, as of one collect().
+    struct instrument_group_snapshot {
+        std::vector<std::int64_t> values;
+    };
+
+    /// Bidirectional counters that are exported together and consistently: all changes made in one update() are in
+    /// the same snapshot, so ratios like errors / requests are never torn between two counters changed by one
+    /// request.
+    ///
+    /// Changes are added to one of two banks, chosen by the parity of an epoch_domain epoch the update pins. collect()
+    /// advances the epoch, so new updates go to the other bank, waits until the updates still pinned to the previous
+    /// epoch have finished, and then moves that bank into the totals. Updates never wait: pinning is the only extra
+    /// cost, and collect() only waits for updates that are already running.
+    template <typename Texporter>
+    class atomic_instrument_group {
+    public:
+        using value_type = std::int64_t;
+        using exporter_type = Texporter;
+    private:
+        data_block<instrument_group_snapshot, exporter_type> data_;
+        std::size_t size_;
+        epoch_domain epochs_;
+        std::array<std::unique_ptr<std::atomic<value_type>[]>, 2> banks_;
+        std::mutex collect_mutex_;
+
+    public:
+        /// Changes to several counters of a group that are exported together. Keep it short: collect() waits until
+        /// every update that is running when it is called has been destroyed.
+        class update {
+            epoch_domain::guard guard_;
+            std::atomic<value_type> *bank_;
+        public:
+            explicit update(atomic_instrument_group &group)
+                    : guard_{group.epochs_}, bank_{group.banks_[guard_.epoch() & 1u].get()} {}
+
+            void add(std::size_t index, value_type amount = 1) {
+                bank_[index].fetch_add(amount, std::memory_order_relaxed);
+            }
+
+            void sub(std::size_t index, value_type amount = 1) {
+                bank_[index].fetch_sub(amount, std::memory_order_relaxed);
+            }
+        };
+
+        atomic_instrument_group(std::shared_ptr<exporter_type> exporter, typename exporter_type::metadata_type metadata,
+                                std::size_t size)
+                : data_{std::move(exporter), std::move(metadata), instrument_group_snapshot{}}, size_{size} {
+            if (size == 0) throw std::invalid_argument("size must be positive");
+            for (auto &bank : banks_) {
+                bank.reset(new std::atomic<value_type>[size]);
+                for (std::size_t i = 0; i < size; ++i) bank[i].store(0, std::memory_order_relaxed);
+            }
+            data_.value_.values.resize(size);
+            data_.emit_init(data_.value_);
+        }
+
+        update begin_update() {
+            return update{*this};
+        }
+
+        /// Changes one counter, as an update of its own.
+        void add(std::size_t index, value_type amount = 1) {
+            update{*this}.add(index, amount);
+        }
+
+        void sub(std::size_t index, value_type amount = 1) {
+            update{*this}.sub(index, amount);
+        }
+
+        std::size_t size() const {
+            return size_;
+        }
+
+        /// Takes a snapshot that contains every update that finished before the call, and no part of an update that
+        /// started after it, and sends it when a counter changed.
+        const instrument_group_snapshot &collect() {
+            std::lock_guard lock{collect_mutex_};
+            auto previous = epochs_.epoch();
+            while (!epochs_.try_advance()) std::this_thread::yield();
+            while (!epochs_.previous_drained()) std::this_thread::yield();
+            auto &bank = banks_[previous & 1u];
+            auto &snapshot = data_.value_;
+            bool changed = false;
+            for (std::size_t i = 0; i < size_; ++i) {
+                auto delta = bank[i].exchange(0, std::memory_order_acquire);
+                snapshot.values[i] += delta;
+                changed = changed || delta != 0;
+            }
+            if (changed) data_.emit(snapshot);
+            return snapshot;
+        }
+
+        /// The snapshot of the last collect(). Only use it from the thread that calls collect().
+        const instrument_group_snapshot &last() const {
+            return data_.value_;
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_INSTRUMENT_GROUP_H
@@ -0,0 +1,202 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_LINE_PROTOCOL_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_LINE_PROTOCOL_H
+#include "exporter_statistics.h"
+#include "number_format.h"
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace crosscode::simple_instruments {
+
+    namespace detail {
+        template <typename Tvalue>
+        void append_number(std::string &out, Tvalue value) {
+            char buffer[max_number_chars];
+            out.append(buffer, format_number(buffer, value));
+        }
+    }
+
+    /// Appends value as InfluxDB line protocol field value: integers get an i suffix, unsigned integers an u suffix.
+    template <typename Tvalue>
+    void append_line_protocol_value(std::string &out, const Tvalue &value) {
+        static_assert(std::is_arithmetic_v<Tvalue>, "line protocol only supports arithmetic values");
+        if constexpr (std::is_same_v<Tvalue, bool>) {
+            out.append(value ? "true" : "false");
+        } else if constexpr (std::is_floating_point_v<Tvalue>) {
+            detail::append_number(out, value);
+        } else if constexpr (std::is_signed_v<Tvalue>) {
+            detail::append_number(out, static_cast<std::int64_t>(value));
+            out.push_back('i');
+        } else {
+            detail::append_number(out, static_cast<std::uint64_t>(value));
+            out.push_back('u');
+        }
+    }
+
+    /// Defined in simple_instruments/aggregate_recorder.h
+    template <typename Tvalue>
+    struct value_aggregate;
+
+    /// Appends the fields of a value: "value=<value>".
+    template <typename Tvalue>
+    void append_line_protocol_fields(std::string &out, const Tvalue &value) {
+        out.append("value=");
+        append_line_protocol_value(out, value);
+    }
+
+    /// Appends the fields of an aggregate: "min=<min>,max=<max>,sum=<sum>,count=<count>u".
+    template <typename Tvalue>
+    void append_line_protocol_fields(std::string &out, const value_aggregate<Tvalue> &aggregate) {
+        out.append("min=");
+        append_line_protocol_value(out, aggregate.min);
+        out.append(",max=");
+        append_line_protocol_value(out, aggregate.max);
+        out.append(",sum=");
+        append_line_protocol_value(out, aggregate.sum);
+        out.append(",count=");
+        append_line_protocol_value(out, aggregate.count);
+    }
+
+    /// Appends the fields of a sketch: "count=<count>u,sum=<sum>,min=<min>,max=<max>,p50=<p50>,p90=<p90>,p99=<p99>",
+    /// or only the count for an empty sketch.
+    inline void append_line_protocol_fields(std::string &out, const quantile_sketch &sketch) {
+        out.append("count=");
+        append_line_protocol_value(out, sketch.count());
+        if (sketch.count() == 0) return;
+        out.append(",sum=");
+        append_line_protocol_value(out, sketch.sum());
+        out.append(",min=");
+        append_line_protocol_value(out, sketch.min());
+        out.append(",max=");
+        append_line_protocol_value(out, sketch.max());
+        out.append(",p50=");
+        append_line_protocol_value(out, sketch.quantile(0.5));
+        out.append(",p90=");
+        append_line_protocol_value(out, sketch.quantile(0.9));
+        out.append(",p99=");
+        append_line_protocol_value(out, sketch.quantile(0.99));
+    }
+
+    /// Appends one line: "<series> <fields> <timestamp>\n". series is expected to be an escaped line protocol
+    /// measurement with optional tags.
+    template <typename Tvalue>
+    void append_line_protocol(std::string &out, std::string_view series, const Tvalue &value, std::int64_t timestamp) {
+        out.append(series);
+        out.push_back(' ');
+        append_line_protocol_fields(out, value);
+        out.push_back(' ');
+        detail::append_number(out, timestamp);
+        out.push_back('\n');
+    }
+
+    /// Sink that appends buffers to a file.
+    class file_sink {
+        std::ofstream out_;
+    public:
+        explicit file_sink(const std::string &path) : out_{path, std::ios::binary | std::ios::app} {
+            if (!out_) throw std::runtime_error("could not open " + path);
+        }
+
+        void write(std::string &&buffer) {
+            out_.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        }
+
+        void flush() {
+            out_.flush();
+        }
+    };
+
+    /// Exporter that writes every value as InfluxDB line protocol into a buffer, and hands the buffer to Tsink when it
+    /// reaches buffer_size. The series is obtained by calling unique_identifier(metadata), which is found through
+    /// argument dependent lookup.
+    ///
+    /// A sink has to provide write(std::string&&), which takes ownership of a completed buffer, and flush().
+    template <typename Tmetadata, typename Tsink>
+    class line_protocol_exporter {
+    public:
+        using metadata_type = Tmetadata;
+        using sink_type = Tsink;
+    private:
+        std::mutex mutex_;
+        std::size_t buffer_size_;
+        std::string buffer_;
+        std::shared_ptr<exporter_statistics> statistics_{std::make_shared<exporter_statistics>()};
+        sink_type sink_;
+
+        template <typename Tvalue>
+        void append(const Tvalue &value, const metadata_type &md) {
+            const auto &id = unique_identifier(md);
+            auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+            std::lock_guard lock{mutex_};
+            append_line_protocol(buffer_, std::string_view{id}, value, timestamp);
+            if (buffer_.size() >= buffer_size_) write_buffer();
+        }
+
+        void write_buffer() {
+            if (buffer_.empty()) return;
+            std::string full;
+            full.reserve(buffer_size_ + buffer_size_ / 4);
+            std::swap(full, buffer_);
+            auto size = full.size();
+            auto start = std::chrono::steady_clock::now();
+            try {
+                sink_.write(std::move(full));
+            } catch (...) {
+                statistics_->add_error();
+                throw;
+            }
+            statistics_->add_batch(size, size, std::chrono::steady_clock::now() - start);
+        }
+
+    public:
+        template <typename ...Args>
+        explicit line_protocol_exporter(std::size_t buffer_size, Args &&...args)
+                : buffer_size_{buffer_size}, sink_{std::forward<Args>(args)...} {
+            buffer_.reserve(buffer_size_ + buffer_size_ / 4);
+        }
+
+        line_protocol_exporter(const line_protocol_exporter &) = delete;
+        line_protocol_exporter &operator=(const line_protocol_exporter &) = delete;
+
+        ~line_protocol_exporter() {
+            flush();
+        }
+
+        template <typename Tvalue>
+        void emit_init(const Tvalue &value, const metadata_type &md) {
+            append(value, md);
+        }
+
+        template <typename Tvalue>
+        void emit(const Tvalue &value, const metadata_type &md) {
+            append(value, md);
+        }
+
+        /// Hands the current buffer to the sink, even when it is not full, and flushes the sink.
+        void flush() {
+            std::lock_guard lock{mutex_};
+            write_buffer();
+            sink_.flush();
+        }
+
+        sink_type &sink() {
+            return sink_;
+        }
+
+        /// Bytes and buffers written, write latencies and errors; publish them with self_metrics.
+        const std::shared_ptr<exporter_statistics> &statistics() const {
+            return statistics_;
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_LINE_PROTOCOL_H
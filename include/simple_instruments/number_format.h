@@ -0,0 +1,202 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_NUMBER_FORMAT_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_NUMBER_FORMAT_H
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CROSSCODE_SIMPLE_INSTRUMENTS_FORMAT_SSE2
+#endif
+
+namespace crosscode::simple_instruments {
+
+    /// Buffer size that is enough for every number the format functions write.
+    inline constexpr std::size_t max_number_chars = 32;
+
+    namespace detail {
+        inline constexpr char digit_pairs[] =
+                "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+                "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+                "8081828384858687888990919293949596979899";
+
+        /// Writes value, at most 9999, without leading zeros.
+        inline char *format_small(char *out, std::uint32_t value) {
+            if (value < 10) {
+                *out = static_cast<char>('0' + value);
+                return out + 1;
+            }
+            if (value < 100) {
+                std::memcpy(out, digit_pairs + value * 2, 2);
+                return out + 2;
+            }
+            if (value < 1000) {
+                *out = static_cast<char>('0' + value / 100);
+                std::memcpy(out + 1, digit_pairs + value % 100 * 2, 2);
+                return out + 3;
+            }
+            std::memcpy(out, digit_pairs + value / 100 * 2, 2);
+            std::memcpy(out + 2, digit_pairs + value % 100 * 2, 2);
+            return out + 4;
+        }
+
+        inline unsigned lowest_bit(unsigned mask) {
+#if defined(__GNUC__)
+            return static_cast<unsigned>(__builtin_ctz(mask));
+#else
+            unsigned bit = 0;
+            while ((mask & 1u) == 0) {
+                mask >>= 1;
+                ++bit;
+            }
+            return bit;
+#endif
+        }
+
+#if defined(CROSSCODE_SIMPLE_INSTRUMENTS_FORMAT_SSE2)
+        /// The 8 decimal digits of value, at most 99999999, as 16 bit lanes, most significant first. Both halves of
+        /// 4 digits are divided by 1000, 100, 10 and 1 at once with multiplications by fixed point reciprocals.
+        inline __m128i eight_digits(std::uint32_t value) {
+            auto abcdefgh = _mm_cvtsi32_si128(static_cast<int>(value));
+            auto abcd = _mm_srli_epi64(_mm_mul_epu32(abcdefgh, _mm_set1_epi32(static_cast<int>(0xd1b71759))), 45);
+            auto efgh = _mm_sub_epi32(abcdefgh, _mm_mul_epu32(abcd, _mm_set1_epi32(10000)));
+            auto v1 = _mm_slli_epi64(_mm_unpacklo_epi16(abcd, efgh), 2);
+            auto v1_pairs = _mm_unpacklo_epi16(v1, v1);
+            auto v2 = _mm_unpacklo_epi32(v1_pairs, v1_pairs);
+            // [a, ab, abc, abcd, e, ef, efg, efgh]
+            auto v3 = _mm_mulhi_epu16(v2, _mm_setr_epi16(8389, 5243, 13108, -32768, 8389, 5243, 13108, -32768));
+            auto v4 = _mm_mulhi_epu16(v3, _mm_setr_epi16(1 << 7, 1 << 11, 1 << 13, -32768,
+                                                         1 << 7, 1 << 11, 1 << 13, -32768));
+            // Subtracts ten times the digits before each lane: [a, b, c, d, e, f, g, h]
+            auto v5 = _mm_slli_epi64(_mm_mullo_epi16(v4, _mm_set1_epi16(10)), 16);
+            return _mm_sub_epi16(v4, v5);
+        }
+
+        /// Writes 16 digits as characters, and returns how many of them are leading zeros.
+        inline unsigned sixteen_digits(char *out, __m128i high, __m128i low) {
+            auto chars = _mm_add_epi8(_mm_packus_epi16(high, low), _mm_set1_epi8('0'));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out), chars);
+            auto zeros = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_set1_epi8('0'))));
+            return lowest_bit(~zeros | 0x10000u);
+        }
+#endif
+
+        /// Writes value, at most 10^16 - 1, without leading zeros.
+        inline char *format_sixteen(char *out, std::uint64_t value) {
+#if defined(CROSSCODE_SIMPLE_INSTRUMENTS_FORMAT_SSE2)
+            // Copies 16 bytes whatever the number of digits, so the buffer is larger than 16.
+            char digits[32] = {};
+            auto high = eight_digits(static_cast<std::uint32_t>(value / 100000000));
+            auto low = eight_digits(static_cast<std::uint32_t>(value % 100000000));
+            auto zeros = sixteen_digits(digits, high, low);
+            if (zeros == 16) zeros = 15;
+            std::memcpy(out, digits + zeros, 16);
+            return out + 16 - zeros;
+#else
+            char digits[16];
+            auto end = digits + 16;
+            auto p = end;
+            while (value >= 100) {
+                p -= 2;
+                std::memcpy(p, digit_pairs + value % 100 * 2, 2);
+                value /= 100;
+            }
+            if (value >= 10) {
+                p -= 2;
+                std::memcpy(p, digit_pairs + value * 2, 2);
+            } else {
+                *--p = static_cast<char>('0' + value);
+            }
+            auto size = static_cast<std::size_t>(end - p);
+            std::memcpy(out, p, size);
+            return out + size;
+#endif
+        }
+
+        /// Writes exactly 16 digits of value, at most 10^16 - 1, with leading zeros.
+        inline char *format_sixteen_padded(char *out, std::uint64_t value) {
+#if defined(CROSSCODE_SIMPLE_INSTRUMENTS_FORMAT_SSE2)
+            sixteen_digits(out, eight_digits(static_cast<std::uint32_t>(value / 100000000)),
+                           eight_digits(static_cast<std::uint32_t>(value % 100000000)));
+#else
+            for (int i = 14; i >= 0; i -= 2) {
+                std::memcpy(out + i, digit_pairs + value % 100 * 2, 2);
+                value /= 100;
+            }
+#endif
+            return out + 16;
+        }
+
+        /// Whether std::to_chars writes value, a whole number below 2^53, in fixed notation: it picks the shorter of
+        /// fixed and scientific notation, and fixed when they are equally long.
+        inline bool fixed_is_shortest(std::uint64_t value) {
+            if (value == 0) return true;
+            unsigned digits = 1;
+            for (auto v = value; v >= 10; v /= 10) ++digits;
+            unsigned trailing_zeros = 0;
+            for (auto v = value; v % 10 == 0; v /= 10) ++trailing_zeros;
+            auto significant = digits - trailing_zeros;
+            // d.ddde+XX, or de+XX with one significant digit; exponents of whole numbers below 2^53 have 2 digits.
+            auto scientific = significant + (significant > 1 ? 1u : 0u) + 4;
+            return digits <= scientific;
+        }
+
+        inline char *format_unsigned(char *out, std::uint64_t value) {
+            if (value < 10000) return format_small(out, static_cast<std::uint32_t>(value));
+            if (value < 10000000000000000ull) return format_sixteen(out, value);
+            out = format_small(out, static_cast<std::uint32_t>(value / 10000000000000000ull));
+            return format_sixteen_padded(out, value % 10000000000000000ull);
+        }
+    }
+
+    /// Writes value in decimal to out, which must have room for max_number_chars, and returns the end. Writes the
+    /// same as std::to_chars: 16 digits are converted at once with SSE2 where available.
+    template <typename Tinteger, std::enable_if_t<std::is_integral_v<Tinteger> && !std::is_same_v<Tinteger, bool>,
+            int> = 0>
+    char *format_number(char *out, Tinteger value) {
+        if constexpr (std::is_signed_v<Tinteger>) {
+            auto magnitude = static_cast<std::uint64_t>(static_cast<std::int64_t>(value));
+            if (value < 0) {
+                *out++ = '-';
+                magnitude = 0 - magnitude;
+            }
+            return detail::format_unsigned(out, magnitude);
+        } else {
+            return detail::format_unsigned(out, value);
+        }
+    }
+
+    /// Writes the shortest text that reads back as exactly value, the same as std::to_chars. Whole numbers, common
+    /// for counters and sums, are written with the integer path.
+    template <typename Tfloat, std::enable_if_t<std::is_floating_point_v<Tfloat>, int> = 0>
+    char *format_number(char *out, Tfloat value) {
+        constexpr auto exact_limit = static_cast<Tfloat>(std::uint64_t{1} << std::numeric_limits<Tfloat>::digits);
+        auto magnitude = std::fabs(value);
+        if (magnitude < exact_limit && magnitude == std::floor(magnitude)) {
+            auto whole = static_cast<std::uint64_t>(magnitude);
+            if (detail::fixed_is_shortest(whole)) {
+                if (std::signbit(value)) *out++ = '-';
+                return detail::format_unsigned(out, whole);
+            }
+        }
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+        return std::to_chars(out, out + max_number_chars, value).ptr;
+#else
+        // Without shortest std::to_chars: the fewest significant digits that read back as value.
+        for (int precision = std::numeric_limits<Tfloat>::digits10; ; ++precision) {
+            auto size = std::snprintf(out, max_number_chars, "%.*g", precision, static_cast<double>(value));
+            if (precision >= std::numeric_limits<Tfloat>::max_digits10 ||
+                static_cast<Tfloat>(std::strtod(out, nullptr)) == value) {
+                return out + size;
+            }
+        }
+#endif
+    }
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_NUMBER_FORMAT_H
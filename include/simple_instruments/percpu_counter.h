@@ -0,0 +1,164 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_PERCPU_COUNTER_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_PERCPU_COUNTER_H
+#include "../simple_instruments.h"
+#include "detail/thread_index.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <sched.h>
+#include <sys/sysinfo.h>
+#if defined(__x86_64__) && defined(__GNUC__) && __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#if defined(RSEQ_SIG)
+#define CROSSCODE_SIMPLE_INSTRUMENTS_RSEQ
+#endif
+#endif
+
+namespace crosscode::simple_instruments {
+
+    namespace detail {
+#if defined(CROSSCODE_SIMPLE_INSTRUMENTS_RSEQ)
+        /// The rseq area glibc registered for the calling thread, or nullptr when it did not register one.
+        inline struct rseq *current_rseq() {
+            if (__rseq_size == 0) return nullptr;
+            auto thread_pointer = static_cast<char *>(__builtin_thread_pointer());
+            auto area = reinterpret_cast<struct rseq *>(thread_pointer + __rseq_offset);
+            if (static_cast<std::int32_t>(area->cpu_id) < 0) return nullptr;
+            return area;
+        }
+
+        /// Adds amount to slots[cpu * stride] of the CPU the thread runs on, in a restartable sequence: the kernel
+        /// restarts it at abort when the thread is preempted, migrated or signalled before the add committed, so a
+        /// plain add instruction is enough. Returns false when the thread has no rseq area.
+        inline bool rseq_add(std::int64_t *slots, std::size_t stride, std::size_t cpus, std::int64_t amount) {
+            auto area = current_rseq();
+            if (area == nullptr) return false;
+            for (;;) {
+                auto cpu = __atomic_load_n(&area->cpu_id_start, __ATOMIC_RELAXED);
+                auto slot = slots + (cpu % cpus) * stride;
+                __asm__ __volatile__ goto(
+                        ".pushsection __rseq_cs, \"aw\"\n\t"
+                        ".balign 32\n\t"
+                        "3:\n\t"
+                        ".long 0x0, 0x0\n\t"
+                        ".quad 1f, (2f - 1f), 4f\n\t"
+                        ".popsection\n\t"
+                        ".pushsection __rseq_cs_ptr_array, \"aw\"\n\t"
+                        ".quad 3b\n\t"
+                        ".popsection\n\t"
+                        "leaq 3b(%%rip), %%rax\n\t"
+                        "movq %%rax, %[rseq_cs]\n\t"
+                        "1:\n\t"
+                        "cmpl %[cpu], %[current_cpu]\n\t"
+                        "jnz 4f\n\t"
+                        "addq %[amount], %[slot]\n\t"
+                        "2:\n\t"
+                        ".pushsection __rseq_failure, \"ax\"\n\t"
+                        // The signature the kernel checks before the abort address, encoded as an ud1 instruction.
+                        ".byte 0x0f, 0xb9, 0x3d\n\t"
+                        ".long 0x53053053\n\t"
+                        "4:\n\t"
+                        "jmp %l[abort]\n\t"
+                        ".popsection\n\t"
+                        :
+                        : [cpu] "r"(cpu), [current_cpu] "m"(area->cpu_id), [rseq_cs] "m"(area->rseq_cs),
+                          [slot] "m"(*slot), [amount] "er"(amount)
+                        : "memory", "cc", "rax"
+                        : abort);
+                return true;
+            abort:
+                continue;
+            }
+        }
+#endif
+    }
+
+    /// A counter with the semantics of atomic_bidirectional_counter, for counters that many threads update all the
+    /// time, kept in one slot per CPU instead of one per thread: memory does not grow with the number of threads, and
+    /// threads on different CPUs never write the same cache line. Linux only.
+    ///
+    /// On x86-64 with a glibc that registers restartable sequences (2.35 and later), add() is a plain add to the slot
+    /// of the current CPU inside an rseq critical section, which the kernel restarts if the thread is moved. Without
+    /// rseq, threads add atomically to a second set of slots, selected with sched_getcpu(). The value is only summed
+    /// from the slots by value() and collect(), so, like the interval instruments, this counter is sent to the
+    /// exporter by collect() instead of on every change.
+    template <typename Texporter>
+    class atomic_percpu_counter {
+    public:
+        using value_type = std::int64_t;
+        using exporter_type = Texporter;
+    private:
+        static constexpr std::size_t stride = detail::cache_line_size / sizeof(std::int64_t);
+
+        struct alignas(detail::cache_line_size) slot {
+            std::atomic<std::int64_t> value{0};
+        };
+
+        data_block<value_type, exporter_type> data_;
+        value_type initial_;
+        std::size_t cpus_;
+        std::unique_ptr<slot[]> rseq_slots_;
+        std::unique_ptr<slot[]> atomic_slots_;
+
+        static std::size_t current_cpu() {
+            auto cpu = sched_getcpu();
+            return cpu < 0 ? detail::thread_index() : static_cast<std::size_t>(cpu);
+        }
+
+    public:
+        atomic_percpu_counter(std::shared_ptr<exporter_type> exporter, typename exporter_type::metadata_type metadata,
+                              value_type value = 0)
+                : data_{std::move(exporter), std::move(metadata), value}, initial_{value},
+                  cpus_{static_cast<std::size_t>(get_nprocs_conf() > 0 ? get_nprocs_conf() : 1)},
+                  rseq_slots_{new slot[cpus_]}, atomic_slots_{new slot[cpus_]} {
+            data_.emit_init(value);
+        }
+
+        void add(value_type amount = 1) {
+#if defined(CROSSCODE_SIMPLE_INSTRUMENTS_RSEQ)
+            static_assert(sizeof(slot) == stride * sizeof(std::int64_t), "slots are addressed by stride");
+            if (detail::rseq_add(reinterpret_cast<std::int64_t *>(rseq_slots_.get()), stride, cpus_, amount)) return;
+#endif
+            atomic_slots_[current_cpu() % cpus_].value.fetch_add(amount, std::memory_order_relaxed);
+        }
+
+        void sub(value_type amount = 1) {
+            add(-amount);
+        }
+
+        /// The sum of all slots. Adds that run concurrently may or may not be included.
+        value_type value() const {
+            auto sum = initial_;
+            for (std::size_t cpu = 0; cpu < cpus_; ++cpu) {
+                sum += rseq_slots_[cpu].value.load(std::memory_order_relaxed);
+                sum += atomic_slots_[cpu].value.load(std::memory_order_relaxed);
+            }
+            return sum;
+        }
+
+        /// Sends the current value, when it changed since the previous call. Call it from one thread at a time, for
+        /// example from a collector.
+        value_type collect() {
+            auto current = value();
+            if (current != data_.value_) {
+                data_.value_ = current;
+                data_.emit(current);
+            }
+            return current;
+        }
+
+        /// Whether add() uses restartable sequences on the calling thread.
+        static bool uses_rseq() {
+#if defined(CROSSCODE_SIMPLE_INSTRUMENTS_RSEQ)
+            return detail::current_rseq() != nullptr;
+#else
+            return false;
+#endif
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_PERCPU_COUNTER_H
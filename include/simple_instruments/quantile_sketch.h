@@ -0,0 +1,317 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_QUANTILE_SKETCH_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_QUANTILE_SKETCH_H
+#include "../simple_instruments.h"
+#include "detail/thread_index.h"
+#include "epoch.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace crosscode::simple_instruments {
+
+    /// A DDSketch: a histogram with logarithmically sized buckets, so every quantile it returns is within
+    /// relative_accuracy of the exact quantile. Values between min_value and max_value get their own buckets; smaller
+    /// positive values are counted in the lowest bucket and larger values in the highest. Zero and negative values are
+    /// counted as zero. Sketches with the same parameters can be merged.
+    class quantile_sketch {
+        double relative_accuracy_;
+        double gamma_;
+        double log_gamma_;
+        int min_index_;
+        std::vector<std::uint64_t> counts_;
+        std::uint64_t zero_count_{0};
+        std::uint64_t count_{0};
+        double sum_{0};
+        double min_{std::numeric_limits<double>::infinity()};
+        double max_{-std::numeric_limits<double>::infinity()};
+
+        int raw_index(double value) const {
+            return static_cast<int>(std::ceil(std::log(value) / log_gamma_));
+        }
+
+    public:
+        explicit quantile_sketch(double relative_accuracy = 0.01, double min_value = 1e-9, double max_value = 1e9)
+                : relative_accuracy_{relative_accuracy},
+                  gamma_{(1 + relative_accuracy) / (1 - relative_accuracy)},
+                  log_gamma_{std::log(gamma_)} {
+            if (!(relative_accuracy > 0 && relative_accuracy < 1)) {
+                throw std::invalid_argument("relative_accuracy must be between 0 and 1");
+            }
+            if (!(min_value > 0 && max_value > min_value)) {
+                throw std::invalid_argument("min_value must be positive and smaller than max_value");
+            }
+            min_index_ = raw_index(min_value);
+            counts_.resize(static_cast<std::size_t>(raw_index(max_value) - min_index_ + 1));
+        }
+
+        /// The bucket value falls in, for a positive value.
+        std::size_t bucket(double value) const {
+            auto index = raw_index(value) - min_index_;
+            if (index < 0) return 0;
+            return std::min(static_cast<std::size_t>(index), counts_.size() - 1);
+        }
+
+        /// The value all values in a bucket are represented by, within relative_accuracy of each of them.
+        double bucket_value(std::size_t bucket) const {
+            return 2 * std::pow(gamma_, static_cast<double>(static_cast<int>(bucket) + min_index_)) / (gamma_ + 1);
+        }
+
+        std::size_t buckets() const {
+            return counts_.size();
+        }
+
+        void add(double value, std::uint64_t count = 1) {
+            if (value > 0) {
+                counts_[bucket(value)] += count;
+            } else {
+                zero_count_ += count;
+            }
+            count_ += count;
+            sum_ += value * static_cast<double>(count);
+            min_ = std::min(min_, value);
+            max_ = std::max(max_, value);
+        }
+
+        /// Adds count values that fell in bucket. Together with add_zero and add_summary used to merge shards.
+        void add_bucket(std::size_t bucket, std::uint64_t count) {
+            counts_[bucket] += count;
+            count_ += count;
+        }
+
+        void add_zero(std::uint64_t count) {
+            zero_count_ += count;
+            count_ += count;
+        }
+
+        void add_summary(double sum, double min, double max) {
+            sum_ += sum;
+            min_ = std::min(min_, min);
+            max_ = std::max(max_, max);
+        }
+
+        bool mergeable(const quantile_sketch &other) const {
+            return gamma_ == other.gamma_ && min_index_ == other.min_index_ && counts_.size() == other.counts_.size();
+        }
+
+        void merge(const quantile_sketch &other) {
+            if (!mergeable(other)) throw std::invalid_argument("sketches with different parameters can not be merged");
+            for (std::size_t i = 0; i < counts_.size(); ++i) counts_[i] += other.counts_[i];
+            zero_count_ += other.zero_count_;
+            count_ += other.count_;
+            add_summary(other.sum_, other.min_, other.max_);
+        }
+
+        /// The value at quantile q, between 0 and 1. Zero when the sketch is empty. Kept between min() and max() when
+        /// the summary was added; a sketch built from buckets only returns the bucket values.
+        double quantile(double q) const {
+            if (count_ == 0) return 0;
+            auto rank = static_cast<std::uint64_t>(std::clamp(q, 0.0, 1.0) * static_cast<double>(count_ - 1));
+            auto summarized = min_ <= max_;
+            if (rank < zero_count_) return summarized ? std::min(0.0, max_) : 0.0;
+            auto seen = zero_count_;
+            for (std::size_t i = 0; i < counts_.size(); ++i) {
+                seen += counts_[i];
+                if (seen > rank) return summarized ? std::clamp(bucket_value(i), min_, max_) : bucket_value(i);
+            }
+            return summarized ? max_ : 0.0;
+        }
+
+        void clear() {
+            std::fill(counts_.begin(), counts_.end(), 0);
+            zero_count_ = 0;
+            count_ = 0;
+            sum_ = 0;
+            min_ = std::numeric_limits<double>::infinity();
+            max_ = -std::numeric_limits<double>::infinity();
+        }
+
+        /// The number of values in bucket.
+        std::uint64_t bucket_count(std::size_t bucket) const {
+            return counts_[bucket];
+        }
+
+        /// The number of values that were zero or negative.
+        std::uint64_t zero_count() const {
+            return zero_count_;
+        }
+
+        /// Calls f(bucket_value, count) for every bucket that has values, from low to high; zero first.
+        template <typename F>
+        void for_each_bucket(F &&f) const {
+            if (zero_count_ != 0) f(0.0, zero_count_);
+            for (std::size_t i = 0; i < counts_.size(); ++i) {
+                if (counts_[i] != 0) f(bucket_value(i), counts_[i]);
+            }
+        }
+
+        double relative_accuracy() const {
+            return relative_accuracy_;
+        }
+
+        std::uint64_t count() const {
+            return count_;
+        }
+
+        double sum() const {
+            return sum_;
+        }
+
+        double min() const {
+            return min_;
+        }
+
+        double max() const {
+            return max_;
+        }
+    };
+
+    /// A value recorder that keeps a quantile_sketch of the values recorded since the last call of collect(), for
+    /// quantiles like p99 with a bounded relative error. collect() sends the merged sketch to the exporter as a
+    /// const quantile_sketch&; intervals without values are not sent.
+    ///
+    /// Threads record into their own shard of the sketch, created on first use and spread over the shards in order
+    /// of first use, so up to 16 threads never share the cache lines they write to. collect() merges the shards.
+    /// The shards come in two banks, chosen by the parity of an epoch_domain epoch that record() pins, like the banks
+    /// of atomic_aggregate_recorder, so a value is never counted in one interval and its sum or extremes in another.
+    template <typename Tvalue, typename Texporter>
+    class atomic_quantile_recorder {
+        static_assert(std::is_arithmetic_v<Tvalue> && !std::is_same_v<Tvalue, bool>, "Tvalue must be a number");
+    public:
+        using value_type = Tvalue;
+        using exporter_type = Texporter;
+    private:
+        static constexpr std::size_t shards = 16;
+
+        struct alignas(detail::cache_line_size) shard {
+            std::unique_ptr<std::atomic<std::uint64_t>[]> counts;
+            std::atomic<std::uint64_t> zero{0};
+            std::atomic<double> sum{0};
+            std::atomic<double> min{std::numeric_limits<double>::infinity()};
+            std::atomic<double> max{-std::numeric_limits<double>::infinity()};
+
+            explicit shard(std::size_t buckets) : counts{new std::atomic<std::uint64_t>[buckets]} {
+                for (std::size_t i = 0; i < buckets; ++i) counts[i].store(0, std::memory_order_relaxed);
+            }
+        };
+
+        data_block<quantile_sketch, exporter_type> data_;
+        epoch_domain epochs_;
+        std::array<std::array<std::atomic<shard *>, shards>, 2> banks_{};
+        std::mutex collect_mutex_;
+
+        shard &local(std::uint64_t epoch) {
+            auto &slot = banks_[epoch & 1u][detail::thread_index() % shards];
+            auto s = slot.load(std::memory_order_acquire);
+            if (s != nullptr) return *s;
+            auto created = new shard{data_.value_.buckets()};
+            if (slot.compare_exchange_strong(s, created, std::memory_order_acq_rel)) return *created;
+            delete created;
+            return *s;
+        }
+
+        static void add(std::atomic<double> &target, double value) {
+            auto current = target.load(std::memory_order_relaxed);
+            while (!target.compare_exchange_weak(current, current + value, std::memory_order_relaxed)) {}
+        }
+
+    public:
+        atomic_quantile_recorder(std::shared_ptr<exporter_type> exporter,
+                                 typename exporter_type::metadata_type metadata, double relative_accuracy = 0.01,
+                                 double min_value = 1e-9, double max_value = 1e9)
+                : data_{std::move(exporter), std::move(metadata),
+                        quantile_sketch{relative_accuracy, min_value, max_value}} {
+            data_.emit_init(data_.value_);
+        }
+
+        atomic_quantile_recorder(const atomic_quantile_recorder &) = delete;
+        atomic_quantile_recorder &operator=(const atomic_quantile_recorder &) = delete;
+
+        ~atomic_quantile_recorder() {
+            for (auto &bank : banks_) {
+                for (auto &slot : bank) delete slot.load(std::memory_order_relaxed);
+            }
+        }
+
+        void record(value_type value) {
+            epoch_domain::guard guard{epochs_};
+            auto &s = local(guard.epoch());
+            auto v = static_cast<double>(value);
+            if (v > 0) {
+                s.counts[data_.value_.bucket(v)].fetch_add(1, std::memory_order_relaxed);
+            } else {
+                s.zero.fetch_add(1, std::memory_order_relaxed);
+            }
+            add(s.sum, v);
+            auto min = s.min.load(std::memory_order_relaxed);
+            while (v < min && !s.min.compare_exchange_weak(min, v, std::memory_order_relaxed)) {}
+            auto max = s.max.load(std::memory_order_relaxed);
+            while (v > max && !s.max.compare_exchange_weak(max, v, std::memory_order_relaxed)) {}
+        }
+
+        /// Adds the values of a sketch that was recorded elsewhere, with the same parameters, to the interval.
+        void merge(const quantile_sketch &sketch) {
+            if (!data_.value_.mergeable(sketch)) {
+                throw std::invalid_argument("sketches with different parameters can not be merged");
+            }
+            if (sketch.count() == 0) return;
+            epoch_domain::guard guard{epochs_};
+            auto &s = local(guard.epoch());
+            for (std::size_t i = 0; i < sketch.buckets(); ++i) {
+                auto count = sketch.bucket_count(i);
+                if (count != 0) s.counts[i].fetch_add(count, std::memory_order_relaxed);
+            }
+            s.zero.fetch_add(sketch.zero_count(), std::memory_order_relaxed);
+            add(s.sum, sketch.sum());
+            auto min = s.min.load(std::memory_order_relaxed);
+            while (sketch.min() < min && !s.min.compare_exchange_weak(min, sketch.min(), std::memory_order_relaxed)) {}
+            auto max = s.max.load(std::memory_order_relaxed);
+            while (sketch.max() > max && !s.max.compare_exchange_weak(max, sketch.max(), std::memory_order_relaxed)) {}
+        }
+
+        /// Ends the interval: merges the shards into one sketch of the values recorded since the previous call, sends
+        /// it and returns it. Waits for the records that are running when it is called. Only use the returned sketch
+        /// from the thread that calls collect().
+        const quantile_sketch &collect() {
+            std::lock_guard lock{collect_mutex_};
+            auto previous = epochs_.epoch();
+            while (!epochs_.try_advance()) std::this_thread::yield();
+            while (!epochs_.previous_drained()) std::this_thread::yield();
+            auto &sketch = data_.value_;
+            sketch.clear();
+            for (auto &slot : banks_[previous & 1u]) {
+                auto s = slot.load(std::memory_order_acquire);
+                if (s == nullptr) continue;
+                for (std::size_t i = 0; i < sketch.buckets(); ++i) {
+                    if (s->counts[i].load(std::memory_order_relaxed) == 0) continue;
+                    sketch.add_bucket(i, s->counts[i].exchange(0, std::memory_order_relaxed));
+                }
+                sketch.add_zero(s->zero.exchange(0, std::memory_order_relaxed));
+                sketch.add_summary(s->sum.exchange(0, std::memory_order_relaxed),
+                                   s->min.exchange(std::numeric_limits<double>::infinity(), std::memory_order_relaxed),
+                                   s->max.exchange(-std::numeric_limits<double>::infinity(),
+                                                   std::memory_order_relaxed));
+            }
+            if (sketch.count() != 0) data_.emit(sketch);
+            return sketch;
+        }
+
+        /// The sketch of the last collect(). Only use it from the thread that calls collect().
+        const quantile_sketch &last() const {
+            return data_.value_;
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_QUANTILE_SKETCH_H
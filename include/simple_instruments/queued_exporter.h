@@ -0,0 +1,284 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_QUEUED_EXPORTER_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_QUEUED_EXPORTER_H
+#include "../simple_instruments.h"
+#include "encoded_value.h"
+#include "exporter_statistics.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+namespace crosscode::simple_instruments {
+
+    /// Exporter that queues everything and delivers it to Texporter on its own thread, so a slow exporter never stalls
+    /// the instrumented threads. When capacity values are queued new values are dropped and counted in dropped().
+    /// Creation and destruction of instruments are never dropped, so the exporter always sees them in order.
+    ///
+    /// Changes of counters are queued as changes when Texporter applies them, see detail::emit_add. A dropped change
+    /// is added to the next change of the same instrument that is queued, so such an exporter still ends up with the
+    /// counter value; the amount it receives is then the net change, which for unsigned counters can wrap.
+    template <typename Texporter>
+    class queued_exporter {
+    public:
+        using metadata_type = typename Texporter::metadata_type;
+        using exporter_type = Texporter;
+    private:
+        struct series {
+            metadata_type metadata;
+            exporter_handle_t<exporter_type> handle{};
+            /// Net change of the dropped changes, encoded like the counter value.
+            std::atomic<std::uint64_t> dropped_change{0};
+        };
+    public:
+        using handle_type = series *;
+    private:
+        static constexpr std::size_t inline_value_size = 32;
+
+        struct record {
+            void (*deliver)(exporter_type &, record &);
+            series *target;
+            alignas(std::max_align_t) unsigned char value[inline_value_size];
+        };
+
+        template <typename Tvalue>
+        struct change {
+            Tvalue amount;
+            Tvalue value;
+            bool subtract;
+        };
+
+        template <typename Tvalue>
+        static constexpr bool queues_changes = std::is_arithmetic_v<Tvalue> &&
+                                               detail::exporter_has_emit_change<exporter_type, Tvalue>::value;
+
+        template <typename Tvalue>
+        static constexpr bool stored_inline = std::is_trivially_copyable_v<Tvalue> &&
+                                              sizeof(Tvalue) <= inline_value_size &&
+                                              alignof(Tvalue) <= alignof(std::max_align_t);
+
+        template <typename Tvalue>
+        static void store(record &r, const Tvalue &value) {
+            if constexpr (stored_inline<Tvalue>) {
+                std::memcpy(r.value, &value, sizeof(Tvalue));
+            } else {
+                auto copy = new Tvalue(value);
+                std::memcpy(r.value, &copy, sizeof(copy));
+            }
+        }
+
+        template <typename Tvalue, typename F>
+        static void with_value(record &r, F &&f) {
+            if constexpr (stored_inline<Tvalue>) {
+                f(*std::launder(reinterpret_cast<const Tvalue *>(r.value)));
+            } else {
+                Tvalue *copy;
+                std::memcpy(&copy, r.value, sizeof(copy));
+                f(*copy);
+                delete copy;
+            }
+        }
+
+        template <typename Tvalue>
+        static void discard(record &r) {
+            with_value<Tvalue>(r, [](const Tvalue &) {});
+        }
+
+        template <typename Tvalue>
+        static void deliver_init(exporter_type &exporter, record &r) {
+            with_value<Tvalue>(r, [&](const Tvalue &value) {
+                r.target->handle = detail::emit_init(exporter, value, r.target->metadata);
+            });
+        }
+
+        template <typename Tvalue>
+        static void deliver_emit(exporter_type &exporter, record &r) {
+            with_value<Tvalue>(r, [&](const Tvalue &value) {
+                detail::emit(exporter, value, r.target->metadata, r.target->handle);
+            });
+        }
+
+        template <typename Tvalue>
+        static void deliver_change(exporter_type &exporter, record &r) {
+            with_value<change<Tvalue>>(r, [&](const change<Tvalue> &c) {
+                auto &target = *r.target;
+                auto dropped = target.dropped_change.exchange(0, std::memory_order_relaxed);
+                if (dropped == 0) {
+                    if (c.subtract) {
+                        detail::emit_sub(exporter, c.amount, c.value, target.metadata, target.handle);
+                    } else {
+                        detail::emit_add(exporter, c.amount, c.value, target.metadata, target.handle);
+                    }
+                    return;
+                }
+                std::atomic<std::uint64_t> net{dropped};
+                detail::add_encoded(net, c.amount, c.subtract);
+                detail::emit_add(exporter, detail::decode_value<Tvalue>(net.load(std::memory_order_relaxed)), c.value,
+                                 target.metadata, target.handle);
+            });
+        }
+
+        template <typename Tvalue>
+        static void drop_change(record &r) {
+            with_value<change<Tvalue>>(r, [&](const change<Tvalue> &c) {
+                detail::add_encoded(r.target->dropped_change, c.amount, c.subtract);
+            });
+        }
+
+        static void deliver_release(exporter_type &exporter, record &r) {
+            detail::release(exporter, r.target->handle, r.target->metadata);
+            delete r.target;
+        }
+
+        std::size_t capacity_;
+        std::mutex mutex_;
+        std::condition_variable work_;
+        std::condition_variable idle_;
+        std::deque<record> queue_;
+        bool busy_{false};
+        bool stop_{false};
+        std::shared_ptr<exporter_statistics> statistics_{std::make_shared<exporter_statistics>()};
+        exporter_type exporter_;
+        std::thread worker_;
+
+        void push(record &&r, bool droppable, void (*on_drop)(record &) = nullptr) {
+            {
+                std::unique_lock lock{mutex_};
+                if (droppable && queue_.size() >= capacity_) {
+                    statistics_->add_dropped();
+                    lock.unlock();
+                    if (on_drop) on_drop(r);
+                    return;
+                }
+                queue_.push_back(std::move(r));
+                statistics_->set_queue_depth(static_cast<std::int64_t>(queue_.size()));
+            }
+            work_.notify_one();
+        }
+
+        template <typename Tvalue>
+        void push_value(void (*deliver)(exporter_type &, record &), series *target, const Tvalue &value,
+                        bool droppable) {
+            record r{deliver, target, {}};
+            store(r, value);
+            if constexpr (stored_inline<Tvalue>) {
+                push(std::move(r), droppable);
+            } else {
+                push(std::move(r), droppable, &discard<Tvalue>);
+            }
+        }
+
+        template <typename Tvalue>
+        void push_change(const Tvalue &amount, const Tvalue &value, bool subtract, const metadata_type &md,
+                         series *target) {
+            if constexpr (queues_changes<Tvalue>) {
+                record r{&deliver_change<Tvalue>, target, {}};
+                store(r, change<Tvalue>{amount, value, subtract});
+                push(std::move(r), true, &drop_change<Tvalue>);
+            } else {
+                emit(value, md, target);
+            }
+        }
+
+        void run() {
+            std::deque<record> batch;
+            std::unique_lock lock{mutex_};
+            for (;;) {
+                work_.wait(lock, [this] { return !queue_.empty() || stop_; });
+                if (queue_.empty()) return;
+                batch.swap(queue_);
+                statistics_->set_queue_depth(0);
+                busy_ = true;
+                lock.unlock();
+                auto start = std::chrono::steady_clock::now();
+                for (auto &r : batch) r.deliver(exporter_, r);
+                statistics_->add_batch(batch.size(), 0, std::chrono::steady_clock::now() - start);
+                batch.clear();
+                lock.lock();
+                busy_ = false;
+                idle_.notify_all();
+            }
+        }
+
+    public:
+        template <typename ...Args>
+        explicit queued_exporter(std::size_t capacity, Args &&...args)
+                : capacity_{capacity}, exporter_{std::forward<Args>(args)...}, worker_{[this] { run(); }} {}
+
+        queued_exporter(const queued_exporter &) = delete;
+        queued_exporter &operator=(const queued_exporter &) = delete;
+
+        /// Delivers everything still queued before returning.
+        ~queued_exporter() {
+            {
+                std::lock_guard lock{mutex_};
+                stop_ = true;
+            }
+            work_.notify_one();
+            worker_.join();
+        }
+
+        template <typename Tvalue>
+        handle_type emit_init(const Tvalue &value, const metadata_type &md) {
+            auto target = new series{md};
+            push_value(&deliver_init<Tvalue>, target, value, false);
+            return target;
+        }
+
+        template <typename Tvalue>
+        void emit(const Tvalue &value, const metadata_type &, const handle_type &target) {
+            push_value(&deliver_emit<Tvalue>, target, value, true);
+        }
+
+        template <typename Tvalue>
+        void emit_add(const Tvalue &amount, const Tvalue &value, const metadata_type &md, const handle_type &target) {
+            push_change(amount, value, false, md, target);
+        }
+
+        template <typename Tvalue>
+        void emit_sub(const Tvalue &amount, const Tvalue &value, const metadata_type &md, const handle_type &target) {
+            push_change(amount, value, true, md, target);
+        }
+
+        void release(const handle_type &target, const metadata_type &) {
+            if (target) push(record{&deliver_release, target, {}}, false);
+        }
+
+        /// Waits until everything queued so far is delivered.
+        void drain() {
+            std::unique_lock lock{mutex_};
+            idle_.wait(lock, [this] { return queue_.empty() && !busy_; });
+        }
+
+        std::size_t queue_depth() {
+            std::lock_guard lock{mutex_};
+            return queue_.size();
+        }
+
+        std::uint64_t dropped() const {
+            return statistics_->dropped();
+        }
+
+        /// Queued records, dropped values, and the size and delivery time of the batches the delivery thread took
+        /// from the queue; publish them with self_metrics.
+        const std::shared_ptr<exporter_statistics> &statistics() const {
+            return statistics_;
+        }
+
+        /// The queued exporter. Only access it when it is safe to do so concurrently with the delivery thread.
+        exporter_type &exporter() {
+            return exporter_;
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_QUEUED_EXPORTER_H
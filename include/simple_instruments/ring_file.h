@@ -0,0 +1,277 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_RING_FILE_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_RING_FILE_H
+#include "encoded_value.h"
+#include "detail/mapped_region.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+namespace crosscode::simple_instruments {
+
+    /// Header at the start of a ring file. The file layout is:
+    /// [ring_file_header][padding up to records_offset][capacity * ring_file_record]
+    struct ring_file_header {
+        static constexpr std::uint64_t magic_value = 0x31474e4952495343; // "CSIRING1"
+        static constexpr std::uint32_t version_value = 1;
+        std::atomic<std::uint64_t> magic;
+        std::uint32_t version;
+        std::uint32_t record_size;
+        std::uint64_t records_offset;
+        std::uint64_t capacity;
+        alignas(64) std::atomic<std::uint64_t> tail;
+    };
+
+    /// A single record. sequence is 0 while the record is being written and sequence number + 1 when committed.
+    struct ring_file_record {
+        static constexpr std::size_t max_name_size = 102;
+        std::atomic<std::uint64_t> sequence;
+        std::int64_t timestamp;
+        std::uint64_t value;
+        std::uint8_t kind;
+        std::uint8_t name_size;
+        char name[max_name_size];
+    };
+
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "ring files require lock free 64 bit atomics");
+    static_assert(sizeof(ring_file_record) == 128, "ring_file_record must be 128 bytes");
+
+    /// A record copied out of a ring file.
+    struct ring_file_entry {
+        std::uint64_t sequence{0};
+        std::int64_t timestamp{0};
+        encoded_value value;
+        std::string name;
+    };
+
+    enum class ring_file_read_status {
+        ok,
+        pending,
+        overwritten
+    };
+
+    /// Memory mapped circular file of fixed size records. Appending is a reservation with a single atomic add followed
+    /// by a copy into the mapping, so no system calls are made while recording. Because the mapping is shared with the
+    /// file the data survives a crash of the writing process, and other processes can read the file concurrently.
+    class ring_file {
+        static constexpr std::uint64_t records_offset = 4096;
+        detail::mapped_region region_;
+        ring_file_header *header_{nullptr};
+        ring_file_record *records_{nullptr};
+
+        explicit ring_file(detail::mapped_region region) : region_{std::move(region)} {
+            auto base = static_cast<char *>(region_.data());
+            header_ = reinterpret_cast<ring_file_header *>(base);
+            records_ = reinterpret_cast<ring_file_record *>(base + header_->records_offset);
+        }
+
+        static std::size_t file_size(std::uint64_t capacity) {
+            return records_offset + capacity * sizeof(ring_file_record);
+        }
+
+        static bool valid_header(const ring_file_header &header, std::size_t size) {
+            return header.magic.load(std::memory_order_acquire) == ring_file_header::magic_value &&
+                   header.version == ring_file_header::version_value &&
+                   header.record_size == sizeof(ring_file_record) &&
+                   header.records_offset >= sizeof(ring_file_header) &&
+                   header.capacity > 0 &&
+                   size >= header.records_offset + header.capacity * sizeof(ring_file_record);
+        }
+
+    public:
+        /// Opens path for writing. An existing ring file with the same capacity is resumed, otherwise the file is
+        /// (re)initialized. Throws std::invalid_argument when capacity is zero or the file would not fit in memory.
+        static ring_file create(const std::string &path, std::uint64_t capacity) {
+            if (capacity == 0) throw std::invalid_argument("capacity must be positive");
+            if (capacity > (std::numeric_limits<std::size_t>::max() - records_offset) / sizeof(ring_file_record)) {
+                throw std::invalid_argument("capacity is too large");
+            }
+            detail::file_descriptor fd{::open(path.c_str(), O_RDWR | O_CREAT, 0644)};
+            if (fd.get() < 0) detail::throw_errno("open " + path);
+            struct stat st{};
+            if (::fstat(fd.get(), &st) != 0) detail::throw_errno("fstat " + path);
+            auto size = file_size(capacity);
+            bool resume = static_cast<std::size_t>(st.st_size) == size;
+            if (!resume) {
+                if (::ftruncate(fd.get(), 0) != 0 || ::ftruncate(fd.get(), static_cast<off_t>(size)) != 0) {
+                    detail::throw_errno("ftruncate " + path);
+                }
+            }
+            detail::mapped_region region{fd.get(), size, true};
+            auto header = static_cast<ring_file_header *>(region.data());
+            if (!resume || !valid_header(*header, size) || header->capacity != capacity) {
+                std::memset(region.data(), 0, size);
+                header->version = ring_file_header::version_value;
+                header->record_size = sizeof(ring_file_record);
+                header->records_offset = records_offset;
+                header->capacity = capacity;
+                header->tail.store(0, std::memory_order_relaxed);
+                header->magic.store(ring_file_header::magic_value, std::memory_order_release);
+            }
+            return ring_file{std::move(region)};
+        }
+
+        /// Opens an existing ring file for reading.
+        static ring_file open_read_only(const std::string &path) {
+            detail::file_descriptor fd{::open(path.c_str(), O_RDONLY)};
+            if (fd.get() < 0) detail::throw_errno("open " + path);
+            struct stat st{};
+            if (::fstat(fd.get(), &st) != 0) detail::throw_errno("fstat " + path);
+            auto size = static_cast<std::size_t>(st.st_size);
+            if (size < records_offset) throw std::runtime_error(path + " is not a ring file");
+            detail::mapped_region region{fd.get(), size, false};
+            if (!valid_header(*static_cast<ring_file_header *>(region.data()), size)) {
+                throw std::runtime_error(path + " is not a ring file");
+            }
+            return ring_file{std::move(region)};
+        }
+
+        std::uint64_t capacity() const {
+            return header_->capacity;
+        }
+
+        /// Sequence number of the next record that will be appended.
+        std::uint64_t tail() const {
+            return header_->tail.load(std::memory_order_acquire);
+        }
+
+        /// Sequence number of the oldest record that can still be read.
+        std::uint64_t head() const {
+            auto t = tail();
+            return t > capacity() ? t - capacity() : 0;
+        }
+
+        void append(std::string_view name, encoded_value value, std::int64_t timestamp) noexcept {
+            auto sequence = header_->tail.fetch_add(1, std::memory_order_relaxed);
+            auto &record = records_[sequence % header_->capacity];
+            record.sequence.store(0, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            auto name_size = std::min(name.size(), ring_file_record::max_name_size);
+            record.timestamp = timestamp;
+            record.value = value.bits;
+            record.kind = static_cast<std::uint8_t>(value.kind);
+            record.name_size = static_cast<std::uint8_t>(name_size);
+            std::memcpy(record.name, name.data(), name_size);
+            record.sequence.store(sequence + 1, std::memory_order_release);
+        }
+
+        /// Copies the record with the given sequence number. Returns pending when the record is not committed yet and
+        /// overwritten when it has been (or is being) replaced by a newer record.
+        ring_file_read_status read(std::uint64_t sequence, ring_file_entry &entry) const {
+            const auto &record = records_[sequence % header_->capacity];
+            auto before = record.sequence.load(std::memory_order_acquire);
+            if (before != sequence + 1) {
+                return before > sequence + 1 ? ring_file_read_status::overwritten : ring_file_read_status::pending;
+            }
+            entry.sequence = sequence;
+            entry.timestamp = record.timestamp;
+            entry.value.bits = record.value;
+            entry.value.kind = static_cast<value_kind>(record.kind);
+            entry.name.assign(record.name, std::min<std::size_t>(record.name_size, ring_file_record::max_name_size));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (record.sequence.load(std::memory_order_relaxed) != before) {
+                return ring_file_read_status::overwritten;
+            }
+            return ring_file_read_status::ok;
+        }
+
+        /// Flushes the mapping to disk. Not needed for crash safety of the process, only for power loss.
+        void sync(bool wait = true) {
+            region_.sync(wait);
+        }
+    };
+
+    /// Reads the records of a ring_file in order, starting at its head. A record that is reserved but not committed,
+    /// for example because its writer crashed while appending it, is skipped once it has been pending for
+    /// pending_timeout, so it never hides the records after it. With a zero timeout, as when dumping a ring file once,
+    /// pending records are skipped immediately.
+    class ring_file_cursor {
+        const ring_file *ring_;
+        std::uint64_t position_;
+        std::chrono::steady_clock::duration pending_timeout_;
+        std::uint64_t pending_position_{static_cast<std::uint64_t>(-1)};
+        std::chrono::steady_clock::time_point pending_since_{};
+        ring_file_entry entry_;
+
+    public:
+        explicit ring_file_cursor(const ring_file &ring,
+                                  std::chrono::steady_clock::duration pending_timeout = std::chrono::seconds(1))
+                : ring_{&ring}, position_{ring.head()}, pending_timeout_{pending_timeout} {}
+
+        /// Calls on_entry(entry) for every committed record up to the tail, and on_skipped(sequence) for every pending
+        /// record that is skipped. Stops early at a record that has been pending for less than pending_timeout.
+        template <typename Fentry, typename Fskipped>
+        void poll(Fentry &&on_entry, Fskipped &&on_skipped) {
+            auto tail = ring_->tail();
+            if (tail - position_ > ring_->capacity()) position_ = tail - ring_->capacity();
+            while (position_ < tail) {
+                auto status = ring_->read(position_, entry_);
+                if (status == ring_file_read_status::pending) {
+                    if (pending_timeout_.count() > 0) {
+                        auto now = std::chrono::steady_clock::now();
+                        if (pending_position_ != position_) {
+                            pending_position_ = position_;
+                            pending_since_ = now;
+                        }
+                        if (now - pending_since_ < pending_timeout_) return;
+                    }
+                    on_skipped(position_);
+                } else if (status == ring_file_read_status::ok) {
+                    on_entry(static_cast<const ring_file_entry &>(entry_));
+                }
+                ++position_;
+            }
+        }
+
+        /// Sequence number of the next record to read.
+        std::uint64_t position() const {
+            return position_;
+        }
+    };
+
+    /// Exporter that appends every emitted value to a ring_file. The series name is obtained by calling
+    /// unique_identifier(metadata), which is found through argument dependent lookup, and truncated to
+    /// ring_file_record::max_name_size bytes.
+    template <typename Tmetadata>
+    class ring_file_exporter {
+    public:
+        using metadata_type = Tmetadata;
+    private:
+        ring_file ring_;
+
+        template <typename Tvalue>
+        void append(const Tvalue &value, const metadata_type &md) {
+            const auto &id = unique_identifier(md);
+            auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+            ring_.append(std::string_view{id}, encode_value(value), timestamp);
+        }
+
+    public:
+        ring_file_exporter(const std::string &path, std::uint64_t capacity) : ring_{ring_file::create(path, capacity)} {}
+
+        template <typename Tvalue>
+        void emit_init(const Tvalue &value, const metadata_type &md) {
+            append(value, md);
+        }
+
+        template <typename Tvalue>
+        void emit(const Tvalue &value, const metadata_type &md) {
+            append(value, md);
+        }
+
+        ring_file &ring() {
+            return ring_;
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_RING_FILE_H
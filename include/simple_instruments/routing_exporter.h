@@ -0,0 +1,145 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_ROUTING_EXPORTER_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_ROUTING_EXPORTER_H
+#include "../simple_instruments.h"
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace crosscode::simple_instruments {
+
+    /// Exporter that sends each instrument to one of Texporters. Trouter is called once per instrument, in
+    /// emit_init, with the metadata and returns the index of the exporter to use. The choice is kept in the handle of
+    /// the instrument, so emitting a value is a single indirect call through a table. An index that is out of range
+    /// discards the instrument.
+    template <typename Trouter, typename Texporter, typename ...Texporters>
+    class routing_exporter {
+    public:
+        using metadata_type = typename Texporter::metadata_type;
+        using router_type = Trouter;
+        static constexpr std::size_t size = 1 + sizeof...(Texporters);
+        static_assert((std::is_same_v<metadata_type, typename Texporters::metadata_type> && ...),
+                      "all exporters of a routing_exporter must have the same metadata_type");
+
+        struct route {
+            std::size_t index{size};
+            std::variant<exporter_handle_t<Texporter>, exporter_handle_t<Texporters>...> handle;
+        };
+
+        using handle_type = route;
+    private:
+        using exporters_type = std::tuple<std::shared_ptr<Texporter>, std::shared_ptr<Texporters>...>;
+
+        router_type router_;
+        exporters_type exporters_;
+
+        template <typename Tvalue, std::size_t I>
+        static route emit_init_to(routing_exporter &self, const Tvalue &value, const metadata_type &md) {
+            return {I, decltype(route::handle){std::in_place_index<I>,
+                                               detail::emit_init(*std::get<I>(self.exporters_), value, md)}};
+        }
+
+        template <typename Tvalue, std::size_t I>
+        static void emit_to(routing_exporter &self, const Tvalue &value, const metadata_type &md, const route &r) {
+            detail::emit(*std::get<I>(self.exporters_), value, md, std::get<I>(r.handle));
+        }
+
+        template <typename Tvalue, std::size_t I>
+        static void change_to(routing_exporter &self, const Tvalue &amount, const Tvalue &value, bool subtract,
+                              const metadata_type &md, const route &r) {
+            if (subtract) {
+                detail::emit_sub(*std::get<I>(self.exporters_), amount, value, md, std::get<I>(r.handle));
+            } else {
+                detail::emit_add(*std::get<I>(self.exporters_), amount, value, md, std::get<I>(r.handle));
+            }
+        }
+
+        template <std::size_t I>
+        static void release_to(routing_exporter &self, const route &r, const metadata_type &md) {
+            detail::release(*std::get<I>(self.exporters_), std::get<I>(r.handle), md);
+        }
+
+        template <typename Tvalue, std::size_t ...I>
+        static constexpr auto make_emit_table(std::index_sequence<I...>) {
+            using function_type = void (*)(routing_exporter &, const Tvalue &, const metadata_type &, const route &);
+            return std::array<function_type, size>{&emit_to<Tvalue, I>...};
+        }
+
+        template <typename Tvalue, std::size_t ...I>
+        static constexpr auto make_change_table(std::index_sequence<I...>) {
+            using function_type = void (*)(routing_exporter &, const Tvalue &, const Tvalue &, bool,
+                                           const metadata_type &, const route &);
+            return std::array<function_type, size>{&change_to<Tvalue, I>...};
+        }
+
+        template <typename Tvalue, std::size_t ...I>
+        static constexpr auto make_emit_init_table(std::index_sequence<I...>) {
+            using function_type = route (*)(routing_exporter &, const Tvalue &, const metadata_type &);
+            return std::array<function_type, size>{&emit_init_to<Tvalue, I>...};
+        }
+
+        template <std::size_t ...I>
+        static constexpr auto make_release_table(std::index_sequence<I...>) {
+            using function_type = void (*)(routing_exporter &, const route &, const metadata_type &);
+            return std::array<function_type, size>{&release_to<I>...};
+        }
+
+        template <typename Tvalue>
+        static constexpr auto emit_table = make_emit_table<Tvalue>(std::make_index_sequence<size>{});
+
+        template <typename Tvalue>
+        static constexpr auto change_table = make_change_table<Tvalue>(std::make_index_sequence<size>{});
+
+        template <typename Tvalue>
+        static constexpr auto emit_init_table = make_emit_init_table<Tvalue>(std::make_index_sequence<size>{});
+
+        static constexpr auto release_table = make_release_table(std::make_index_sequence<size>{});
+
+    public:
+        explicit routing_exporter(router_type router, std::shared_ptr<Texporter> exporter,
+                                  std::shared_ptr<Texporters> ...exporters)
+                : router_{std::move(router)}, exporters_{std::move(exporter), std::move(exporters)...} {}
+
+        template <typename Tvalue>
+        handle_type emit_init(const Tvalue &value, const metadata_type &md) {
+            std::size_t index = router_(md);
+            if (index >= size) return {};
+            return emit_init_table<Tvalue>[index](*this, value, md);
+        }
+
+        template <typename Tvalue>
+        void emit(const Tvalue &value, const metadata_type &md, const handle_type &r) {
+            if (r.index < size) emit_table<Tvalue>[r.index](*this, value, md, r);
+        }
+
+        /// Passes the change of a counter on to the exporter of the instrument.
+        template <typename Tvalue>
+        void emit_add(const Tvalue &amount, const Tvalue &value, const metadata_type &md, const handle_type &r) {
+            if (r.index < size) change_table<Tvalue>[r.index](*this, amount, value, false, md, r);
+        }
+
+        template <typename Tvalue>
+        void emit_sub(const Tvalue &amount, const Tvalue &value, const metadata_type &md, const handle_type &r) {
+            if (r.index < size) change_table<Tvalue>[r.index](*this, amount, value, true, md, r);
+        }
+
+        void release(const handle_type &r, const metadata_type &md) {
+            if (r.index < size) release_table[r.index](*this, r, md);
+        }
+
+        router_type &router() {
+            return router_;
+        }
+
+        template <std::size_t I>
+        auto &exporter() {
+            return *std::get<I>(exporters_);
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_ROUTING_EXPORTER_H
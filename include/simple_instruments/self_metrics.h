@@ -0,0 +1,97 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_SELF_METRICS_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_SELF_METRICS_H
+#include "../simple_instruments.h"
+#include "exporter_statistics.h"
+#include "quantile_sketch.h"
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace crosscode::simple_instruments {
+
+    /// Publishes the exporter_statistics of an exporter as instruments of factory, so the cost and health of the
+    /// telemetry pipeline are exported like any other metric. metadata(name) is called for the metadata of each:
+    ///
+    /// - queue_depth, dropped_records, bytes_written, batches_written and write_errors are value recorders. The
+    ///   counts are cumulative, like the value of a counter.
+    /// - flush_seconds and batch_size are quantile recorders of the writes in the interval.
+    ///
+    /// collect() reads the statistics and updates the instruments; call it periodically, for example from a
+    /// collector. The measured exporter never emits while it updates its statistics, so factory may use it too.
+    template <typename Texporter>
+    class self_metrics {
+    public:
+        using exporter_type = Texporter;
+    private:
+        std::shared_ptr<exporter_statistics> statistics_;
+        atomic_value_recorder<std::int64_t, exporter_type> queue_depth_;
+        atomic_value_recorder<std::uint64_t, exporter_type> dropped_;
+        atomic_value_recorder<std::uint64_t, exporter_type> bytes_written_;
+        atomic_value_recorder<std::uint64_t, exporter_type> batches_written_;
+        atomic_value_recorder<std::uint64_t, exporter_type> errors_;
+        atomic_quantile_recorder<double, exporter_type> flush_seconds_;
+        atomic_quantile_recorder<double, exporter_type> batch_size_;
+        quantile_sketch flush_scratch_{exporter_statistics::relative_accuracy, exporter_statistics::min_seconds,
+                                       exporter_statistics::max_seconds};
+        quantile_sketch batch_scratch_{exporter_statistics::relative_accuracy, exporter_statistics::min_batch_size,
+                                       exporter_statistics::max_batch_size};
+
+        template <typename Tvalue>
+        static void update(atomic_value_recorder<Tvalue, exporter_type> &recorder, Tvalue value) {
+            if (recorder.value() != value) recorder.set(value);
+        }
+
+    public:
+        template <typename Fmetadata>
+        self_metrics(instrument_factory<exporter_type> &factory, std::shared_ptr<exporter_statistics> statistics,
+                     Fmetadata &&metadata)
+                : statistics_{std::move(statistics)},
+                  queue_depth_{factory.template make_atomic_value_recorder_counter<std::int64_t>(
+                          metadata("queue_depth"))},
+                  dropped_{factory.template make_atomic_value_recorder_counter<std::uint64_t>(
+                          metadata("dropped_records"))},
+                  bytes_written_{factory.template make_atomic_value_recorder_counter<std::uint64_t>(
+                          metadata("bytes_written"))},
+                  batches_written_{factory.template make_atomic_value_recorder_counter<std::uint64_t>(
+                          metadata("batches_written"))},
+                  errors_{factory.template make_atomic_value_recorder_counter<std::uint64_t>(
+                          metadata("write_errors"))},
+                  flush_seconds_{factory.template make_atomic_quantile_recorder<double>(
+                          metadata("flush_seconds"), exporter_statistics::relative_accuracy,
+                          exporter_statistics::min_seconds, exporter_statistics::max_seconds)},
+                  batch_size_{factory.template make_atomic_quantile_recorder<double>(
+                          metadata("batch_size"), exporter_statistics::relative_accuracy,
+                          exporter_statistics::min_batch_size, exporter_statistics::max_batch_size)} {}
+
+        self_metrics(const self_metrics &) = delete;
+        self_metrics &operator=(const self_metrics &) = delete;
+
+        /// Sends the values that changed since the previous call, and the distributions of the interval. Call it
+        /// from one thread at a time.
+        void collect() {
+            update(queue_depth_, statistics_->queue_depth());
+            update(dropped_, statistics_->dropped());
+            update(bytes_written_, statistics_->bytes_written());
+            update(batches_written_, statistics_->batches_written());
+            update(errors_, statistics_->errors());
+            flush_scratch_.clear();
+            batch_scratch_.clear();
+            statistics_->take_distributions(flush_scratch_, batch_scratch_);
+            flush_seconds_.merge(flush_scratch_);
+            batch_size_.merge(batch_scratch_);
+            flush_seconds_.collect();
+            batch_size_.collect();
+        }
+
+        const quantile_sketch &last_flush_seconds() const {
+            return flush_seconds_.last();
+        }
+
+        const quantile_sketch &last_batch_size() const {
+            return batch_size_.last();
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_SELF_METRICS_H
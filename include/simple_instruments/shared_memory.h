@@ -0,0 +1,315 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_SHARED_MEMORY_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_SHARED_MEMORY_H
+#include "encoded_value.h"
+#include "detail/mapped_region.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+namespace crosscode::simple_instruments {
+
+    /// Header at the start of a shared memory segment. The segment layout is:
+    /// [shared_memory_header][padding up to slots_offset][slot_count * shared_memory_slot]
+    /// generation is odd while the owner changes which series occupy the slots, and even otherwise.
+    struct shared_memory_header {
+        static constexpr std::uint64_t magic_value = 0x31304d4853495343; // "CSISHM01"
+        static constexpr std::uint32_t version_value = 1;
+        std::atomic<std::uint64_t> magic;
+        std::uint32_t version;
+        std::uint32_t slot_size;
+        std::uint64_t slots_offset;
+        std::uint64_t slot_count;
+        std::uint32_t value_offset;
+        std::uint32_t name_offset;
+        std::uint32_t max_name_size;
+        alignas(64) std::atomic<std::uint64_t> generation;
+    };
+
+    /// One series. Every slot starts on its own cache line so values of different series never share a line.
+    struct alignas(128) shared_memory_slot {
+        static constexpr std::uint32_t free = 0;
+        static constexpr std::uint32_t live = 1;
+        static constexpr std::size_t max_name_size = 114;
+        std::atomic<std::uint64_t> value;
+        std::atomic<std::uint32_t> state;
+        std::uint8_t kind;
+        std::uint8_t name_size;
+        char name[max_name_size];
+    };
+
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "shared memory requires lock free 64 bit atomics");
+    static_assert(sizeof(shared_memory_slot) == 128, "shared_memory_slot must be 128 bytes");
+
+    /// A POSIX shared memory segment holding the current value of a set of series. The owner allocates a slot per
+    /// series and stores values into it, readers in other processes map the segment read only and load the values
+    /// whenever they like.
+    class shared_memory_segment {
+        static constexpr std::uint64_t slots_offset = 4096;
+        std::string name_;
+        bool owner_{false};
+        detail::mapped_region region_;
+        shared_memory_header *header_{nullptr};
+        shared_memory_slot *slots_{nullptr};
+        std::mutex mutex_;
+
+        static std::size_t segment_size(std::uint64_t slot_count) {
+            return slots_offset + slot_count * sizeof(shared_memory_slot);
+        }
+
+        void attach(detail::mapped_region region, std::uint64_t offset) {
+            region_ = std::move(region);
+            auto base = static_cast<char *>(region_.data());
+            header_ = reinterpret_cast<shared_memory_header *>(base);
+            slots_ = reinterpret_cast<shared_memory_slot *>(base + offset);
+        }
+
+        void begin_change() {
+            header_->generation.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        void end_change() {
+            header_->generation.fetch_add(1, std::memory_order_release);
+        }
+
+    public:
+        /// Creates (or replaces) the segment with the given name, e.g. "/my_application".
+        shared_memory_segment(std::string name, std::uint64_t slot_count) : name_{std::move(name)}, owner_{true} {
+            detail::file_descriptor fd{::shm_open(name_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644)};
+            if (fd.get() < 0) detail::throw_errno("shm_open " + name_);
+            auto size = segment_size(slot_count);
+            if (::ftruncate(fd.get(), static_cast<off_t>(size)) != 0) detail::throw_errno("ftruncate " + name_);
+            attach(detail::mapped_region{fd.get(), size, true}, slots_offset);
+            header_->version = shared_memory_header::version_value;
+            header_->slot_size = sizeof(shared_memory_slot);
+            header_->slots_offset = slots_offset;
+            header_->slot_count = slot_count;
+            header_->value_offset = offsetof(shared_memory_slot, value);
+            header_->name_offset = offsetof(shared_memory_slot, name);
+            header_->max_name_size = shared_memory_slot::max_name_size;
+            header_->generation.store(0, std::memory_order_relaxed);
+            header_->magic.store(shared_memory_header::magic_value, std::memory_order_release);
+        }
+
+        /// Opens an existing segment for reading.
+        explicit shared_memory_segment(std::string name) : name_{std::move(name)} {
+            detail::file_descriptor fd{::shm_open(name_.c_str(), O_RDONLY, 0)};
+            if (fd.get() < 0) detail::throw_errno("shm_open " + name_);
+            struct stat st{};
+            if (::fstat(fd.get(), &st) != 0) detail::throw_errno("fstat " + name_);
+            auto size = static_cast<std::size_t>(st.st_size);
+            if (size < slots_offset) throw std::runtime_error(name_ + " is not a simple_instruments segment");
+            detail::mapped_region region{fd.get(), size, false};
+            auto header = static_cast<const shared_memory_header *>(region.data());
+            if (header->magic.load(std::memory_order_acquire) != shared_memory_header::magic_value ||
+                header->version != shared_memory_header::version_value ||
+                header->slot_size != sizeof(shared_memory_slot) ||
+                size < header->slots_offset + header->slot_count * sizeof(shared_memory_slot)) {
+                throw std::runtime_error(name_ + " is not a simple_instruments segment");
+            }
+            auto offset = header->slots_offset;
+            attach(std::move(region), offset);
+        }
+
+        shared_memory_segment(const shared_memory_segment &) = delete;
+        shared_memory_segment &operator=(const shared_memory_segment &) = delete;
+
+        ~shared_memory_segment() {
+            if (owner_) ::shm_unlink(name_.c_str());
+        }
+
+        std::uint64_t slot_count() const {
+            return header_->slot_count;
+        }
+
+        std::uint64_t generation() const {
+            return header_->generation.load(std::memory_order_acquire);
+        }
+
+        const shared_memory_slot &slot(std::uint64_t index) const {
+            return slots_[index];
+        }
+
+        /// Claims a free slot for a series. Returns nullptr when the segment is full.
+        shared_memory_slot *allocate(std::string_view name, encoded_value value) {
+            std::lock_guard lock{mutex_};
+            for (std::uint64_t i = 0; i < header_->slot_count; ++i) {
+                auto &s = slots_[i];
+                if (s.state.load(std::memory_order_relaxed) != shared_memory_slot::free) continue;
+                auto name_size = std::min(name.size(), shared_memory_slot::max_name_size);
+                begin_change();
+                s.kind = static_cast<std::uint8_t>(value.kind);
+                s.name_size = static_cast<std::uint8_t>(name_size);
+                std::memcpy(s.name, name.data(), name_size);
+                s.value.store(value.bits, std::memory_order_relaxed);
+                s.state.store(shared_memory_slot::live, std::memory_order_relaxed);
+                end_change();
+                return &s;
+            }
+            return nullptr;
+        }
+
+        void release(shared_memory_slot *s) {
+            if (!s) return;
+            std::lock_guard lock{mutex_};
+            begin_change();
+            s->state.store(shared_memory_slot::free, std::memory_order_relaxed);
+            end_change();
+        }
+    };
+
+    /// A series as seen by a shared_memory_reader.
+    struct shared_memory_series {
+        std::string name;
+        value_kind kind;
+        const std::atomic<std::uint64_t> *value;
+    };
+
+    /// Samples all series of a shared memory segment. The list of series is only rescanned when the owner added or
+    /// removed a series, so sampling itself is a relaxed load per series. A segment whose owner died while it changed
+    /// the series stays in that change forever, so the reader gives up after max_retries attempts.
+    class shared_memory_reader {
+    public:
+        static constexpr int max_retries = 10000;
+    private:
+        shared_memory_segment segment_;
+        std::vector<shared_memory_series> series_;
+        std::vector<shared_memory_series> scanned_;
+        std::vector<encoded_value> values_;
+        std::uint64_t generation_{1};
+        bool stale_{false};
+
+        bool scan() {
+            auto before = segment_.generation();
+            if (before == generation_) return true;
+            if (before & 1u) return false;
+            scanned_.clear();
+            for (std::uint64_t i = 0; i < segment_.slot_count(); ++i) {
+                const auto &s = segment_.slot(i);
+                if (s.state.load(std::memory_order_relaxed) != shared_memory_slot::live) continue;
+                auto name_size = std::min<std::size_t>(s.name_size, shared_memory_slot::max_name_size);
+                scanned_.push_back({std::string(s.name, name_size), static_cast<value_kind>(s.kind), &s.value});
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (segment_.generation() != before) return false;
+            series_.swap(scanned_);
+            generation_ = before;
+            return true;
+        }
+
+        bool try_scan() {
+            for (int i = 0; i < max_retries; ++i) {
+                if (scan()) return true;
+                std::this_thread::yield();
+            }
+            return false;
+        }
+
+    public:
+        explicit shared_memory_reader(std::string name) : segment_{std::move(name)} {}
+
+        /// Calls f(name, encoded_value) for every live series. Returns false without calling f when the owner kept
+        /// changing the series for max_retries attempts, for example because it died during a change.
+        template <typename F>
+        bool sample(F &&f) {
+            for (int i = 0; i < max_retries; ++i) {
+                if (!scan()) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                values_.resize(series_.size());
+                for (std::size_t j = 0; j < series_.size(); ++j) {
+                    values_[j] = {series_[j].kind, series_[j].value->load(std::memory_order_relaxed)};
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (segment_.generation() != generation_) continue;
+                for (std::size_t j = 0; j < series_.size(); ++j) {
+                    f(std::string_view{series_[j].name}, values_[j]);
+                }
+                return true;
+            }
+            return false;
+        }
+
+        /// The live series. When the owner kept changing them for max_retries attempts, the series found by the last
+        /// successful scan are returned and stale() is true.
+        const std::vector<shared_memory_series> &series() {
+            stale_ = !try_scan();
+            return series_;
+        }
+
+        /// True when the last call of series() could not rescan the series.
+        bool stale() const {
+            return stale_;
+        }
+    };
+
+    /// Exporter that mirrors the current value of every instrument into a shared memory segment. The slot of an
+    /// instrument is looked up once in emit_init and kept in the instrument as handle. Counters apply each change to
+    /// the slot with an atomic addition that wraps at the width of the counter, so the slot always holds the counter
+    /// value and never goes back to a value that another thread computed earlier but stored later. That also holds
+    /// behind a tee_exporter, routing_exporter or queued_exporter, which pass the changes on. Other instruments store their value with a relaxed
+    /// store, so of concurrent changes the one stored last remains. When the segment is full, instruments are not
+    /// exported and dropped_series() is incremented.
+    template <typename Tmetadata>
+    class shared_memory_exporter {
+    public:
+        using metadata_type = Tmetadata;
+        using handle_type = shared_memory_slot *;
+    private:
+        shared_memory_segment segment_;
+        std::atomic<std::uint64_t> dropped_series_{0};
+
+    public:
+        shared_memory_exporter(std::string name, std::uint64_t slot_count) : segment_{std::move(name), slot_count} {}
+
+        template <typename Tvalue>
+        handle_type emit_init(const Tvalue &value, const metadata_type &md) {
+            const auto &id = unique_identifier(md);
+            auto slot = segment_.allocate(std::string_view{id}, encode_value(value));
+            if (!slot) dropped_series_.fetch_add(1, std::memory_order_relaxed);
+            return slot;
+        }
+
+        template <typename Tvalue>
+        void emit(const Tvalue &value, const metadata_type &, const handle_type &slot) {
+            if (slot) slot->value.store(encode_value(value).bits, std::memory_order_relaxed);
+        }
+
+        template <typename Tvalue>
+        void emit_add(const Tvalue &amount, const Tvalue &, const metadata_type &, const handle_type &slot) {
+            if (slot) detail::add_encoded(slot->value, amount, false);
+        }
+
+        template <typename Tvalue>
+        void emit_sub(const Tvalue &amount, const Tvalue &, const metadata_type &, const handle_type &slot) {
+            if (slot) detail::add_encoded(slot->value, amount, true);
+        }
+
+        void release(const handle_type &slot, const metadata_type &) {
+            segment_.release(slot);
+        }
+
+        std::uint64_t dropped_series() const {
+            return dropped_series_.load(std::memory_order_relaxed);
+        }
+
+        shared_memory_segment &segment() {
+            return segment_;
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_SHARED_MEMORY_H
@@ -0,0 +1,122 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_TEE_EXPORTER_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_TEE_EXPORTER_H
+#include "../simple_instruments.h"
+#include <cstddef>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace crosscode::simple_instruments {
+
+    namespace detail {
+        /// Declares handle_type only when Thandles contains a handle of at least one exporter.
+        template <bool has_handles, typename Thandles>
+        struct composite_handle {};
+
+        template <typename Thandles>
+        struct composite_handle<true, Thandles> {
+            using handle_type = Thandles;
+        };
+    }
+
+    /// Exporter that forwards everything to each of Texporters, in order. All exporters must use the same
+    /// metadata_type. Put an exporter behind a queued_exporter to keep it from slowing down the others.
+    template <typename Texporter, typename ...Texporters>
+    class tee_exporter : public detail::composite_handle<
+            (exporter_has_handle_v<Texporter> || ... || exporter_has_handle_v<Texporters>),
+            std::tuple<exporter_handle_t<Texporter>, exporter_handle_t<Texporters>...>> {
+    public:
+        using metadata_type = typename Texporter::metadata_type;
+        using handles_type = std::tuple<exporter_handle_t<Texporter>, exporter_handle_t<Texporters>...>;
+        static constexpr bool has_handles = (exporter_has_handle_v<Texporter> || ... || exporter_has_handle_v<Texporters>);
+        static_assert((std::is_same_v<metadata_type, typename Texporters::metadata_type> && ...),
+                      "all exporters of a tee_exporter must have the same metadata_type");
+    private:
+        std::tuple<std::shared_ptr<Texporter>, std::shared_ptr<Texporters>...> exporters_;
+        static constexpr std::size_t size = 1 + sizeof...(Texporters);
+        using change_handle_type = std::conditional_t<has_handles, handles_type, detail::no_handle>;
+
+        template <typename Tvalue, std::size_t ...I>
+        handles_type emit_init_all(const Tvalue &value, const metadata_type &md, std::index_sequence<I...>) {
+            return handles_type{detail::emit_init(*std::get<I>(exporters_), value, md)...};
+        }
+
+        template <typename Tvalue, std::size_t ...I>
+        void emit_all(const Tvalue &value, const metadata_type &md, const handles_type &handles,
+                      std::index_sequence<I...>) {
+            (detail::emit(*std::get<I>(exporters_), value, md, std::get<I>(handles)), ...);
+        }
+
+        template <typename Tvalue, std::size_t ...I>
+        void change_all(const Tvalue &amount, const Tvalue &value, bool subtract, const metadata_type &md,
+                        const handles_type &handles, std::index_sequence<I...>) {
+            if (subtract) {
+                (detail::emit_sub(*std::get<I>(exporters_), amount, value, md, std::get<I>(handles)), ...);
+            } else {
+                (detail::emit_add(*std::get<I>(exporters_), amount, value, md, std::get<I>(handles)), ...);
+            }
+        }
+
+        static const handles_type &handles_of(const change_handle_type &handle) {
+            if constexpr (has_handles) {
+                return handle;
+            } else {
+                static const handles_type none{};
+                return none;
+            }
+        }
+
+        template <std::size_t ...I>
+        void release_all(const handles_type &handles, const metadata_type &md, std::index_sequence<I...>) {
+            (detail::release(*std::get<I>(exporters_), std::get<I>(handles), md), ...);
+        }
+
+    public:
+        explicit tee_exporter(std::shared_ptr<Texporter> exporter, std::shared_ptr<Texporters> ...exporters)
+                : exporters_{std::move(exporter), std::move(exporters)...} {}
+
+        template <typename Tvalue>
+        auto emit_init(const Tvalue &value, const metadata_type &md) {
+            auto handles = emit_init_all(value, md, std::make_index_sequence<size>{});
+            if constexpr (has_handles) {
+                return handles;
+            }
+        }
+
+        template <typename Tvalue>
+        void emit(const Tvalue &value, const metadata_type &md) {
+            emit_all(value, md, handles_type{}, std::make_index_sequence<size>{});
+        }
+
+        template <typename Tvalue>
+        void emit(const Tvalue &value, const metadata_type &md, const handles_type &handles) {
+            emit_all(value, md, handles, std::make_index_sequence<size>{});
+        }
+
+        /// Passes the change of a counter on, so exporters that apply changes receive them also behind a tee.
+        template <typename Tvalue>
+        void emit_add(const Tvalue &amount, const Tvalue &value, const metadata_type &md,
+                      const change_handle_type &handle) {
+            change_all(amount, value, false, md, handles_of(handle), std::make_index_sequence<size>{});
+        }
+
+        template <typename Tvalue>
+        void emit_sub(const Tvalue &amount, const Tvalue &value, const metadata_type &md,
+                      const change_handle_type &handle) {
+            change_all(amount, value, true, md, handles_of(handle), std::make_index_sequence<size>{});
+        }
+
+        void release(const handles_type &handles, const metadata_type &md) {
+            release_all(handles, md, std::make_index_sequence<size>{});
+        }
+
+        template <std::size_t I>
+        auto &exporter() {
+            return *std::get<I>(exporters_);
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_TEE_EXPORTER_H
@@ -0,0 +1,229 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_TOP_K_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_TOP_K_H
+#include "../simple_instruments.h"
+#include "detail/hash.h"
+#include "detail/thread_index.h"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace crosscode::simple_instruments {
+
+    /// A key with its count. The real count is between count - error and count.
+    struct heavy_hitter {
+        std::string key;
+        std::uint64_t count;
+        std::uint64_t error;
+    };
+
+    /// The keys with the highest counts of one export interval, highest first, and the total of all counts.
+    struct heavy_hitters {
+        std::vector<heavy_hitter> top;
+        std::uint64_t total{0};
+    };
+
+    /// Counts events per key and sends the k keys with the highest counts per export interval, without a counter per
+    /// key. It uses the Space-Saving algorithm: a fixed number of counters is kept, and a key without a counter takes
+    /// over the counter with the lowest count.
+    ///
+    /// Keys are spread over shard_count shards by hash, each with its own lock and capacity / shard_count of the
+    /// counters, so threads counting different keys rarely wait for each other. Because every key lives in one shard,
+    /// merging the shards for collect() is exact. The Space-Saving guarantee holds per shard: a key that occurs more
+    /// than shard total / shard capacity times in an interval, where shard total counts the events of all keys in its
+    /// shard, keeps its counter and has a count that is at most that much too high. When the events are spread evenly
+    /// over the shards that is about total / capacity, but when a key shares its shard with most of the events it is
+    /// up to shard_count times more.
+    template <typename Texporter>
+    class atomic_top_k {
+    public:
+        using value_type = std::uint64_t;
+        using exporter_type = Texporter;
+        static constexpr std::size_t shard_count = 8;
+    private:
+        static constexpr std::size_t shards = shard_count;
+        static constexpr std::uint32_t empty = static_cast<std::uint32_t>(-1);
+
+        struct entry {
+            std::string key;
+            std::uint64_t hash;
+            std::uint64_t count;
+            std::uint64_t error;
+            std::uint32_t heap_index;
+        };
+
+        /// Space-Saving summary: entries in a min-heap by count, found through an open addressing table.
+        struct alignas(detail::cache_line_size) shard {
+            std::mutex mutex;
+            std::size_t capacity{0};
+            std::vector<entry> entries;
+            std::vector<std::uint32_t> heap;
+            std::vector<std::uint32_t> table;
+            std::size_t mask{0};
+            std::uint64_t total{0};
+
+            void init(std::size_t c) {
+                capacity = c;
+                entries.reserve(c);
+                heap.reserve(c);
+                table.assign(detail::table_size(c), empty);
+                mask = table.size() - 1;
+            }
+
+            std::size_t slot_of(std::uint64_t hash, std::string_view key) const {
+                for (auto slot = hash & mask;; slot = (slot + 1) & mask) {
+                    auto index = table[slot];
+                    if (index == empty) return slot;
+                    const auto &e = entries[index];
+                    if (e.hash == hash && e.key == key) return slot;
+                }
+            }
+
+            /// Removes the table slot of an entry, moving later entries of its probe sequence back.
+            void erase_slot(std::size_t slot) {
+                auto hole = slot;
+                for (auto next = (hole + 1) & mask; table[next] != empty; next = (next + 1) & mask) {
+                    auto home = entries[table[next]].hash & mask;
+                    if (((next - home) & mask) >= ((next - hole) & mask)) {
+                        table[hole] = table[next];
+                        hole = next;
+                    }
+                }
+                table[hole] = empty;
+            }
+
+            void swap_heap(std::size_t a, std::size_t b) {
+                std::swap(heap[a], heap[b]);
+                entries[heap[a]].heap_index = static_cast<std::uint32_t>(a);
+                entries[heap[b]].heap_index = static_cast<std::uint32_t>(b);
+            }
+
+            void sift_down(std::size_t i) {
+                for (;;) {
+                    auto smallest = i;
+                    auto left = 2 * i + 1;
+                    auto right = left + 1;
+                    if (left < heap.size() && entries[heap[left]].count < entries[heap[smallest]].count) {
+                        smallest = left;
+                    }
+                    if (right < heap.size() && entries[heap[right]].count < entries[heap[smallest]].count) {
+                        smallest = right;
+                    }
+                    if (smallest == i) return;
+                    swap_heap(i, smallest);
+                    i = smallest;
+                }
+            }
+
+            void sift_up(std::size_t i) {
+                while (i > 0) {
+                    auto parent = (i - 1) / 2;
+                    if (entries[heap[parent]].count <= entries[heap[i]].count) return;
+                    swap_heap(i, parent);
+                    i = parent;
+                }
+            }
+
+            void add(std::uint64_t hash, std::string_view key, std::uint64_t amount) {
+                total += amount;
+                auto slot = slot_of(hash, key);
+                if (table[slot] != empty) {
+                    auto &e = entries[table[slot]];
+                    e.count += amount;
+                    sift_down(e.heap_index);
+                } else if (entries.size() < capacity) {
+                    auto index = static_cast<std::uint32_t>(entries.size());
+                    entries.push_back({std::string{key}, hash, amount, 0, static_cast<std::uint32_t>(heap.size())});
+                    heap.push_back(index);
+                    table[slot] = index;
+                    sift_up(heap.size() - 1);
+                } else {
+                    auto index = heap[0];
+                    auto &e = entries[index];
+                    erase_slot(slot_of(e.hash, e.key));
+                    e.key.assign(key.data(), key.size());
+                    e.hash = hash;
+                    e.error = e.count;
+                    e.count += amount;
+                    table[slot_of(hash, key)] = index;
+                    sift_down(0);
+                }
+            }
+
+            void clear() {
+                entries.clear();
+                heap.clear();
+                std::fill(table.begin(), table.end(), empty);
+                total = 0;
+            }
+        };
+
+        static std::uint64_t hash_of(std::string_view key) {
+            return detail::mix(detail::hash_bytes(0x2545f4914f6cdd1dull, key));
+        }
+
+        data_block<heavy_hitters, exporter_type> data_;
+        std::size_t k_;
+        std::unique_ptr<std::array<shard, shards>> shards_;
+
+    public:
+        /// Keeps capacity counters, 8 * k when capacity is 0. More counters give more accurate counts.
+        atomic_top_k(std::shared_ptr<exporter_type> exporter, typename exporter_type::metadata_type metadata,
+                     std::size_t k, std::size_t capacity = 0)
+                : data_{std::move(exporter), std::move(metadata), heavy_hitters{}}, k_{k},
+                  shards_{std::make_unique<std::array<shard, shards>>()} {
+            if (k == 0) throw std::invalid_argument("k must be positive");
+            if (capacity == 0) capacity = 8 * k;
+            for (auto &s : *shards_) s.init((capacity + shards - 1) / shards);
+            data_.emit_init(data_.value_);
+        }
+
+        void add(std::string_view key, std::uint64_t amount = 1) {
+            auto hash = hash_of(key);
+            auto &s = (*shards_)[(hash >> 32) % shards];
+            std::lock_guard lock{s.mutex};
+            s.add(hash, key, amount);
+        }
+
+        /// The shard that counts key.
+        static std::size_t shard_of(std::string_view key) {
+            return (hash_of(key) >> 32) % shards;
+        }
+
+        /// Ends the interval: sends the k keys with the highest counts since the previous call, and starts over. Call
+        /// it from one thread at a time, for example from a collector.
+        const heavy_hitters &collect() {
+            auto &result = data_.value_;
+            result.top.clear();
+            result.total = 0;
+            for (auto &s : *shards_) {
+                std::lock_guard lock{s.mutex};
+                for (auto &e : s.entries) result.top.push_back({std::move(e.key), e.count, e.error});
+                result.total += s.total;
+                s.clear();
+            }
+            auto by_count = [](const heavy_hitter &a, const heavy_hitter &b) { return a.count > b.count; };
+            auto k = std::min(k_, result.top.size());
+            std::partial_sort(result.top.begin(), result.top.begin() + static_cast<std::ptrdiff_t>(k),
+                              result.top.end(), by_count);
+            result.top.resize(k);
+            if (result.total != 0) data_.emit(result);
+            return result;
+        }
+
+        /// The result of the last collect(). Only use it from the thread that calls collect().
+        const heavy_hitters &last() const {
+            return data_.value_;
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_TOP_K_H
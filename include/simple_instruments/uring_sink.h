@@ -0,0 +1,437 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_URING_SINK_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_URING_SINK_H
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+// IORING_FEAT_RW_CUR_POS came with IORING_OP_WRITE, in Linux 5.6.
+#if defined(__NR_io_uring_setup) && defined(IORING_FEAT_RW_CUR_POS)
+#define CROSSCODE_SIMPLE_INSTRUMENTS_IO_URING
+#endif
+#endif
+
+namespace crosscode::simple_instruments {
+
+    enum class sink_backend {
+        io_uring,
+        writev
+    };
+
+    namespace detail {
+        [[noreturn]] inline void throw_errno(int error, const char *what) {
+            throw std::system_error{error, std::generic_category(), what};
+        }
+
+#if defined(CROSSCODE_SIMPLE_INSTRUMENTS_IO_URING)
+        /// One io_uring submission and completion queue, set up with the raw system calls instead of liburing.
+        class io_uring_queue {
+            int fd_{-1};
+            void *sq_ring_{MAP_FAILED};
+            std::size_t sq_ring_size_{0};
+            void *cq_ring_{MAP_FAILED};
+            std::size_t cq_ring_size_{0};
+            io_uring_sqe *sqes_{static_cast<io_uring_sqe *>(MAP_FAILED)};
+            std::size_t sqes_size_{0};
+            unsigned *sq_head_{nullptr};
+            unsigned *sq_tail_{nullptr};
+            unsigned *sq_array_{nullptr};
+            unsigned sq_mask_{0};
+            unsigned sq_entries_{0};
+            unsigned *cq_head_{nullptr};
+            unsigned *cq_tail_{nullptr};
+            io_uring_cqe *cqes_{nullptr};
+            unsigned cq_mask_{0};
+            unsigned local_tail_{0};
+
+            template <typename T>
+            static T *at(void *ring, std::uint32_t offset) {
+                return reinterpret_cast<T *>(static_cast<char *>(ring) + offset);
+            }
+
+            void close() {
+                if (sqes_ != MAP_FAILED) munmap(sqes_, sqes_size_);
+                if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) munmap(cq_ring_, cq_ring_size_);
+                if (sq_ring_ != MAP_FAILED) munmap(sq_ring_, sq_ring_size_);
+                if (fd_ >= 0) ::close(fd_);
+            }
+
+        public:
+            explicit io_uring_queue(unsigned entries) {
+                io_uring_params params{};
+                fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+                if (fd_ < 0) throw_errno(errno, "io_uring_setup failed");
+                sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+                cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+                bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+                if (single_mmap) sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+                sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+                                IORING_OFF_SQ_RING);
+                if (sq_ring_ != MAP_FAILED) {
+                    cq_ring_ = single_mmap ? sq_ring_ : mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                                                             MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+                }
+                sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+                if (cq_ring_ != MAP_FAILED) {
+                    sqes_ = static_cast<io_uring_sqe *>(mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                                                             MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES));
+                }
+                if (sqes_ == MAP_FAILED) {
+                    auto error = errno;
+                    close();
+                    throw_errno(error, "io_uring mmap failed");
+                }
+                sq_head_ = at<unsigned>(sq_ring_, params.sq_off.head);
+                sq_tail_ = at<unsigned>(sq_ring_, params.sq_off.tail);
+                sq_array_ = at<unsigned>(sq_ring_, params.sq_off.array);
+                sq_mask_ = *at<unsigned>(sq_ring_, params.sq_off.ring_mask);
+                sq_entries_ = params.sq_entries;
+                cq_head_ = at<unsigned>(cq_ring_, params.cq_off.head);
+                cq_tail_ = at<unsigned>(cq_ring_, params.cq_off.tail);
+                cqes_ = at<io_uring_cqe>(cq_ring_, params.cq_off.cqes);
+                cq_mask_ = *at<unsigned>(cq_ring_, params.cq_off.ring_mask);
+                local_tail_ = *sq_tail_;
+            }
+
+            io_uring_queue(const io_uring_queue &) = delete;
+            io_uring_queue &operator=(const io_uring_queue &) = delete;
+
+            ~io_uring_queue() {
+                close();
+            }
+
+            /// Registers memory the kernel then keeps mapped, for IORING_OP_WRITE_FIXED. False when it could not.
+            bool register_buffers(const iovec *buffers, unsigned count) {
+                return syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, buffers, count) == 0;
+            }
+
+            /// Registers fd as file 0, for IOSQE_FIXED_FILE. False when it could not.
+            bool register_file(int fd) {
+                return syscall(__NR_io_uring_register, fd_, IORING_REGISTER_FILES, &fd, 1) == 0;
+            }
+
+            /// A cleared submission queue entry, or nullptr when the queue is full. It is passed to the kernel by the
+            /// next submit().
+            io_uring_sqe *next_sqe() {
+                auto head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+                if (local_tail_ - head >= sq_entries_) return nullptr;
+                auto index = local_tail_ & sq_mask_;
+                sq_array_[index] = index;
+                ++local_tail_;
+                auto sqe = &sqes_[index];
+                std::memset(sqe, 0, sizeof(*sqe));
+                return sqe;
+            }
+
+            /// Submits the prepared entries and waits until at least wait_for completions are available.
+            void submit(unsigned wait_for) {
+                __atomic_store_n(sq_tail_, local_tail_, __ATOMIC_RELEASE);
+                unsigned flags = wait_for > 0 ? IORING_ENTER_GETEVENTS : 0u;
+                for (;;) {
+                    auto to_submit = local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+                    if (to_submit == 0 && wait_for == 0) return;
+                    if (syscall(__NR_io_uring_enter, fd_, to_submit, wait_for, flags, nullptr, 0) >= 0) return;
+                    if (errno != EINTR) throw_errno(errno, "io_uring_enter failed");
+                }
+            }
+
+            /// Calls f for every available completion, and returns them to the kernel.
+            template <typename F>
+            void drain(F &&f) {
+                auto head = *cq_head_;
+                auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+                for (; head != tail; ++head) f(cqes_[head & cq_mask_]);
+                __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+            }
+        };
+#endif
+    }
+
+    /// Sink for line_protocol_exporter that writes to a file or socket without waiting for the writes: buffers are
+    /// copied into one of depth slots of slot_size bytes and submitted to an io_uring, so up to depth writes are in
+    /// flight. write only waits when all slots are in flight, and flush waits for all of them. The slots and the file
+    /// descriptor are registered with the ring, so the kernel does not map them for every write. Larger buffers are
+    /// split over several slots.
+    ///
+    /// Writes to a regular file go to explicit offsets and complete in any order; writes to sockets, pipes and files
+    /// opened with O_APPEND are linked, so they are written in order. When io_uring is not available, because the
+    /// kernel is older than 5.6 or io_uring is disabled, or when sink_backend::writev is requested, buffers are kept
+    /// without copying and written depth at a time with one writev. backend() tells which one is used.
+    ///
+    /// Like the other sinks it is not thread safe; the exporter calls it with its lock held. Write errors are thrown
+    /// as std::system_error, from the write or flush that finds out about them.
+    class uring_sink {
+        struct slot {
+            std::size_t size{0};
+            std::size_t written{0};
+            std::uint64_t offset{0};
+            bool in_flight{false};
+        };
+
+        int fd_;
+        bool owns_fd_;
+        bool ordered_{true};
+        std::uint64_t offset_{0};
+        std::size_t depth_;
+        std::size_t slot_size_;
+        sink_backend backend_{sink_backend::writev};
+        int error_{0};
+        // io_uring
+        char *memory_{static_cast<char *>(MAP_FAILED)};
+        std::vector<slot> slots_;
+        std::vector<std::size_t> free_;
+        std::deque<std::size_t> order_;
+        std::size_t in_flight_{0};
+        bool fixed_buffers_{false};
+        bool fixed_file_{false};
+#if defined(CROSSCODE_SIMPLE_INSTRUMENTS_IO_URING)
+        std::unique_ptr<detail::io_uring_queue> ring_;
+#endif
+        // writev
+        std::vector<std::string> pending_;
+        std::vector<iovec> iovecs_;
+
+        static int open_file(const std::string &path) {
+            auto fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+            if (fd < 0) detail::throw_errno(errno, ("could not open " + path).c_str());
+            return fd;
+        }
+
+        void setup(sink_backend backend) {
+            if (depth_ == 0 || depth_ > 1024 || slot_size_ == 0) {
+                if (owns_fd_) ::close(fd_);
+                throw std::invalid_argument("depth must be 1 to 1024 and slot_size positive");
+            }
+            auto position = lseek(fd_, 0, owns_fd_ ? SEEK_END : SEEK_CUR);
+            auto flags = fcntl(fd_, F_GETFL);
+            ordered_ = position < 0 || (flags >= 0 && (flags & O_APPEND) != 0);
+            offset_ = position < 0 ? 0 : static_cast<std::uint64_t>(position);
+#if defined(CROSSCODE_SIMPLE_INSTRUMENTS_IO_URING)
+            if (backend != sink_backend::io_uring) return;
+            auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+            slot_size_ = (slot_size_ + page - 1) / page * page;
+            try {
+                ring_ = std::make_unique<detail::io_uring_queue>(static_cast<unsigned>(depth_));
+            } catch (const std::system_error &) {
+                return;
+            }
+            memory_ = static_cast<char *>(mmap(nullptr, depth_ * slot_size_, PROT_READ | PROT_WRITE,
+                                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+            if (memory_ == MAP_FAILED) {
+                auto error = errno;
+                if (owns_fd_) ::close(fd_);
+                detail::throw_errno(error, "could not map uring_sink slots");
+            }
+            std::vector<iovec> buffers(depth_);
+            slots_.resize(depth_);
+            for (std::size_t i = 0; i < depth_; ++i) {
+                buffers[i] = iovec{memory_ + i * slot_size_, slot_size_};
+                free_.push_back(depth_ - 1 - i);
+            }
+            fixed_buffers_ = ring_->register_buffers(buffers.data(), static_cast<unsigned>(depth_));
+            fixed_file_ = ring_->register_file(fd_);
+            backend_ = sink_backend::io_uring;
+#else
+            (void)backend;
+#endif
+        }
+
+        void throw_if_failed() {
+            if (error_ == 0) return;
+            auto error = std::exchange(error_, 0);
+            detail::throw_errno(error, "uring_sink write failed");
+        }
+
+        // writev
+
+        void write_pending() {
+            iovecs_.clear();
+            for (auto &buffer : pending_) iovecs_.push_back(iovec{buffer.data(), buffer.size()});
+            std::size_t index = 0;
+            while (index < iovecs_.size()) {
+                auto count = static_cast<int>(std::min<std::size_t>(iovecs_.size() - index, IOV_MAX));
+                auto written = ::writev(fd_, iovecs_.data() + index, count);
+                if (written < 0) {
+                    if (errno == EINTR) continue;
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        pollfd descriptor{fd_, POLLOUT, 0};
+                        ::poll(&descriptor, 1, -1);
+                        continue;
+                    }
+                    error_ = errno;
+                    break;
+                }
+                auto left = static_cast<std::size_t>(written);
+                while (index < iovecs_.size() && left >= iovecs_[index].iov_len) left -= iovecs_[index++].iov_len;
+                if (left > 0) {
+                    iovecs_[index].iov_base = static_cast<char *>(iovecs_[index].iov_base) + left;
+                    iovecs_[index].iov_len -= left;
+                }
+            }
+            pending_.clear();
+        }
+
+        // io_uring
+
+#if defined(CROSSCODE_SIMPLE_INSTRUMENTS_IO_URING)
+        /// Submits the slots that are not in flight, in order. Ordered writes are submitted as one linked chain once
+        /// the previous chain completed, because only writes in one chain are ordered.
+        void submit_queued() {
+            if (ordered_ && in_flight_ > 0) return;
+            io_uring_sqe *previous = nullptr;
+            for (auto index : order_) {
+                auto &s = slots_[index];
+                if (s.in_flight) continue;
+                auto sqe = ring_->next_sqe();
+                if (sqe == nullptr) break;
+                sqe->opcode = fixed_buffers_ ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+                sqe->fd = fixed_file_ ? 0 : fd_;
+                if (fixed_file_) sqe->flags |= IOSQE_FIXED_FILE;
+                sqe->addr = reinterpret_cast<std::uintptr_t>(memory_ + index * slot_size_ + s.written);
+                sqe->len = static_cast<std::uint32_t>(s.size - s.written);
+                sqe->off = ordered_ ? 0 : s.offset + s.written;
+                if (fixed_buffers_) sqe->buf_index = static_cast<std::uint16_t>(index);
+                sqe->user_data = index;
+                if (ordered_ && previous != nullptr) previous->flags |= IOSQE_IO_LINK;
+                previous = sqe;
+                s.in_flight = true;
+                ++in_flight_;
+            }
+            ring_->submit(0);
+        }
+
+        /// Handles completions, waiting for at least one when wait is set. Short writes, and ordered writes that
+        /// were cancelled because an earlier write in their chain was short, are submitted again.
+        void reap(bool wait) {
+            submit_queued();
+            if (wait && in_flight_ > 0) ring_->submit(1);
+            ring_->drain([this](const io_uring_cqe &cqe) {
+                auto &s = slots_[cqe.user_data];
+                s.in_flight = false;
+                --in_flight_;
+                if (cqe.res == -ECANCELED || cqe.res == -EAGAIN || cqe.res == -EINTR) return;
+                if (cqe.res <= 0) {
+                    if (error_ == 0) error_ = cqe.res == 0 ? EIO : -cqe.res;
+                    s.written = s.size;
+                } else {
+                    s.written += static_cast<std::size_t>(cqe.res);
+                }
+            });
+            order_.erase(std::remove_if(order_.begin(), order_.end(), [this](std::size_t index) {
+                auto &s = slots_[index];
+                if (s.in_flight || s.written < s.size) return false;
+                free_.push_back(index);
+                return true;
+            }), order_.end());
+            submit_queued();
+        }
+
+        void write_slots(const std::string &buffer) {
+            std::size_t done = 0;
+            while (done < buffer.size()) {
+                while (free_.empty()) reap(true);
+                auto index = free_.back();
+                free_.pop_back();
+                auto &s = slots_[index];
+                s.size = std::min(slot_size_, buffer.size() - done);
+                s.written = 0;
+                s.offset = offset_;
+                offset_ += s.size;
+                std::memcpy(memory_ + index * slot_size_, buffer.data() + done, s.size);
+                done += s.size;
+                order_.push_back(index);
+            }
+            reap(false);
+        }
+
+        void drain_slots() {
+            while (!order_.empty()) reap(true);
+        }
+#endif
+
+    public:
+        /// Appends to the file at path, which is created when it does not exist.
+        explicit uring_sink(const std::string &path, std::size_t depth = 8, std::size_t slot_size = 64 * 1024,
+                            sink_backend backend = sink_backend::io_uring)
+                : fd_{open_file(path)}, owns_fd_{true}, depth_{depth}, slot_size_{slot_size} {
+            setup(backend);
+        }
+
+        /// Writes to fd, for example a connected socket, from its current position. fd is not closed.
+        explicit uring_sink(int fd, std::size_t depth = 8, std::size_t slot_size = 64 * 1024,
+                            sink_backend backend = sink_backend::io_uring)
+                : fd_{fd}, owns_fd_{false}, depth_{depth}, slot_size_{slot_size} {
+            setup(backend);
+        }
+
+        uring_sink(const uring_sink &) = delete;
+        uring_sink &operator=(const uring_sink &) = delete;
+
+        /// Waits for all writes. Errors are ignored; call flush first to see them.
+        ~uring_sink() {
+            try {
+                flush();
+            } catch (const std::system_error &) {
+            }
+#if defined(CROSSCODE_SIMPLE_INSTRUMENTS_IO_URING)
+            ring_.reset();
+#endif
+            if (memory_ != MAP_FAILED) munmap(memory_, depth_ * slot_size_);
+            if (owns_fd_) {
+                ::close(fd_);
+            } else if (backend_ == sink_backend::io_uring && !ordered_) {
+                lseek(fd_, static_cast<off_t>(offset_), SEEK_SET);
+            }
+        }
+
+        void write(std::string &&buffer) {
+            throw_if_failed();
+            if (buffer.empty()) return;
+#if defined(CROSSCODE_SIMPLE_INSTRUMENTS_IO_URING)
+            if (backend_ == sink_backend::io_uring) {
+                write_slots(buffer);
+                return;
+            }
+#endif
+            pending_.push_back(std::move(buffer));
+            if (pending_.size() >= depth_) write_pending();
+        }
+
+        /// Waits until everything written so far reached the file or socket.
+        void flush() {
+#if defined(CROSSCODE_SIMPLE_INSTRUMENTS_IO_URING)
+            if (backend_ == sink_backend::io_uring) drain_slots();
+#endif
+            if (!pending_.empty()) write_pending();
+            throw_if_failed();
+        }
+
+        sink_backend backend() const {
+            return backend_;
+        }
+
+        /// Whether the slots and the file descriptor were registered with the ring.
+        bool registered() const {
+            return fixed_buffers_ && fixed_file_;
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_URING_SINK_H
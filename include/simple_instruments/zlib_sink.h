@@ -0,0 +1,145 @@
+#ifndef CROSSCODE_SIMPLE_INSTRUMENTS_ZLIB_SINK_H
+#define CROSSCODE_SIMPLE_INSTRUMENTS_ZLIB_SINK_H
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <zlib.h>
+
+namespace crosscode::simple_instruments {
+
+    /// Sink that gzip compresses completed buffers on a background thread and writes the compressed stream to Tsink.
+    /// Compression never runs on the thread calling write, which only queues the buffer. When max_pending buffers are
+    /// queued write blocks until the background thread catches up.
+    ///
+    /// Requires linking against zlib.
+    template <typename Tsink>
+    class zlib_sink {
+    public:
+        using sink_type = Tsink;
+    private:
+        static constexpr std::size_t output_chunk_size = 64 * 1024;
+        std::mutex mutex_;
+        std::condition_variable work_;
+        std::condition_variable progress_;
+        std::deque<std::string> queue_;
+        std::size_t max_pending_;
+        std::uint64_t flush_requested_{0};
+        std::uint64_t flush_done_{0};
+        bool stop_{false};
+        std::atomic<std::uint64_t> bytes_in_{0};
+        std::atomic<std::uint64_t> bytes_out_{0};
+        z_stream stream_{};
+        sink_type sink_;
+        std::thread worker_;
+
+        void compress(const std::string &input, int mode) {
+            stream_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(input.data()));
+            stream_.avail_in = static_cast<uInt>(input.size());
+            for (;;) {
+                auto bound = static_cast<std::size_t>(deflateBound(&stream_, static_cast<uLong>(input.size())));
+                std::string output(std::max(bound, output_chunk_size), '\0');
+                stream_.next_out = reinterpret_cast<Bytef *>(output.data());
+                stream_.avail_out = static_cast<uInt>(output.size());
+                auto result = deflate(&stream_, mode);
+                output.resize(output.size() - stream_.avail_out);
+                if (!output.empty()) {
+                    bytes_out_.fetch_add(output.size(), std::memory_order_relaxed);
+                    sink_.write(std::move(output));
+                }
+                if (result == Z_STREAM_END || result == Z_STREAM_ERROR || result == Z_BUF_ERROR) break;
+                if (mode != Z_FINISH && stream_.avail_in == 0 && stream_.avail_out != 0) break;
+            }
+            bytes_in_.fetch_add(input.size(), std::memory_order_relaxed);
+        }
+
+        void run() {
+            std::unique_lock lock{mutex_};
+            for (;;) {
+                work_.wait(lock, [this] { return !queue_.empty() || flush_requested_ > flush_done_ || stop_; });
+                if (!queue_.empty()) {
+                    auto buffer = std::move(queue_.front());
+                    queue_.pop_front();
+                    progress_.notify_all();
+                    lock.unlock();
+                    compress(buffer, Z_NO_FLUSH);
+                    lock.lock();
+                } else if (flush_requested_ > flush_done_) {
+                    auto target = flush_requested_;
+                    lock.unlock();
+                    compress({}, Z_SYNC_FLUSH);
+                    sink_.flush();
+                    lock.lock();
+                    flush_done_ = target;
+                    progress_.notify_all();
+                } else {
+                    lock.unlock();
+                    compress({}, Z_FINISH);
+                    sink_.flush();
+                    return;
+                }
+            }
+        }
+
+    public:
+        template <typename ...Args>
+        explicit zlib_sink(int level, Args &&...args) : max_pending_{16}, sink_{std::forward<Args>(args)...} {
+            if (deflateInit2(&stream_, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                throw std::runtime_error("deflateInit2 failed");
+            }
+            worker_ = std::thread{[this] { run(); }};
+        }
+
+        zlib_sink(const zlib_sink &) = delete;
+        zlib_sink &operator=(const zlib_sink &) = delete;
+
+        /// Finishes the gzip stream and waits for all queued buffers to be written.
+        ~zlib_sink() {
+            {
+                std::lock_guard lock{mutex_};
+                stop_ = true;
+            }
+            work_.notify_one();
+            worker_.join();
+            deflateEnd(&stream_);
+        }
+
+        void write(std::string &&buffer) {
+            std::unique_lock lock{mutex_};
+            progress_.wait(lock, [this] { return queue_.size() < max_pending_; });
+            queue_.push_back(std::move(buffer));
+            lock.unlock();
+            work_.notify_one();
+        }
+
+        /// Waits until all queued buffers are compressed and written, and the compressed stream is flushed to a byte
+        /// boundary so everything written so far can be decompressed.
+        void flush() {
+            std::unique_lock lock{mutex_};
+            auto target = ++flush_requested_;
+            work_.notify_one();
+            progress_.wait(lock, [this, target] { return flush_done_ >= target; });
+        }
+
+        std::uint64_t bytes_in() const {
+            return bytes_in_.load(std::memory_order_relaxed);
+        }
+
+        std::uint64_t bytes_out() const {
+            return bytes_out_.load(std::memory_order_relaxed);
+        }
+
+        sink_type &sink() {
+            return sink_;
+        }
+    };
+
+}
+
+#endif //CROSSCODE_SIMPLE_INSTRUMENTS_ZLIB_SINK_H
@@ -0,0 +1,129 @@
+#include "simple_instruments.h"
+#include "simple_instruments/aggregate_recorder.h"
+#include "simple_instruments/line_protocol.h"
+#include "doctest.h"
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct aggregate_metadata {
+        std::string name;
+    };
+
+    class aggregate_exporter {
+    public:
+        using metadata_type = aggregate_metadata;
+        std::vector<std::string> lines;
+
+        template <typename Tvalue>
+        void emit_init(const csi::value_aggregate<Tvalue> &, const metadata_type &md) {
+            lines.push_back(md.name + " created");
+        }
+
+        template <typename Tvalue>
+        void emit(const csi::value_aggregate<Tvalue> &aggregate, const metadata_type &md) {
+            std::string line{md.name};
+            line.push_back(' ');
+            csi::append_line_protocol_fields(line, aggregate);
+            lines.push_back(line);
+        }
+    };
+
+    class null_exporter {
+    public:
+        using metadata_type = aggregate_metadata;
+
+        template <typename Tvalue>
+        void emit_init(const Tvalue &, const metadata_type &) {}
+
+        template <typename Tvalue>
+        void emit(const Tvalue &, const metadata_type &) {}
+    };
+
+}
+
+TEST_SUITE("atomic_aggregate_recorder") {
+    TEST_CASE("Minimum, maximum, sum and count are sent per interval") {
+        csi::instrument_factory<aggregate_exporter> factory;
+        auto latency = factory.make_atomic_aggregate_recorder<int>({"latency"});
+        latency.record(20);
+        latency.record(-5);
+        latency.record(700);
+        latency.record(10);
+        auto aggregate = latency.collect();
+        CHECK(aggregate.min == -5);
+        CHECK(aggregate.max == 700);
+        CHECK(aggregate.sum == 725);
+        CHECK(aggregate.count == 4);
+        CHECK(aggregate.mean() == doctest::Approx(181.25));
+        latency.collect();
+        latency.record(3);
+        latency.collect();
+        CHECK(factory.exporter().lines == std::vector<std::string>{
+                "latency created",
+                "latency min=-5i,max=700i,sum=725i,count=4u",
+                "latency min=3i,max=3i,sum=3i,count=1u"});
+        CHECK(latency.last().count == 1);
+    }
+
+    TEST_CASE("Floating point values are aggregated") {
+        csi::instrument_factory<aggregate_exporter> factory;
+        auto size = factory.make_atomic_aggregate_recorder<double>({"size"});
+        size.record(0.5);
+        size.record(-1.5);
+        auto aggregate = size.collect();
+        CHECK(aggregate.min == -1.5);
+        CHECK(aggregate.max == 0.5);
+        CHECK(aggregate.sum == -1.0);
+    }
+
+    TEST_CASE("Values recorded concurrently are all counted") {
+        csi::instrument_factory<null_exporter> factory;
+        auto latency = factory.make_atomic_aggregate_recorder<std::uint32_t>({"latency"});
+        std::vector<std::thread> threads;
+        for (std::uint32_t t = 0; t < 4; ++t) {
+            threads.emplace_back([&latency, t] {
+                for (std::uint32_t i = 0; i < 10000; ++i) latency.record(t * 10000 + i);
+            });
+        }
+        for (auto &t : threads) t.join();
+        auto aggregate = latency.collect();
+        CHECK(aggregate.count == 40000);
+        CHECK(aggregate.min == 0);
+        CHECK(aggregate.max == 39999);
+        CHECK(aggregate.sum == 39999ull * 40000ull / 2);
+    }
+
+    TEST_CASE("Aggregates collected while values are recorded are consistent") {
+        csi::instrument_factory<null_exporter> factory;
+        auto latency = factory.make_atomic_aggregate_recorder<int>({"latency"});
+        std::atomic<bool> stop{false};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&latency, &stop, t] {
+                for (int i = 0; !stop.load(std::memory_order_relaxed); ++i) latency.record(t * 1000 + i % 1000);
+            });
+        }
+        std::uint64_t count = 0;
+        std::uint64_t intervals = 0;
+        bool consistent = true;
+        while (intervals < 100) {
+            auto aggregate = latency.collect();
+            if (aggregate.count == 0) continue;
+            count += aggregate.count;
+            ++intervals;
+            consistent = consistent && aggregate.min <= aggregate.max && aggregate.min >= 0 &&
+                         aggregate.max < 4000 && aggregate.mean() >= aggregate.min && aggregate.mean() <= aggregate.max;
+        }
+        stop = true;
+        for (auto &t : threads) t.join();
+        CHECK(consistent);
+        CHECK(count > 0);
+    }
+}
@@ -0,0 +1,176 @@
+#include "simple_instruments.h"
+#include "simple_instruments/arena.h"
+#include "simple_instruments/instrument_family.h"
+#include "doctest.h"
+#include <array>
+#include <condition_variable>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    class counting_resource : public std::pmr::memory_resource {
+        void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+            ++allocations;
+            return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+        }
+
+        void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override {
+            ++deallocations;
+            std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+            return this == &other;
+        }
+    public:
+        int allocations{0};
+        int deallocations{0};
+    };
+
+    struct pmr_metadata {
+        using allocator_type = std::pmr::polymorphic_allocator<char>;
+        std::pmr::string name;
+
+        pmr_metadata(std::string_view n = {}, const allocator_type &allocator = {}) : name{n, allocator} {}
+        pmr_metadata(const pmr_metadata &other, const allocator_type &allocator) : name{other.name, allocator} {}
+        pmr_metadata(pmr_metadata &&other, const allocator_type &allocator)
+                : name{std::move(other.name), allocator} {}
+        pmr_metadata(const pmr_metadata &) = default;
+        pmr_metadata(pmr_metadata &&) = default;
+    };
+
+    template <std::size_t N>
+    pmr_metadata with_labels(const pmr_metadata &md, const std::array<csi::label, N> &labels) {
+        pmr_metadata result{md, md.name.get_allocator()};
+        for (const auto &l : labels) result.name.append(",").append(l.name).append("=").append(l.value);
+        return result;
+    }
+
+    class name_exporter {
+    public:
+        using metadata_type = pmr_metadata;
+        std::vector<std::pmr::memory_resource *> resources;
+
+        template <typename Tvalue>
+        void emit_init(const Tvalue &, const metadata_type &md) {
+            resources.push_back(md.name.get_allocator().resource());
+        }
+
+        template <typename Tvalue>
+        void emit(const Tvalue &, const metadata_type &) {}
+    };
+
+}
+
+TEST_SUITE("instrument_arena") {
+    TEST_CASE("Freed blocks are reused without going upstream") {
+        counting_resource upstream;
+        {
+            csi::instrument_arena arena{64 * 1024, &upstream};
+            auto a = arena.allocate(24);
+            auto b = arena.allocate(100);
+            CHECK(upstream.allocations == 1);
+            arena.deallocate(a, 24);
+            CHECK(arena.allocate(32) == a);
+            for (int i = 0; i < 10000; ++i) arena.deallocate(arena.allocate(48), 48);
+            std::vector<void *> blocks;
+            for (int i = 0; i < 1000; ++i) blocks.push_back(arena.allocate(200));
+            for (auto block : blocks) arena.deallocate(block, 200);
+            auto reserved = arena.reserved();
+            for (int i = 0; i < 1000; ++i) blocks[static_cast<std::size_t>(i)] = arena.allocate(200);
+            for (auto block : blocks) arena.deallocate(block, 200);
+            CHECK(arena.reserved() == reserved);
+            SUBCASE("Large allocations are passed upstream") {
+                auto before = upstream.allocations;
+                auto large = arena.allocate(4096);
+                CHECK(upstream.allocations == before + 1);
+                arena.deallocate(large, 4096);
+                CHECK(upstream.deallocations == 1);
+            }
+            arena.deallocate(b, 100);
+            arena.deallocate(a, 32);
+        }
+        CHECK(upstream.allocations == upstream.deallocations);
+    }
+
+    TEST_CASE("Blocks can be freed by another thread") {
+        csi::instrument_arena arena;
+        std::vector<void *> blocks;
+        for (int i = 0; i < 1000; ++i) blocks.push_back(arena.allocate(64));
+        std::thread{[&] {
+            for (auto block : blocks) arena.deallocate(block, 64);
+        }}.join();
+        auto reserved = arena.reserved();
+        for (int i = 0; i < 1000; ++i) arena.deallocate(arena.allocate(64), 64);
+        CHECK(arena.reserved() == reserved);
+    }
+
+    TEST_CASE("The thread cache follows the arena allocated from last") {
+        csi::instrument_arena first;
+        csi::instrument_arena second;
+        std::thread{[&] {
+            first.deallocate(first.allocate(24), 24);
+            CHECK(first.cached() == 16);
+            second.deallocate(second.allocate(24), 24);
+            CHECK(first.cached() == 0);
+            CHECK(second.cached() == 16);
+            auto reserved = first.reserved();
+            std::vector<void *> blocks;
+            for (int i = 0; i < 16; ++i) blocks.push_back(first.allocate(24));
+            for (auto block : blocks) first.deallocate(block, 24);
+            CHECK(first.reserved() == reserved);
+        }}.join();
+    }
+
+    TEST_CASE("The thread cache is reused after the arena it held blocks of was destroyed") {
+        auto first = std::make_unique<csi::instrument_arena>();
+        csi::instrument_arena second;
+        std::mutex mutex;
+        std::condition_variable cv;
+        int step = 0;
+        std::thread worker{[&] {
+            first->deallocate(first->allocate(24), 24);
+            std::unique_lock lock{mutex};
+            step = 1;
+            cv.notify_all();
+            cv.wait(lock, [&] { return step == 2; });
+            second.deallocate(second.allocate(24), 24);
+            CHECK(second.cached() == 16);
+        }};
+        {
+            std::unique_lock lock{mutex};
+            cv.wait(lock, [&] { return step == 1; });
+            first.reset();
+            step = 2;
+        }
+        cv.notify_all();
+        worker.join();
+    }
+
+    TEST_CASE("The factory allocates metadata and family children from its memory resource") {
+        counting_resource upstream;
+        csi::instrument_arena arena{64 * 1024, &upstream};
+        csi::instrument_factory<name_exporter> factory;
+        factory.use_memory_resource(&arena);
+        CHECK(factory.memory_resource() == &arena);
+        auto counter = factory.make_atomic_monotonic_counter<uint64_t>({"a counter with a name that is not short"});
+        auto family = factory.make_atomic_monotonic_counter_family<uint64_t>({"requests"}, {"endpoint"});
+        family.with("/a/path/that/is/long/enough/to/allocate").add();
+        CHECK(upstream.allocations == 1);
+        CHECK(factory.exporter().resources == std::vector<std::pmr::memory_resource *>{&arena, &arena});
+        SUBCASE("Without a memory resource the default allocator is used") {
+            factory.use_memory_resource(nullptr);
+            CHECK(factory.memory_resource() == std::pmr::get_default_resource());
+            auto other = factory.make_atomic_monotonic_counter<uint64_t>({"requests"});
+            CHECK(factory.exporter().resources.back() == std::pmr::get_default_resource());
+        }
+    }
+}
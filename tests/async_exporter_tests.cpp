@@ -0,0 +1,163 @@
+#include "simple_instruments.h"
+#include "simple_instruments/async_exporter.h"
+#include "doctest.h"
+#include <coroutine>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct lp_metadata {
+        std::string series;
+    };
+
+    const std::string &unique_identifier(const lp_metadata &md) {
+        return md.series;
+    }
+
+    /// A single threaded event loop: suspended coroutines wait in a queue until run() resumes them.
+    struct event_loop {
+        std::deque<std::coroutine_handle<>> ready;
+
+        void run() {
+            while (!ready.empty()) {
+                auto h = ready.front();
+                ready.pop_front();
+                h.resume();
+            }
+        }
+    };
+
+    /// Completes writes on the next turn of the loop, like a sink that submits them to the kernel.
+    struct loop_sink {
+        event_loop *loop;
+        std::vector<std::string> buffers;
+        bool fail{false};
+
+        explicit loop_sink(event_loop *l) : loop{l} {}
+
+        struct write_awaiter {
+            loop_sink *sink;
+            std::string buffer;
+
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> h) {
+                sink->loop->ready.push_back(h);
+            }
+
+            void await_resume() {
+                if (sink->fail) throw std::runtime_error("write failed");
+                sink->buffers.push_back(std::move(buffer));
+            }
+        };
+
+        write_awaiter write(std::string &&buffer) {
+            return write_awaiter{this, std::move(buffer)};
+        }
+    };
+
+    using exporter_type = csi::async_line_protocol_exporter<lp_metadata, loop_sink>;
+
+    static_assert(csi::async_sink<loop_sink>);
+    static_assert(csi::async_exporter<exporter_type>);
+
+    struct blocking_exporter {
+        using metadata_type = lp_metadata;
+
+        void flush() {}
+    };
+
+    static_assert(!csi::async_exporter<blocking_exporter>);
+
+    csi::async_task flush_twice(exporter_type &exporter, int &finished) {
+        co_await exporter.flush();
+        co_await exporter.flush();
+        ++finished;
+    }
+
+}
+
+TEST_SUITE("async_exporter") {
+    TEST_CASE("Emits are only written when a flush is driven by the event loop") {
+        event_loop loop;
+        csi::instrument_factory<exporter_type> factory(1024, &loop);
+        auto connections = factory.make_atomic_bidirectional_counter<int32_t>({"connections"});
+        connections.add(2);
+        auto exporter = &factory.exporter();
+        REQUIRE(exporter->buffered() > 0);
+
+        auto task = exporter->flush();
+        REQUIRE_FALSE(task.done());
+        REQUIRE(exporter->sink().buffers.empty());
+        task.start();
+        REQUIRE_FALSE(task.done());
+        REQUIRE(exporter->buffered() == 0);
+        loop.run();
+        REQUIRE(task.done());
+        task.get();
+        REQUIRE(exporter->sink().buffers.size() == 1);
+        auto &lines = exporter->sink().buffers[0];
+        REQUIRE(lines.find("connections value=0i ") == 0);
+        REQUIRE(lines.find("\nconnections value=2i ") != std::string::npos);
+    }
+
+    TEST_CASE("An empty buffer is not written") {
+        event_loop loop;
+        exporter_type exporter{1024, &loop};
+        auto task = exporter.flush();
+        task.start();
+        REQUIRE(task.done());
+        REQUIRE(exporter.sink().buffers.empty());
+    }
+
+    TEST_CASE("Flushes can be awaited from another coroutine") {
+        event_loop loop;
+        csi::instrument_factory<exporter_type> factory(1024, &loop);
+        auto counter = factory.make_atomic_monotonic_counter<uint64_t>({"requests"});
+        auto exporter = &factory.exporter();
+        int finished = 0;
+        auto task = flush_twice(*exporter, finished);
+        task.start();
+        counter.add();
+        loop.run();
+        REQUIRE(finished == 1);
+        REQUIRE(exporter->sink().buffers.size() == 2);
+        REQUIRE(exporter->sink().buffers[1].find("requests value=1u ") == 0);
+    }
+
+    TEST_CASE("on_full is called once per batch") {
+        event_loop loop;
+        csi::instrument_factory<exporter_type> factory(64, &loop);
+        auto exporter = &factory.exporter();
+        int notified = 0;
+        exporter->on_full([&] { ++notified; });
+        auto counter = factory.make_atomic_monotonic_counter<uint64_t>({"requests"});
+        for (int i = 0; i < 10; ++i) counter.add();
+        REQUIRE(notified == 1);
+        auto task = exporter->flush();
+        task.start();
+        loop.run();
+        for (int i = 0; i < 10; ++i) counter.add();
+        REQUIRE(notified == 2);
+    }
+
+    TEST_CASE("Sink errors are rethrown by the task") {
+        event_loop loop;
+        csi::instrument_factory<exporter_type> factory(1024, &loop);
+        auto counter = factory.make_atomic_monotonic_counter<uint64_t>({"requests"});
+        auto exporter = &factory.exporter();
+        exporter->sink().fail = true;
+        auto task = exporter->flush();
+        task.start();
+        loop.run();
+        REQUIRE(task.done());
+        REQUIRE_THROWS_AS(task.get(), std::runtime_error);
+    }
+}
@@ -0,0 +1,187 @@
+#include "simple_instruments.h"
+#include "simple_instruments/queued_exporter.h"
+#include "simple_instruments/tee_exporter.h"
+#include "doctest.h"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct composite_metadata {
+        std::string name;
+    };
+
+    class recording_exporter {
+    public:
+        using metadata_type = composite_metadata;
+    private:
+        std::mutex mutex_;
+        std::stringstream ss_;
+    public:
+        template <typename Tvalue>
+        void emit_init(const Tvalue &value, const metadata_type &md) {
+            std::lock_guard lock{mutex_};
+            ss_ << md.name << " init " << value << "\n";
+        }
+
+        template <typename Tvalue>
+        void emit(const Tvalue &value, const metadata_type &md) {
+            std::lock_guard lock{mutex_};
+            ss_ << md.name << " " << value << "\n";
+        }
+
+        std::string str() {
+            std::lock_guard lock{mutex_};
+            return ss_.str();
+        }
+    };
+
+    class handle_exporter {
+    public:
+        using metadata_type = composite_metadata;
+        using handle_type = std::string;
+        std::stringstream ss;
+
+        template <typename Tvalue>
+        handle_type emit_init(const Tvalue &, const metadata_type &md) {
+            return "#" + md.name;
+        }
+
+        template <typename Tvalue>
+        void emit(const Tvalue &value, const metadata_type &, const handle_type &handle) {
+            ss << handle << " " << value << "\n";
+        }
+
+        void release(const handle_type &handle, const metadata_type &) {
+            ss << handle << " released\n";
+        }
+    };
+
+    /// Blocks every emit until opened, to simulate a slow sink.
+    class gated_exporter {
+    public:
+        using metadata_type = composite_metadata;
+    private:
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        bool open_{false};
+    public:
+        int emitted{0};
+
+        template <typename Tvalue>
+        void emit_init(const Tvalue &, const metadata_type &) {}
+
+        template <typename Tvalue>
+        void emit(const Tvalue &, const metadata_type &) {
+            std::unique_lock lock{mutex_};
+            cv_.wait(lock, [this] { return open_; });
+            ++emitted;
+        }
+
+        void open() {
+            {
+                std::lock_guard lock{mutex_};
+                open_ = true;
+            }
+            cv_.notify_all();
+        }
+    };
+
+    /// Counts its live copies, to find copies that are never destroyed.
+    struct counted_value {
+        std::shared_ptr<int> live{std::make_shared<int>(0)};
+        std::string padding;
+
+        counted_value() {
+            ++*live;
+        }
+
+        counted_value(const counted_value &other) : live{other.live}, padding{other.padding} {
+            ++*live;
+        }
+
+        counted_value &operator=(const counted_value &) = default;
+
+        ~counted_value() {
+            --*live;
+        }
+    };
+
+}
+
+TEST_SUITE("tee_exporter") {
+    TEST_CASE("Can send instruments to multiple exporters") {
+        auto first = std::make_shared<recording_exporter>();
+        auto second = std::make_shared<recording_exporter>();
+        csi::instrument_factory<csi::tee_exporter<recording_exporter, recording_exporter>> factory(first, second);
+        static_assert(!csi::exporter_has_handle_v<decltype(factory)::exporter_type>,
+                      "tee_exporter should have no handle when none of its exporters has one");
+        auto counter = factory.make_atomic_monotonic_counter<int>({"requests"});
+        counter.add();
+        REQUIRE(first->str() == "requests init 0\nrequests 1\n");
+        REQUIRE(second->str() == first->str());
+        REQUIRE(&factory.exporter().exporter<1>() == second.get());
+    }
+
+    TEST_CASE("Handles of exporters are kept per exporter") {
+        auto first = std::make_shared<recording_exporter>();
+        auto second = std::make_shared<handle_exporter>();
+        csi::instrument_factory<csi::tee_exporter<recording_exporter, handle_exporter>> factory(first, second);
+        static_assert(csi::exporter_has_handle_v<decltype(factory)::exporter_type>,
+                      "tee_exporter should have a handle when one of its exporters has one");
+        {
+            auto recorder = factory.make_atomic_value_recorder_counter<int>({"size"});
+            recorder.set(3);
+        }
+        REQUIRE(first->str() == "size init 0\nsize 3\n");
+        REQUIRE(second->ss.str() == "#size 3\n#size released\n");
+    }
+}
+
+TEST_SUITE("queued_exporter") {
+    TEST_CASE("Values are delivered in order on the queue thread") {
+        csi::instrument_factory<csi::queued_exporter<handle_exporter>> factory(16);
+        {
+            auto counter = factory.make_atomic_bidirectional_counter<int>({"active"});
+            auto recorder = factory.make_atomic_value_recorder_counter<double>({"latency"});
+            counter.add();
+            recorder.set(0.5);
+            counter.sub();
+        }
+        factory.exporter().drain();
+        REQUIRE(factory.exporter().exporter().ss.str() ==
+                "#active 1\n#latency 0.5\n#active 0\n#latency released\n#active released\n");
+    }
+
+    TEST_CASE("A slow exporter drops values instead of blocking the instruments") {
+        auto slow = std::make_shared<csi::queued_exporter<gated_exporter>>(4);
+        auto fast = std::make_shared<recording_exporter>();
+        using exporter_type = csi::tee_exporter<csi::queued_exporter<gated_exporter>, recording_exporter>;
+        csi::instrument_factory<exporter_type> factory(slow, fast);
+        auto counter = factory.make_atomic_monotonic_counter<int>({"requests"});
+        for (int i = 0; i < 100; ++i) counter.add();
+        CHECK(fast->str().find("requests 100\n") != std::string::npos);
+        slow->exporter().open();
+        slow->drain();
+        CHECK(slow->dropped() > 0);
+        CHECK(slow->exporter().emitted + static_cast<int>(slow->dropped()) == 100);
+    }
+
+    TEST_CASE("Dropped values that are not stored inline are destroyed") {
+        csi::queued_exporter<gated_exporter> exporter(1);
+        counted_value value;
+        auto target = exporter.emit_init(value, {"requests"});
+        for (int i = 0; i < 100; ++i) exporter.emit(value, {"requests"}, target);
+        exporter.exporter().open();
+        exporter.drain();
+        exporter.release(target, {"requests"});
+        exporter.drain();
+        CHECK(exporter.dropped() > 0);
+        CHECK(*value.live == 1);
+    }
+}
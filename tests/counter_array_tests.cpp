@@ -0,0 +1,90 @@
+#include "simple_instruments.h"
+#include "simple_instruments/counter_array.h"
+#include "doctest.h"
+#include <atomic>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct counter_array_metadata {
+        std::string name;
+    };
+
+    class counter_array_exporter {
+    public:
+        using metadata_type = counter_array_metadata;
+        std::vector<std::vector<std::uint64_t>> sent;
+
+        void emit_init(const csi::counter_array_snapshot &snapshot, const metadata_type &) {
+            CHECK(snapshot.changed == 0);
+        }
+
+        void emit(const csi::counter_array_snapshot &snapshot, const metadata_type &) {
+            sent.push_back(snapshot.deltas);
+        }
+    };
+
+}
+
+TEST_SUITE("atomic_counter_array") {
+    TEST_CASE("Deltas are the increase since the previous collect") {
+        csi::instrument_factory<counter_array_exporter> factory;
+        auto status = factory.make_atomic_counter_array({"status"}, 6);
+        status.add(0);
+        status.add(5, 3);
+        auto &first = status.collect();
+        CHECK(first.values == std::vector<std::uint64_t>{1, 0, 0, 0, 0, 3});
+        CHECK(first.deltas == std::vector<std::uint64_t>{1, 0, 0, 0, 0, 3});
+        CHECK(first.changed == 2);
+        status.collect();
+        status.add(5);
+        auto &third = status.collect();
+        CHECK(third.values == std::vector<std::uint64_t>{1, 0, 0, 0, 0, 4});
+        CHECK(third.deltas == std::vector<std::uint64_t>{0, 0, 0, 0, 0, 1});
+        CHECK(third.changed == 1);
+        CHECK(factory.exporter().sent.size() == 2);
+        CHECK(status.value(5) == 4);
+    }
+
+    TEST_CASE("The dispatched snapshot matches the scalar one") {
+        auto streamed = csi::detail::streamed_snapshot_size + 3;
+        for (std::size_t size : {std::size_t{1}, std::size_t{4}, std::size_t{7}, std::size_t{1027}, streamed}) {
+            std::vector<std::atomic<std::uint64_t>> counters(size);
+            std::mt19937_64 random{size};
+            std::vector<std::uint64_t> values(size);
+            for (auto &v : values) v = random() % 4;
+            for (std::size_t i = 0; i < size; ++i) counters[i].store(values[i] + random() % 2);
+            counters[0].store(values[0] - 1);
+            auto expected_values = values;
+            std::vector<std::uint64_t> expected_deltas(size);
+            std::vector<std::uint64_t> deltas(size);
+            auto changed = csi::detail::snapshot_counters(counters.data(), values.data(), deltas.data(), size);
+            auto expected = csi::detail::snapshot_counters_scalar(counters.data(), expected_values.data(),
+                                                                  expected_deltas.data(), size);
+            CHECK(changed == expected);
+            CHECK(values == expected_values);
+            CHECK(deltas == expected_deltas);
+        }
+    }
+
+    TEST_CASE("Concurrent adds are all counted") {
+        csi::instrument_factory<counter_array_exporter> factory;
+        auto slots = factory.make_atomic_counter_array({"slots"}, 8);
+        std::vector<std::thread> threads;
+        std::uint64_t total = 0;
+        for (std::size_t t = 0; t < 4; ++t) {
+            threads.emplace_back([&slots, t] {
+                for (std::size_t i = 0; i < 10000; ++i) slots.add((t + i) % 8);
+            });
+        }
+        for (auto &thread : threads) thread.join();
+        for (auto delta : slots.collect().deltas) total += delta;
+        CHECK(total == 40000);
+    }
+}
@@ -0,0 +1,145 @@
+#include "simple_instruments.h"
+#include "simple_instruments/collector.h"
+#include "simple_instruments/delta_exporter.h"
+#include "doctest.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct delta_metadata {
+        std::string name;
+    };
+
+    class recording_exporter {
+    public:
+        using metadata_type = delta_metadata;
+        std::stringstream ss;
+
+        template <typename Tvalue>
+        void emit_init(const Tvalue &value, const metadata_type &md) {
+            ss << md.name << " init " << value << "\n";
+        }
+
+        template <typename Tvalue>
+        void emit(const Tvalue &value, const metadata_type &md) {
+            static_assert(std::is_same_v<Tvalue, std::uint64_t> || std::is_same_v<Tvalue, double>,
+                          "deltas are sent as uint64_t or double");
+            ss << md.name << " " << value << "\n";
+        }
+
+        void release(const csi::detail::no_handle &, const metadata_type &md) {
+            ss << md.name << " released\n";
+        }
+
+        std::string take() {
+            auto result = ss.str();
+            ss.str({});
+            return result;
+        }
+    };
+
+}
+
+TEST_SUITE("delta_exporter") {
+    TEST_CASE("Cumulative counters are sent as deltas per collection") {
+        csi::instrument_factory<csi::delta_exporter<recording_exporter>> factory(csi::delta_mode::delta);
+        auto &out = factory.exporter().exporter();
+        auto requests = factory.make_atomic_monotonic_counter<uint64_t>({"requests"}, 100);
+        auto errors = factory.make_atomic_monotonic_counter<int>({"errors"});
+        CHECK(out.take() == "requests init 0\nerrors init 0\n");
+        requests.add();
+        requests.add();
+        errors.add();
+        factory.exporter().collect();
+        CHECK(out.take() == "requests 2\nerrors 1\n");
+        SUBCASE("Series that did not change are not sent") {
+            requests.add();
+            factory.exporter().collect();
+            CHECK(out.take() == "requests 1\n");
+        }
+        SUBCASE("The last delta of a destroyed instrument is sent before it is released") {
+            {
+                auto temporary = factory.make_atomic_monotonic_counter<uint64_t>({"temporary"});
+                temporary.add();
+            }
+            CHECK(factory.exporter().size() == 3);
+            factory.exporter().collect();
+            CHECK(out.take() == "temporary init 0\ntemporary 1\ntemporary released\n");
+            CHECK(factory.exporter().size() == 2);
+        }
+    }
+
+    TEST_CASE("Wraps and resets are detected") {
+        using csi::value_kind;
+        auto delta = [](value_kind kind, unsigned width, std::uint64_t previous, std::uint64_t current) {
+            auto result = csi::detail::compute_counter_delta(kind, width, previous, current);
+            return result.advanced ? result.delta.bits : ~std::uint64_t{0};
+        };
+        CHECK(delta(value_kind::unsigned_integer, 16, 65530, 4) == 10);
+        CHECK(delta(value_kind::signed_integer, 16, static_cast<std::uint64_t>(std::int64_t{32760}),
+                    static_cast<std::uint64_t>(std::int64_t{-32766})) == 10);
+        CHECK(delta(value_kind::unsigned_integer, 64, ~std::uint64_t{0}, 9) == 10);
+        CHECK(delta(value_kind::unsigned_integer, 64, 1000000, 20) == 20);
+        CHECK(delta(value_kind::unsigned_integer, 64, 1000000, 999999) == ~std::uint64_t{0});
+        auto reset = csi::detail::compute_counter_delta(value_kind::floating_point, 64,
+                                                        csi::encode_value(10.0).bits, csi::encode_value(2.5).bits);
+        CHECK(reset.advanced);
+        CHECK(reset.delta.visit([](auto value) { return static_cast<double>(value); }) == 2.5);
+    }
+
+    TEST_CASE("Rates are sent per second of the collection interval") {
+        csi::instrument_factory<csi::delta_exporter<recording_exporter>> factory(csi::delta_mode::rate);
+        auto requests = factory.make_atomic_monotonic_counter<uint64_t>({"requests"});
+        factory.exporter().collect();
+        for (int i = 0; i < 1000; ++i) requests.add();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        factory.exporter().collect();
+        std::string name;
+        std::string init;
+        double zero = 1;
+        double rate = 0;
+        factory.exporter().exporter().ss >> name >> init >> zero >> name >> rate;
+        CHECK(zero == 0);
+        CHECK(rate > 1000);
+        CHECK(rate <= 10000);
+    }
+}
+
+TEST_SUITE("collector") {
+    TEST_CASE("Tasks run once per interval until removed") {
+        std::atomic<int> runs{0};
+        csi::collector collector{std::chrono::milliseconds(5)};
+        auto id = collector.add([&runs] { ++runs; });
+        while (runs < 3) std::this_thread::yield();
+        collector.remove(id);
+        auto after = runs.load();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        CHECK(runs == after);
+    }
+
+    TEST_CASE("A collector without interval only runs on collect") {
+        int runs = 0;
+        csi::collector collector;
+        collector.add([&runs] { ++runs; });
+        collector.collect();
+        collector.collect();
+        CHECK(runs == 2);
+        CHECK(collector.interval() == csi::collector::clock::duration::zero());
+    }
+
+    TEST_CASE("A collector needs a positive interval") {
+        CHECK_THROWS_AS(csi::collector{std::chrono::milliseconds(0)}, std::invalid_argument);
+        CHECK_THROWS_AS(csi::collector{std::chrono::seconds(-1)}, std::invalid_argument);
+        using picoseconds = std::chrono::duration<std::int64_t, std::pico>;
+        CHECK_THROWS_AS(csi::collector{picoseconds(1)}, std::invalid_argument);
+    }
+}
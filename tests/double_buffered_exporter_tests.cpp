@@ -0,0 +1,148 @@
+#include "simple_instruments.h"
+#include "simple_instruments/double_buffered_exporter.h"
+#include "doctest.h"
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct lp_metadata {
+        std::string series;
+    };
+
+    const std::string &unique_identifier(const lp_metadata &md) {
+        return md.series;
+    }
+
+    /// Records what it is given, and blocks in write while closed, like a stalled network connection.
+    struct gated_sink {
+        std::mutex mutex;
+        std::condition_variable opened;
+        bool open{true};
+        bool fail{false};
+        std::string written;
+        std::vector<std::thread::id> writers;
+        int flushes{0};
+
+        void write(std::string &&buffer) {
+            std::unique_lock lock{mutex};
+            opened.wait(lock, [this] { return open; });
+            if (fail) throw std::runtime_error("write failed");
+            written += buffer;
+            writers.push_back(std::this_thread::get_id());
+        }
+
+        void flush() {
+            std::lock_guard lock{mutex};
+            ++flushes;
+        }
+
+        void set_open(bool value) {
+            {
+                std::lock_guard lock{mutex};
+                open = value;
+            }
+            opened.notify_all();
+        }
+    };
+
+    struct shared_sink {
+        std::shared_ptr<std::string> written;
+
+        explicit shared_sink(std::shared_ptr<std::string> out) : written{std::move(out)} {}
+
+        void write(std::string &&buffer) {
+            *written += buffer;
+        }
+
+        void flush() {}
+    };
+
+    using exporter_type = csi::double_buffered_line_protocol_exporter<lp_metadata, gated_sink>;
+
+    std::size_t count_lines(const std::string &text) {
+        std::size_t lines = 0;
+        for (auto c : text) lines += c == '\n';
+        return lines;
+    }
+
+}
+
+TEST_SUITE("double_buffered_exporter") {
+    TEST_CASE("Buffers are written in order by the flusher thread") {
+        csi::instrument_factory<exporter_type> factory(128, 2);
+        auto requests = factory.make_atomic_monotonic_counter<uint64_t>({"requests"});
+        for (int i = 0; i < 1000; ++i) requests.add();
+        factory.exporter().flush();
+        auto &sink = factory.exporter().sink();
+        std::lock_guard lock{sink.mutex};
+        REQUIRE(count_lines(sink.written) == 1001 - factory.exporter().dropped());
+        REQUIRE(sink.written.find("requests value=0u ") == 0);
+        std::uint64_t previous = 0;
+        for (std::size_t line = sink.written.find('\n') + 1; line < sink.written.size();
+             line = sink.written.find('\n', line) + 1) {
+            auto value = std::stoull(sink.written.substr(line + std::string{"requests value="}.size()));
+            REQUIRE(value > previous);
+            previous = value;
+        }
+        REQUIRE(sink.flushes >= 1);
+        for (auto id : sink.writers) REQUIRE(id != std::this_thread::get_id());
+    }
+
+    TEST_CASE("Emits do not wait for a stalled sink") {
+        csi::instrument_factory<exporter_type> factory(256, 3);
+        auto &exporter = factory.exporter();
+        exporter.sink().set_open(false);
+        auto requests = factory.make_atomic_monotonic_counter<uint64_t>({"requests"});
+        for (int i = 0; i < 10000; ++i) requests.add();
+        REQUIRE(exporter.dropped() > 0);
+        exporter.sink().set_open(true);
+        exporter.flush();
+        std::lock_guard lock{exporter.sink().mutex};
+        REQUIRE(count_lines(exporter.sink().written) == 10001 - exporter.dropped());
+    }
+
+    TEST_CASE("Initial values are never dropped") {
+        csi::instrument_factory<exporter_type> factory(64, 2);
+        auto &exporter = factory.exporter();
+        exporter.sink().set_open(false);
+        auto first = factory.make_atomic_monotonic_counter<uint64_t>({"first"});
+        for (int i = 0; i < 1000; ++i) first.add();
+        auto second = factory.make_atomic_monotonic_counter<uint64_t>({"second"});
+        exporter.sink().set_open(true);
+        exporter.flush();
+        std::lock_guard lock{exporter.sink().mutex};
+        REQUIRE(exporter.sink().written.find("second value=0u ") != std::string::npos);
+    }
+
+    TEST_CASE("The destructor writes what is buffered") {
+        auto written = std::make_shared<std::string>();
+        {
+            csi::instrument_factory<csi::double_buffered_line_protocol_exporter<lp_metadata, shared_sink>> factory(
+                    1024, 2, written);
+            auto requests = factory.make_atomic_monotonic_counter<uint64_t>({"requests"});
+            requests.add();
+        }
+        REQUIRE(count_lines(*written) == 2);
+    }
+
+    TEST_CASE("Sink errors are rethrown by flush") {
+        csi::instrument_factory<exporter_type> factory(1024, 2);
+        factory.exporter().sink().fail = true;
+        auto requests = factory.make_atomic_monotonic_counter<uint64_t>({"requests"});
+        REQUIRE_THROWS_AS(factory.exporter().flush(), std::runtime_error);
+        REQUIRE_NOTHROW(factory.exporter().flush());
+    }
+
+    TEST_CASE("At least 2 buffers are needed") {
+        REQUIRE_THROWS_AS(exporter_type(1024, 1), std::invalid_argument);
+    }
+}
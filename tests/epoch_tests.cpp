@@ -0,0 +1,48 @@
+#include "simple_instruments/epoch.h"
+#include "doctest.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace csi = crosscode::simple_instruments;
+
+TEST_SUITE("epoch_domain") {
+    TEST_CASE("The epoch advances when no reader is pinned to the previous epoch") {
+        csi::epoch_domain domain;
+        auto tag = domain.epoch();
+        CHECK_FALSE(domain.reclaimable(tag));
+        {
+            auto guard = domain.pin();
+            CHECK(guard.epoch() == tag);
+            CHECK(domain.try_advance());
+            CHECK_FALSE(domain.try_advance());
+            CHECK_FALSE(domain.reclaimable(tag));
+        }
+        CHECK(domain.try_advance());
+        CHECK(domain.reclaimable(tag));
+    }
+
+    TEST_CASE("synchronize waits for pinned readers") {
+        csi::epoch_domain domain;
+        std::atomic<int> *shared = new std::atomic<int>{0};
+        std::atomic<std::atomic<int> *> current{shared};
+        std::atomic<bool> stop{false};
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 3; ++t) {
+            readers.emplace_back([&] {
+                while (!stop.load()) {
+                    auto guard = domain.pin();
+                    current.load()->fetch_add(1);
+                }
+            });
+        }
+        for (int i = 0; i < 200; ++i) {
+            auto old = current.exchange(new std::atomic<int>{0});
+            domain.synchronize();
+            delete old;
+        }
+        stop = true;
+        for (auto &r : readers) r.join();
+        delete current.load();
+    }
+}
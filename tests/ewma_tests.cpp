@@ -0,0 +1,67 @@
+#include "simple_instruments.h"
+#include "simple_instruments/ewma.h"
+#include "doctest.h"
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct ewma_metadata {
+        std::string name;
+    };
+
+    class ewma_exporter {
+    public:
+        using metadata_type = ewma_metadata;
+        std::vector<std::vector<double>> sent;
+
+        void emit_init(const csi::ewma_values &values, const metadata_type &) {
+            CHECK(values.averages.size() == values.half_lives.size());
+        }
+
+        void emit(const csi::ewma_values &values, const metadata_type &) {
+            sent.push_back(values.averages);
+        }
+    };
+
+}
+
+TEST_SUITE("atomic_ewma") {
+    TEST_CASE("Rates decay with their half-life") {
+        using namespace std::chrono_literals;
+        csi::instrument_factory<ewma_exporter> factory;
+        auto requests = factory.make_atomic_ewma<int>({"requests"}, csi::ewma_mode::rate, 10s, 60s);
+        auto now = csi::atomic_ewma<int, ewma_exporter>::clock::now();
+        for (int i = 0; i < 100; ++i) requests.mark();
+        requests.tick(now + 10s);
+        CHECK(requests.value(0) == doctest::Approx(10));
+        CHECK(requests.value(1) == doctest::Approx(10));
+        requests.tick(now + 20s);
+        CHECK(requests.value(0) == doctest::Approx(5));
+        CHECK(requests.value(1) == doctest::Approx(10 * std::exp2(-10.0 / 60)));
+        requests.mark(30);
+        requests.tick(now + 30s);
+        CHECK(requests.value(0) == doctest::Approx(4));
+        CHECK(factory.exporter().sent.size() == 3);
+        CHECK(factory.exporter().sent.back()[0] == requests.value(0));
+    }
+
+    TEST_CASE("Levels are sampled at every tick") {
+        using namespace std::chrono_literals;
+        csi::instrument_factory<ewma_exporter> factory;
+        auto load = factory.make_atomic_ewma<double>({"load"}, csi::ewma_mode::level);
+        auto now = csi::atomic_ewma<double, ewma_exporter>::clock::now();
+        load.set(2);
+        load.tick(now + 5s);
+        CHECK(load.value(0) == 2);
+        load.set(0);
+        load.tick(now + 65s);
+        CHECK(load.value(0) == doctest::Approx(1));
+        CHECK(load.value(1) == doctest::Approx(2 * std::exp2(-60.0 / 300)));
+        CHECK(load.value(2) == doctest::Approx(2 * std::exp2(-60.0 / 900)));
+    }
+}
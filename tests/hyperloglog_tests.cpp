@@ -0,0 +1,117 @@
+#include "simple_instruments.h"
+#include "simple_instruments/hyperloglog.h"
+#include "doctest.h"
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct hyperloglog_metadata {
+        std::string name;
+    };
+
+    class hyperloglog_exporter {
+    public:
+        using metadata_type = hyperloglog_metadata;
+        std::vector<double> sent;
+
+        void emit_init(const csi::hyperloglog_sketch &sketch, const metadata_type &) {
+            CHECK(sketch.estimate() == 0);
+        }
+
+        void emit(const csi::hyperloglog_sketch &sketch, const metadata_type &) {
+            sent.push_back(sketch.estimate());
+        }
+    };
+
+    std::vector<std::uint8_t> random_registers(std::size_t size, std::uint64_t seed) {
+        std::mt19937_64 random{seed};
+        std::uniform_int_distribution<int> rank{0, 50};
+        std::vector<std::uint8_t> registers(size);
+        for (auto &r : registers) r = static_cast<std::uint8_t>(rank(random));
+        return registers;
+    }
+
+}
+
+TEST_SUITE("hyperloglog_sketch") {
+    TEST_CASE("Estimates are within a few standard errors") {
+        for (std::uint64_t n : {10ull, 1000ull, 100000ull, 1000000ull}) {
+            csi::hyperloglog_sketch sketch;
+            for (std::uint64_t i = 0; i < n; ++i) {
+                sketch.add(i);
+                sketch.add(i);
+            }
+            CHECK(std::abs(sketch.estimate() - static_cast<double>(n)) <= 0.03 * static_cast<double>(n) + 1);
+        }
+    }
+
+    TEST_CASE("Merged sketches estimate the union") {
+        csi::hyperloglog_sketch a{12};
+        csi::hyperloglog_sketch b{12};
+        for (int i = 0; i < 60000; ++i) a.add("user" + std::to_string(i));
+        for (int i = 30000; i < 90000; ++i) b.add("user" + std::to_string(i));
+        a.merge(b);
+        CHECK(a.estimate() == doctest::Approx(90000).epsilon(0.05));
+        CHECK_THROWS_AS(a.merge(csi::hyperloglog_sketch{10}), std::invalid_argument);
+        csi::hyperloglog_sketch copy{12, a.registers()};
+        CHECK(copy.estimate() == a.estimate());
+        CHECK_THROWS_AS((csi::hyperloglog_sketch{10, a.registers()}), std::invalid_argument);
+    }
+
+    TEST_CASE("SIMD kernels match the scalar ones") {
+        for (std::size_t size : {std::size_t{7}, std::size_t{16}, std::size_t{1000}, std::size_t{1} << 14}) {
+            auto target = random_registers(size, 1);
+            auto expected = target;
+            auto source = random_registers(size, 2);
+            csi::detail::max_registers(target.data(), source.data(), size);
+            csi::detail::max_registers_scalar(expected.data(), source.data(), size);
+            CHECK(target == expected);
+            auto simd = csi::detail::sum_registers(target.data(), size);
+            auto scalar = csi::detail::sum_registers_scalar(target.data(), size);
+            CHECK(simd.zeros == scalar.zeros);
+            CHECK(simd.harmonic == doctest::Approx(scalar.harmonic).epsilon(1e-6));
+        }
+    }
+}
+
+TEST_SUITE("atomic_distinct_counter") {
+    TEST_CASE("Every interval sends its own sketch and empty intervals are not sent") {
+        csi::instrument_factory<hyperloglog_exporter> factory;
+        auto users = factory.make_atomic_distinct_counter({"users"});
+        for (int i = 0; i < 5000; ++i) users.add("user" + std::to_string(i % 1000));
+        CHECK(users.collect().estimate() == doctest::Approx(1000).epsilon(0.03));
+        users.collect();
+        users.add(std::uint64_t{42});
+        CHECK(users.collect().estimate() == doctest::Approx(1).epsilon(0.01));
+        REQUIRE(factory.exporter().sent.size() == 2);
+        CHECK(factory.exporter().sent[1] == users.last().estimate());
+    }
+
+    TEST_CASE("Concurrent adds give the same sketch as sequential adds") {
+        csi::instrument_factory<hyperloglog_exporter> factory;
+        auto ids = factory.make_atomic_distinct_counter({"ids"}, 10);
+        std::vector<std::thread> threads;
+        for (std::uint64_t t = 0; t < 4; ++t) {
+            threads.emplace_back([&ids, t] {
+                for (std::uint64_t i = 0; i < 20000; ++i) ids.add(t * 20000 + i);
+            });
+        }
+        for (auto &thread : threads) thread.join();
+        csi::hyperloglog_sketch expected{10};
+        for (std::uint64_t i = 0; i < 80000; ++i) expected.add(i);
+        CHECK(ids.collect().registers() == expected.registers());
+    }
+
+    TEST_CASE("The precision is checked") {
+        csi::instrument_factory<hyperloglog_exporter> factory;
+        CHECK_THROWS_AS(factory.make_atomic_distinct_counter({"ids"}, 3), std::invalid_argument);
+        CHECK_THROWS_AS(factory.make_atomic_distinct_counter({"ids"}, 19), std::invalid_argument);
+    }
+}
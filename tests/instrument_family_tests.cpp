@@ -0,0 +1,274 @@
+#include "simple_instruments.h"
+#include "simple_instruments/instrument_family.h"
+#include "doctest.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct family_metadata {
+        std::string name;
+    };
+
+    template <std::size_t N>
+    family_metadata with_labels(const family_metadata &md, const std::array<csi::label, N> &labels) {
+        auto result = md;
+        for (const auto &l : labels) {
+            result.name.append(",").append(l.name).append("=").append(l.value);
+        }
+        return result;
+    }
+
+    class family_exporter {
+    public:
+        using metadata_type = family_metadata;
+        std::stringstream ss;
+
+        template <typename Tvalue>
+        void emit_init(const Tvalue &, const metadata_type &md) {
+            ss << md.name << " created\n";
+        }
+
+        template <typename Tvalue>
+        void emit(const Tvalue &value, const metadata_type &md) {
+            ss << md.name << " " << value << "\n";
+        }
+    };
+
+    class releasing_exporter {
+    public:
+        using metadata_type = family_metadata;
+        using handle_type = std::string;
+        std::vector<std::string> released;
+
+        template <typename Tvalue>
+        handle_type emit_init(const Tvalue &, const metadata_type &md) { return md.name; }
+
+        template <typename Tvalue>
+        void emit(const Tvalue &, const metadata_type &, const handle_type &) {}
+
+        void release(const handle_type &handle, const metadata_type &) { released.push_back(handle); }
+    };
+
+    class null_exporter {
+    public:
+        using metadata_type = family_metadata;
+
+        template <typename Tvalue>
+        void emit_init(const Tvalue &, const metadata_type &) {}
+
+        template <typename Tvalue>
+        void emit(const Tvalue &, const metadata_type &) {}
+    };
+
+}
+
+TEST_SUITE("instrument_family") {
+    TEST_CASE("Children are created lazily per label set") {
+        csi::instrument_factory<family_exporter> factory;
+        auto requests = factory.make_atomic_monotonic_counter_family<uint64_t>({"requests"}, {"endpoint", "status"});
+        CHECK(requests.size() == 0);
+        requests.with("/items", "200").add();
+        requests.with("/items", "200").add();
+        requests.with("/items", "500").add();
+        CHECK(requests.size() == 2);
+        CHECK(requests.with("/items", "200").value() == 2);
+        CHECK(factory.exporter().ss.str() == "requests,endpoint=/items,status=200 created\n"
+                                             "requests,endpoint=/items,status=200 1\n"
+                                             "requests,endpoint=/items,status=200 2\n"
+                                             "requests,endpoint=/items,status=500 created\n"
+                                             "requests,endpoint=/items,status=500 1\n");
+        SUBCASE("The same label set always returns the same child") {
+            std::string endpoint = "/items";
+            CHECK(&requests.with(endpoint, std::string{"500"}) == &requests.with("/items", "500"));
+        }
+        SUBCASE("Label values are not confused across labels") {
+            CHECK(&requests.with("/items2", "00") != &requests.with("/items", "200"));
+        }
+        SUBCASE("for_each visits every child") {
+            std::map<std::string, uint64_t> values;
+            requests.for_each([&values](const auto &labels, auto &counter) {
+                values[std::string{labels[1]}] = counter.value();
+            });
+            CHECK(values == std::map<std::string, uint64_t>{{"200", 2}, {"500", 1}});
+        }
+    }
+
+    TEST_CASE("Families can be created for all instrument types") {
+        csi::instrument_factory<family_exporter> factory;
+        auto active = factory.make_atomic_bidirectional_counter_family<int>({"active"}, {"pool"}, 10);
+        auto size = factory.make_atomic_value_recorder_family<double>({"size"}, {"queue"});
+        active.with("db").sub();
+        size.with("input").set(2.5);
+        CHECK(active.with("db").value() == 9);
+        CHECK(size.with("input").value() == 2.5);
+    }
+
+    TEST_CASE("Label combinations beyond the maximum number of series are folded into an overflow series") {
+        csi::instrument_factory<family_exporter> factory;
+        auto requests = factory.make_atomic_monotonic_counter_family<uint64_t>({"requests"}, {"user"}, 0, 2);
+        requests.with("a").add();
+        requests.with("b").add();
+        requests.with("c").add();
+        requests.with("d").add();
+        requests.with("c").add();
+        CHECK(requests.size() == 2);
+        CHECK(requests.rejected() == 3);
+        CHECK(factory.series().rejected() == 3);
+        CHECK(requests.overflow().value() == 3);
+        CHECK(&requests.with("e") == &requests.overflow());
+        CHECK(factory.exporter().ss.str().find("requests,user=__overflow__ 3\n") != std::string::npos);
+    }
+
+    TEST_CASE("The table grows with the children, also without a maximum number of series") {
+        csi::instrument_factory<null_exporter> factory;
+        for (auto max_series : {std::size_t{5000}, std::numeric_limits<std::size_t>::max()}) {
+            auto requests = factory.make_atomic_monotonic_counter_family<uint64_t>({"requests"}, {"user"}, 0,
+                                                                                   max_series);
+            for (int i = 0; i < 5000; ++i) requests.with(std::to_string(i)).add();
+            CHECK(requests.size() == 5000);
+            CHECK(requests.rejected() == 0);
+            bool found = true;
+            for (int i = 0; i < 5000; ++i) found = found && requests.with(std::to_string(i)).value() == 1;
+            CHECK(found);
+            CHECK(requests.expire_idle(0) == 5000);
+            CHECK(requests.size() == 0);
+        }
+    }
+
+    TEST_CASE("Label values equal to the overflow label value are the overflow child") {
+        csi::instrument_factory<family_exporter> factory;
+        auto requests = factory.make_atomic_monotonic_counter_family<uint64_t>({"requests"}, {"user", "status"}, 0, 2);
+        requests.with("__overflow__", "__overflow__").add();
+        requests.with("__overflow__", "200").add();
+        requests.with("a", "200").add();
+        requests.with("b", "200").add();
+        CHECK(requests.size() == 2);
+        CHECK(requests.rejected() == 1);
+        CHECK(&requests.with("__overflow__", "__overflow__") == &requests.overflow());
+        CHECK(requests.rejected() == 1);
+        CHECK(requests.with("__overflow__", "200").value() == 1);
+        CHECK(requests.overflow().value() == 2);
+        CHECK(requests.expire_idle(0) == 2);
+        CHECK(requests.size() == 0);
+        CHECK(requests.overflow().value() == 2);
+        std::size_t exported = 0;
+        requests.for_each([&exported](const auto &values, auto &) {
+            if (values[0] == "__overflow__" && values[1] == "__overflow__") ++exported;
+        });
+        CHECK(exported == 1);
+    }
+
+    TEST_CASE("The factory limits the number of series of all families together") {
+        csi::instrument_factory<family_exporter> factory;
+        factory.series().max(3);
+        auto requests = factory.make_atomic_monotonic_counter_family<uint64_t>({"requests"}, {"user"});
+        {
+            auto errors = factory.make_atomic_monotonic_counter_family<uint64_t>({"errors"}, {"user"});
+            requests.with("a");
+            requests.with("b");
+            errors.with("a");
+            errors.with("b").add();
+            CHECK(errors.size() == 1);
+            CHECK(errors.rejected() == 1);
+            CHECK(factory.series().used() == 3);
+        }
+        SUBCASE("Destroying a family returns its series to the factory") {
+            CHECK(factory.series().used() == 2);
+            requests.with("c");
+            CHECK(requests.size() == 3);
+            CHECK(requests.rejected() == 0);
+        }
+    }
+
+    TEST_CASE("Children can be created and used concurrently") {
+        csi::instrument_factory<null_exporter> factory;
+        auto requests = factory.make_atomic_monotonic_counter_family<uint64_t>({"requests"}, {"thread", "key"});
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&requests] {
+                for (int i = 0; i < 10000; ++i) {
+                    requests.with("shared", std::to_string(i % 100)).add();
+                }
+            });
+        }
+        for (auto &t : threads) t.join();
+        CHECK(requests.size() == 100);
+        uint64_t total = 0;
+        requests.for_each([&total](const auto &, auto &counter) { total += counter.value(); });
+        CHECK(total == 40000);
+    }
+
+    TEST_CASE("Idle children are expired") {
+        csi::instrument_factory<releasing_exporter> factory;
+        factory.series().max(3);
+        auto connections = factory.make_atomic_monotonic_counter_family<uint64_t>({"bytes"}, {"connection"});
+        connections.with("1").add();
+        connections.with("2").add();
+        CHECK(connections.expire_idle(1) == 0);
+        connections.with("1").add();
+        CHECK(connections.expire_idle(1) == 1);
+        CHECK(connections.size() == 1);
+        CHECK(factory.series().used() == 1);
+        connections.with("3");
+        connections.with("4");
+        CHECK(connections.rejected() == 0);
+        SUBCASE("Expired children are released once no thread can use them") {
+            for (int i = 0; i < 4; ++i) connections.expire_idle(1);
+            CHECK(connections.size() == 0);
+            auto released = factory.exporter().released;
+            std::sort(released.begin(), released.end());
+            CHECK(released == std::vector<std::string>{"bytes,connection=1", "bytes,connection=2",
+                                                       "bytes,connection=3", "bytes,connection=4"});
+        }
+        SUBCASE("An expired label set gets a new child") {
+            connections.expire_idle(0);
+            CHECK(connections.size() == 0);
+            CHECK(connections.with("1").value() == 0);
+        }
+    }
+
+    TEST_CASE("The overflow child is never expired") {
+        csi::instrument_factory<family_exporter> factory;
+        auto requests = factory.make_atomic_monotonic_counter_family<uint64_t>({"requests"}, {"user"}, 0, 1);
+        requests.with("a").add();
+        requests.with("b").add();
+        CHECK(requests.expire_idle(0) == 1);
+        CHECK(requests.overflow().value() == 1);
+        requests.with("c").add();
+        CHECK(requests.rejected() == 1);
+    }
+
+    TEST_CASE("Children can be expired while they are used concurrently") {
+        csi::instrument_factory<null_exporter> factory;
+        auto connections = factory.make_atomic_monotonic_counter_family<uint64_t>({"bytes"}, {"connection"}, 0, 64);
+        std::atomic<bool> stop{false};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&connections, &stop, t] {
+                for (int i = 0; !stop.load(); ++i) {
+                    auto guard = connections.pin();
+                    connections.with(std::to_string(t * 1000 + i % 100)).add();
+                }
+            });
+        }
+        for (int i = 0; i < 1000; ++i) {
+            connections.expire_idle(1);
+            std::this_thread::yield();
+        }
+        stop = true;
+        for (auto &t : threads) t.join();
+        connections.expire_idle(0);
+        CHECK(connections.size() == 0);
+        CHECK(factory.series().used() == 0);
+    }
+}
@@ -0,0 +1,81 @@
+#include "simple_instruments.h"
+#include "simple_instruments/instrument_group.h"
+#include "doctest.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct group_metadata {
+        std::string name;
+    };
+
+    class group_exporter {
+    public:
+        using metadata_type = group_metadata;
+        std::vector<std::vector<std::int64_t>> sent;
+
+        void emit_init(const csi::instrument_group_snapshot &snapshot, const metadata_type &) {
+            sent.push_back(snapshot.values);
+        }
+
+        void emit(const csi::instrument_group_snapshot &snapshot, const metadata_type &) {
+            sent.push_back(snapshot.values);
+        }
+    };
+
+    constexpr std::size_t requests = 0;
+    constexpr std::size_t errors = 1;
+
+}
+
+TEST_SUITE("atomic_instrument_group") {
+    TEST_CASE("Snapshots hold the totals of all updates") {
+        csi::instrument_factory<group_exporter> factory;
+        auto http = factory.make_atomic_instrument_group({"http"}, 2);
+        {
+            auto update = http.begin_update();
+            update.add(requests);
+            update.add(errors);
+        }
+        http.add(requests, 3);
+        CHECK(http.collect().values == std::vector<std::int64_t>{4, 1});
+        http.collect();
+        http.sub(errors);
+        CHECK(http.collect().values == std::vector<std::int64_t>{4, 0});
+        CHECK(factory.exporter().sent == std::vector<std::vector<std::int64_t>>{{0, 0}, {4, 1}, {4, 0}});
+    }
+
+    TEST_CASE("Counters changed in one update are never torn") {
+        csi::instrument_factory<group_exporter> factory;
+        auto http = factory.make_atomic_instrument_group({"http"}, 2);
+        std::atomic<bool> stop{false};
+        std::vector<std::thread> writers;
+        for (int t = 0; t < 4; ++t) {
+            writers.emplace_back([&] {
+                while (!stop.load()) {
+                    auto update = http.begin_update();
+                    update.add(requests);
+                    std::this_thread::yield();
+                    update.add(errors);
+                }
+            });
+        }
+        bool consistent = true;
+        for (int i = 0; i < 500 || http.last().values[requests] < 1000; ++i) {
+            auto &values = http.collect().values;
+            consistent = consistent && values[requests] == values[errors];
+        }
+        stop.store(true);
+        for (auto &writer : writers) writer.join();
+        auto &values = http.collect().values;
+        CHECK(consistent);
+        CHECK(values[requests] == values[errors]);
+        CHECK(values[requests] > 0);
+    }
+}
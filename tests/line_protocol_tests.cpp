@@ -0,0 +1,102 @@
+#include "simple_instruments.h"
+#include "simple_instruments/line_protocol.h"
+#include "doctest.h"
+#include <string>
+#include <vector>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct lp_metadata {
+        std::string series;
+    };
+
+    const std::string &unique_identifier(const lp_metadata &md) {
+        return md.series;
+    }
+
+    struct memory_sink {
+        std::vector<std::string> buffers;
+        int flushes{0};
+
+        void write(std::string &&buffer) {
+            buffers.push_back(std::move(buffer));
+        }
+
+        void flush() {
+            ++flushes;
+        }
+    };
+
+    std::string strip_timestamps(const std::string &lines) {
+        std::string result;
+        std::size_t begin = 0;
+        while (begin < lines.size()) {
+            auto end = lines.find('\n', begin);
+            auto line = lines.substr(begin, end - begin);
+            result += line.substr(0, line.rfind(' ')) + "\n";
+            begin = end + 1;
+        }
+        return result;
+    }
+
+}
+
+TEST_SUITE("line_protocol") {
+    TEST_CASE("Values are formatted as line protocol field values") {
+        std::string out;
+        SUBCASE("Signed integers get an i suffix") {
+            csi::append_line_protocol(out, "cpu,host=a", int16_t{-12}, 1000);
+            REQUIRE(out == "cpu,host=a value=-12i 1000\n");
+        }
+        SUBCASE("Unsigned integers get an u suffix") {
+            csi::append_line_protocol(out, "requests", uint64_t{18446744073709551615u}, 1);
+            REQUIRE(out == "requests value=18446744073709551615u 1\n");
+        }
+        SUBCASE("Floating point values have no suffix") {
+            csi::append_line_protocol(out, "latency", 0.25, 2);
+            REQUIRE(out == "latency value=0.25 2\n");
+        }
+        SUBCASE("Booleans are written as true or false") {
+            csi::append_line_protocol(out, "up", true, 3);
+            REQUIRE(out == "up value=true 3\n");
+        }
+        SUBCASE("Quantile sketches are written as summary fields") {
+            csi::quantile_sketch sketch;
+            csi::append_line_protocol(out, "latency", sketch, 4);
+            REQUIRE(out == "latency count=0u 4\n");
+            out.clear();
+            sketch.add(2);
+            csi::append_line_protocol(out, "latency", sketch, 5);
+            REQUIRE(out == "latency count=1u,sum=2,min=2,max=2,p50=2,p90=2,p99=2 5\n");
+        }
+    }
+
+    TEST_CASE("Can export instruments as line protocol") {
+        using exporter_type = csi::line_protocol_exporter<lp_metadata, memory_sink>;
+        csi::instrument_factory<exporter_type> factory(256);
+        auto requests = factory.make_atomic_monotonic_counter<uint32_t>({"requests,host=a"});
+        auto latency = factory.make_atomic_value_recorder_counter<double>({"latency,host=a"});
+        requests.add();
+        latency.set(1.5);
+        SUBCASE("Nothing is written before the buffer is full") {
+            REQUIRE(factory.exporter().sink().buffers.empty());
+        }
+        SUBCASE("Flush writes the buffer") {
+            factory.exporter().flush();
+            auto &sink = factory.exporter().sink();
+            REQUIRE(sink.buffers.size() == 1);
+            CHECK(sink.flushes == 1);
+            CHECK(strip_timestamps(sink.buffers[0]) ==
+                  "requests,host=a value=0u\nlatency,host=a value=0\nrequests,host=a value=1u\nlatency,host=a value=1.5\n");
+        }
+        SUBCASE("A full buffer is handed to the sink") {
+            for (int i = 0; i < 4; ++i) requests.add();
+            auto &sink = factory.exporter().sink();
+            REQUIRE(sink.buffers.size() == 1);
+            CHECK(sink.buffers[0].size() >= 256);
+            CHECK(sink.flushes == 0);
+        }
+    }
+}
@@ -0,0 +1,65 @@
+#include "simple_instruments/number_format.h"
+#include "doctest.h"
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <string>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    template <typename Tvalue>
+    std::string formatted(Tvalue value) {
+        char buffer[csi::max_number_chars];
+        return std::string(buffer, csi::format_number(buffer, value));
+    }
+
+    template <typename Tvalue>
+    std::string expected(Tvalue value) {
+        char buffer[64];
+        return std::string(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+    }
+
+}
+
+TEST_SUITE("number_format") {
+    TEST_CASE("Integers are written like std::to_chars") {
+        CHECK(formatted(std::uint64_t{0}) == "0");
+        CHECK(formatted(std::int16_t{-12}) == "-12");
+        CHECK(formatted(std::numeric_limits<std::uint64_t>::max()) == "18446744073709551615");
+        CHECK(formatted(std::numeric_limits<std::int64_t>::min()) == "-9223372036854775808");
+        std::uint64_t power = 1;
+        for (int i = 0; i < 20; ++i, power *= 10) {
+            for (auto value : {power - 1, power, power + 1}) {
+                CHECK(formatted(value) == expected(value));
+                CHECK(formatted(-static_cast<std::int64_t>(value)) == expected(-static_cast<std::int64_t>(value)));
+            }
+        }
+        std::mt19937_64 random{7};
+        for (int i = 0; i < 100000; ++i) {
+            auto value = random() >> (random() % 64);
+            REQUIRE(formatted(value) == expected(value));
+        }
+    }
+
+    TEST_CASE("Floating point values are written like std::to_chars") {
+        for (double value : {0.0, -0.0, 0.25, 1.5, 3.0, -3.0, 1e5, 1e6, 1.5e6, 123e5, 1e15, 1e16, 9007199254740992.0,
+                             1e21, 1e-7, 1e300, std::numeric_limits<double>::infinity()}) {
+            CHECK(formatted(value) == expected(value));
+        }
+        CHECK(formatted(0.1f) == "0.1");
+        std::mt19937_64 random{11};
+        for (int i = 0; i < 100000; ++i) {
+            auto whole = static_cast<double>(static_cast<std::int64_t>(random() >> (random() % 64)));
+            auto scaled = whole * std::pow(10.0, static_cast<int>(random() % 20));
+            auto fraction = std::ldexp(static_cast<double>(random() >> 11), static_cast<int>(random() % 200) - 100);
+            REQUIRE(formatted(whole) == expected(whole));
+            REQUIRE(formatted(scaled) == expected(scaled));
+            REQUIRE(formatted(fraction) == expected(fraction));
+            REQUIRE(formatted(static_cast<float>(whole)) == expected(static_cast<float>(whole)));
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#include "simple_instruments.h"
+#include "simple_instruments/percpu_counter.h"
+#include "doctest.h"
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct percpu_metadata {
+        std::string name;
+    };
+
+    class percpu_exporter {
+    public:
+        using metadata_type = percpu_metadata;
+        std::vector<std::int64_t> sent;
+
+        void emit_init(std::int64_t value, const metadata_type &) {
+            sent.push_back(value);
+        }
+
+        void emit(std::int64_t value, const metadata_type &) {
+            sent.push_back(value);
+        }
+    };
+
+}
+
+TEST_SUITE("atomic_percpu_counter") {
+    TEST_CASE("Adds and subtracts like a bidirectional counter") {
+        csi::instrument_factory<percpu_exporter> factory;
+        auto connections = factory.make_atomic_percpu_counter({"connections"}, 10);
+        connections.add();
+        connections.add(5);
+        connections.sub(2);
+        CHECK(connections.value() == 14);
+        CHECK(connections.collect() == 14);
+        CHECK(connections.collect() == 14);
+        connections.sub(20);
+        CHECK(connections.collect() == -6);
+        CHECK(factory.exporter().sent == std::vector<std::int64_t>{10, 14, -6});
+    }
+
+    TEST_CASE("Concurrent adds are all counted") {
+        csi::instrument_factory<percpu_exporter> factory;
+        auto requests = factory.make_atomic_percpu_counter({"requests"});
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 8; ++t) {
+            threads.emplace_back([&requests] {
+                for (int i = 0; i < 100000; ++i) requests.add();
+                for (int i = 0; i < 1000; ++i) requests.sub();
+            });
+        }
+        for (auto &thread : threads) thread.join();
+        CHECK(requests.collect() == 8 * 99000);
+    }
+
+    TEST_CASE("Every thread reports the same backend") {
+        bool main_thread = csi::atomic_percpu_counter<percpu_exporter>::uses_rseq();
+        bool other_thread = !main_thread;
+        std::thread{[&other_thread] { other_thread = csi::atomic_percpu_counter<percpu_exporter>::uses_rseq(); }}.join();
+        CHECK(main_thread == other_thread);
+    }
+}
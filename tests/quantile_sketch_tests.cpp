@@ -0,0 +1,144 @@
+#include "simple_instruments.h"
+#include "simple_instruments/quantile_sketch.h"
+#include "doctest.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct sketch_metadata {
+        std::string name;
+    };
+
+    class sketch_exporter {
+    public:
+        using metadata_type = sketch_metadata;
+        std::vector<double> p99s;
+
+        void emit_init(const csi::quantile_sketch &, const metadata_type &) {}
+
+        void emit(const csi::quantile_sketch &sketch, const metadata_type &) {
+            p99s.push_back(sketch.quantile(0.99));
+        }
+    };
+
+    double exact_quantile(std::vector<double> values, double q) {
+        std::sort(values.begin(), values.end());
+        return values[static_cast<std::size_t>(q * static_cast<double>(values.size() - 1))];
+    }
+
+}
+
+TEST_SUITE("quantile_sketch") {
+    TEST_CASE("Quantiles are within the relative accuracy") {
+        std::mt19937_64 random{42};
+        std::lognormal_distribution<double> latency{-7, 1.5};
+        csi::quantile_sketch sketch{0.01};
+        std::vector<double> values;
+        for (int i = 0; i < 100000; ++i) {
+            values.push_back(latency(random));
+            sketch.add(values.back());
+        }
+        for (double q : {0.0, 0.5, 0.9, 0.99, 0.999, 1.0}) {
+            auto exact = exact_quantile(values, q);
+            CHECK(std::abs(sketch.quantile(q) - exact) <= exact * 0.01 + 1e-15);
+        }
+        CHECK(sketch.count() == 100000);
+        CHECK(sketch.min() == *std::min_element(values.begin(), values.end()));
+    }
+
+    TEST_CASE("Sketches merge and count zero") {
+        csi::quantile_sketch first;
+        csi::quantile_sketch second;
+        for (int i = 1; i <= 50; ++i) first.add(i);
+        for (int i = 51; i <= 100; ++i) second.add(i);
+        second.add(0, 10);
+        first.merge(second);
+        CHECK(first.count() == 110);
+        CHECK(first.quantile(0) == 0);
+        CHECK(first.quantile(1) == 100);
+        CHECK(first.quantile(0.5) == doctest::Approx(45).epsilon(0.01));
+        CHECK_THROWS_AS(first.merge(csi::quantile_sketch{0.02}), std::invalid_argument);
+    }
+
+    TEST_CASE("Quantiles of a sketch without a summary are the bucket values") {
+        csi::quantile_sketch reference;
+        csi::quantile_sketch sketch;
+        reference.add(100);
+        sketch.add_bucket(sketch.bucket(100), 1);
+        sketch.add_zero(1);
+        CHECK(sketch.quantile(0) == 0);
+        CHECK(sketch.quantile(1) == reference.bucket_value(reference.bucket(100)));
+    }
+
+    TEST_CASE("The recorder merges the shards of all threads per interval") {
+        csi::instrument_factory<sketch_exporter> factory;
+        auto latency = factory.make_atomic_quantile_recorder<double>({"latency"});
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&latency] {
+                for (int i = 1; i <= 1000; ++i) latency.record(i);
+            });
+        }
+        for (auto &t : threads) t.join();
+        auto &sketch = latency.collect();
+        CHECK(sketch.count() == 4000);
+        CHECK(sketch.max() == 1000);
+        CHECK(sketch.quantile(0.99) == doctest::Approx(990).epsilon(0.01));
+        latency.collect();
+        latency.record(5);
+        latency.collect();
+        REQUIRE(factory.exporter().p99s.size() == 2);
+        CHECK(factory.exporter().p99s[1] == 5);
+    }
+
+    TEST_CASE("The recorder merges sketches recorded elsewhere into the interval") {
+        csi::instrument_factory<sketch_exporter> factory;
+        auto latency = factory.make_atomic_quantile_recorder<double>({"latency"});
+        csi::quantile_sketch elsewhere;
+        for (int i = 1; i <= 100; ++i) elsewhere.add(i);
+        elsewhere.add(0);
+        latency.record(1000);
+        latency.merge(elsewhere);
+        auto &sketch = latency.collect();
+        CHECK(sketch.count() == 102);
+        CHECK(sketch.zero_count() == 1);
+        CHECK(sketch.min() == 0);
+        CHECK(sketch.max() == 1000);
+        CHECK(sketch.sum() == 6050);
+        CHECK_THROWS_AS(latency.merge(csi::quantile_sketch{0.02}), std::invalid_argument);
+    }
+
+    TEST_CASE("Sketches collected while values are recorded are consistent") {
+        csi::instrument_factory<sketch_exporter> factory;
+        auto latency = factory.make_atomic_quantile_recorder<int>({"latency"});
+        std::atomic<bool> stop{false};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&latency, &stop, t] {
+                for (int i = 0; !stop.load(std::memory_order_relaxed); ++i) latency.record(t * 1000 + i % 1000 + 1);
+            });
+        }
+        std::uint64_t intervals = 0;
+        bool consistent = true;
+        while (intervals < 100) {
+            auto &sketch = latency.collect();
+            if (sketch.count() == 0) continue;
+            ++intervals;
+            consistent = consistent && sketch.min() <= sketch.max() && sketch.min() >= 1 && sketch.max() <= 4000 &&
+                         sketch.quantile(0.5) >= sketch.min() && sketch.quantile(0.5) <= sketch.max() &&
+                         sketch.sum() >= sketch.min() * static_cast<double>(sketch.count());
+        }
+        stop = true;
+        for (auto &t : threads) t.join();
+        CHECK(consistent);
+    }
+}
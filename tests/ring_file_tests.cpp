@@ -0,0 +1,151 @@
+#include "simple_instruments.h"
+#include "simple_instruments/ring_file.h"
+#include "doctest.h"
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct ring_metadata {
+        std::string name;
+    };
+
+    const std::string &unique_identifier(const ring_metadata &md) {
+        return md.name;
+    }
+
+    std::string temporary_path(const std::string &name) {
+        auto path = (std::filesystem::temp_directory_path() / name).string();
+        std::remove(path.c_str());
+        return path;
+    }
+
+    std::vector<csi::ring_file_entry> read_all(const csi::ring_file &ring) {
+        std::vector<csi::ring_file_entry> entries;
+        csi::ring_file_entry entry;
+        for (auto sequence = ring.head(); sequence < ring.tail(); ++sequence) {
+            if (ring.read(sequence, entry) == csi::ring_file_read_status::ok) entries.push_back(entry);
+        }
+        return entries;
+    }
+
+    std::int64_t as_int(const csi::encoded_value &value) {
+        return value.visit([](auto v) { return static_cast<std::int64_t>(v); });
+    }
+
+}
+
+TEST_SUITE("ring_file") {
+    TEST_CASE("Can record instruments into a ring file") {
+        auto path = temporary_path("simple_instruments_ring_file_test.ring");
+        {
+            csi::instrument_factory<csi::ring_file_exporter<ring_metadata>> factory(path, 16);
+            auto counter = factory.make_atomic_bidirectional_counter<int16_t>({"requests"});
+            auto recorder = factory.make_atomic_value_recorder_counter<double>({"latency"});
+            counter.add();
+            counter.sub(3);
+            recorder.set(1.5);
+            SUBCASE("Records are readable from another mapping") {
+                auto reader = csi::ring_file::open_read_only(path);
+                auto entries = read_all(reader);
+                REQUIRE(entries.size() == 5);
+                CHECK(entries[0].name == "requests");
+                CHECK(entries[1].name == "latency");
+                CHECK(as_int(entries[2].value) == 1);
+                CHECK(entries[3].value.kind == csi::value_kind::signed_integer);
+                CHECK(as_int(entries[3].value) == -2);
+                CHECK(entries[4].value.kind == csi::value_kind::floating_point);
+                CHECK(entries[4].value.visit([](auto v) { return static_cast<double>(v); }) == 1.5);
+                CHECK(entries[4].timestamp >= entries[0].timestamp);
+            }
+        }
+        SUBCASE("Reopening the ring file with the same capacity resumes after the last record") {
+            auto ring = csi::ring_file::create(path, 16);
+            CHECK(ring.tail() == 5);
+        }
+        SUBCASE("Reopening the ring file with another capacity starts a new ring") {
+            auto ring = csi::ring_file::create(path, 32);
+            CHECK(ring.tail() == 0);
+        }
+        std::remove(path.c_str());
+    }
+
+    TEST_CASE("Ring file keeps the last capacity records") {
+        auto path = temporary_path("simple_instruments_ring_file_wrap_test.ring");
+        auto ring = csi::ring_file::create(path, 4);
+        for (std::uint64_t i = 0; i < 10; ++i) {
+            ring.append("wrap", csi::encode_value(i), 0);
+        }
+        auto entries = read_all(ring);
+        REQUIRE(entries.size() == 4);
+        CHECK(entries.front().sequence == 6);
+        CHECK(as_int(entries.front().value) == 6);
+        CHECK(as_int(entries.back().value) == 9);
+        csi::ring_file_entry entry;
+        CHECK(ring.read(2, entry) == csi::ring_file_read_status::overwritten);
+        CHECK(ring.read(10, entry) == csi::ring_file_read_status::pending);
+        std::remove(path.c_str());
+    }
+
+    TEST_CASE("A ring file needs room for at least one record") {
+        auto path = temporary_path("simple_instruments_ring_file_empty_test.ring");
+        CHECK_THROWS_AS(csi::ring_file::create(path, 0), std::invalid_argument);
+        CHECK_THROWS_AS(csi::ring_file::create(path, std::numeric_limits<std::uint64_t>::max()), std::invalid_argument);
+        std::remove(path.c_str());
+    }
+
+    TEST_CASE("Long names are truncated") {
+        auto path = temporary_path("simple_instruments_ring_file_name_test.ring");
+        auto ring = csi::ring_file::create(path, 4);
+        ring.append(std::string(200, 'x'), csi::encode_value(1), 0);
+        csi::ring_file_entry entry;
+        REQUIRE(ring.read(0, entry) == csi::ring_file_read_status::ok);
+        CHECK(entry.name.size() == csi::ring_file_record::max_name_size);
+        std::remove(path.c_str());
+    }
+
+    TEST_CASE("Records that were never committed do not hide the records after them") {
+        auto path = temporary_path("simple_instruments_ring_file_pending_test.ring");
+        auto ring = csi::ring_file::create(path, 8);
+        ring.append("before", csi::encode_value(1), 0);
+        {
+            // Reserves a record without committing it, as a writer that crashes while appending does.
+            csi::detail::file_descriptor fd{::open(path.c_str(), O_RDWR)};
+            csi::detail::mapped_region region{fd.get(), sizeof(csi::ring_file_header), true};
+            static_cast<csi::ring_file_header *>(region.data())->tail.fetch_add(1);
+        }
+        ring.append("after", csi::encode_value(2), 0);
+        ring.append("after", csi::encode_value(3), 0);
+        std::vector<std::int64_t> values;
+        std::vector<std::uint64_t> skipped;
+        auto on_entry = [&values](const csi::ring_file_entry &entry) { values.push_back(as_int(entry.value)); };
+        auto on_skipped = [&skipped](std::uint64_t sequence) { skipped.push_back(sequence); };
+        SUBCASE("A dump skips them immediately") {
+            csi::ring_file_cursor cursor{ring, std::chrono::steady_clock::duration::zero()};
+            cursor.poll(on_entry, on_skipped);
+            CHECK(values == std::vector<std::int64_t>{1, 2, 3});
+            CHECK(skipped == std::vector<std::uint64_t>{1});
+            CHECK(cursor.position() == 4);
+        }
+        SUBCASE("Following waits for them, then skips them") {
+            csi::ring_file_cursor cursor{ring, std::chrono::milliseconds(20)};
+            cursor.poll(on_entry, on_skipped);
+            CHECK(values == std::vector<std::int64_t>{1});
+            CHECK(skipped.empty());
+            std::this_thread::sleep_for(std::chrono::milliseconds(30));
+            cursor.poll(on_entry, on_skipped);
+            CHECK(values == std::vector<std::int64_t>{1, 2, 3});
+            CHECK(skipped == std::vector<std::uint64_t>{1});
+        }
+        std::remove(path.c_str());
+    }
+}
@@ -0,0 +1,97 @@
+#include "simple_instruments.h"
+#include "simple_instruments/routing_exporter.h"
+#include "doctest.h"
+#include <memory>
+#include <sstream>
+#include <string>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    enum class destination {
+        debug,
+        business,
+        nowhere
+    };
+
+    struct routed_metadata {
+        std::string name;
+        destination to{destination::business};
+    };
+
+    struct destination_router {
+        int calls{0};
+
+        std::size_t operator()(const routed_metadata &md) {
+            ++calls;
+            return static_cast<std::size_t>(md.to);
+        }
+    };
+
+    class stream_exporter {
+    public:
+        using metadata_type = routed_metadata;
+        std::stringstream ss;
+
+        template <typename Tvalue>
+        void emit_init(const Tvalue &value, const metadata_type &md) {
+            ss << md.name << " init " << value << "\n";
+        }
+
+        template <typename Tvalue>
+        void emit(const Tvalue &value, const metadata_type &md) {
+            ss << md.name << " " << value << "\n";
+        }
+    };
+
+    class counting_handle_exporter {
+    public:
+        using metadata_type = routed_metadata;
+        using handle_type = int *;
+        int count{0};
+        int released{0};
+
+        template <typename Tvalue>
+        handle_type emit_init(const Tvalue &, const metadata_type &) {
+            return &count;
+        }
+
+        template <typename Tvalue>
+        void emit(const Tvalue &, const metadata_type &, const handle_type &handle) {
+            ++*handle;
+        }
+
+        void release(const handle_type &, const metadata_type &) {
+            ++released;
+        }
+    };
+
+}
+
+TEST_SUITE("routing_exporter") {
+    TEST_CASE("Instruments are routed once by their metadata") {
+        auto debug = std::make_shared<stream_exporter>();
+        auto business = std::make_shared<counting_handle_exporter>();
+        using exporter_type = csi::routing_exporter<destination_router, stream_exporter, counting_handle_exporter>;
+        csi::instrument_factory<exporter_type> factory(destination_router{}, debug, business);
+        {
+            auto queue_depth = factory.make_atomic_value_recorder_counter<int>({"queue_depth", destination::debug});
+            auto orders = factory.make_atomic_monotonic_counter<uint64_t>({"orders"});
+            auto ignored = factory.make_atomic_monotonic_counter<uint64_t>({"ignored", destination::nowhere});
+            queue_depth.set(4);
+            orders.add();
+            orders.add();
+            ignored.add();
+            SUBCASE("Each exporter only receives its own instruments") {
+                CHECK(debug->ss.str() == "queue_depth init 0\nqueue_depth 4\n");
+                CHECK(business->count == 2);
+            }
+            SUBCASE("The router is only called when instruments are created") {
+                CHECK(factory.exporter().router().calls == 3);
+                CHECK(&factory.exporter().exporter<0>() == debug.get());
+            }
+        }
+        CHECK(business->released == 1);
+    }
+}
@@ -0,0 +1,137 @@
+#include "simple_instruments.h"
+#include "simple_instruments/double_buffered_exporter.h"
+#include "simple_instruments/line_protocol.h"
+#include "simple_instruments/queued_exporter.h"
+#include "simple_instruments/self_metrics.h"
+#include "doctest.h"
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct lp_metadata {
+        std::string series;
+    };
+
+    const std::string &unique_identifier(const lp_metadata &md) {
+        return md.series;
+    }
+
+    struct memory_sink {
+        std::vector<std::string> buffers;
+        bool fail{false};
+
+        void write(std::string &&buffer) {
+            if (fail) throw std::runtime_error("write failed");
+            buffers.push_back(std::move(buffer));
+        }
+
+        void flush() {}
+    };
+
+    /// Keeps the last value of every series, and the number of values in the sketches.
+    class recording_exporter {
+    public:
+        using metadata_type = lp_metadata;
+        std::mutex mutex;
+        std::map<std::string, double> values;
+        std::map<std::string, std::uint64_t> sketch_counts;
+
+        template <typename Tvalue>
+        void emit_init(const Tvalue &value, const metadata_type &md) {
+            emit(value, md);
+        }
+
+        template <typename Tvalue>
+        void emit(const Tvalue &value, const metadata_type &md) {
+            std::lock_guard lock{mutex};
+            values[md.series] = static_cast<double>(value);
+        }
+
+        void emit_init(const csi::quantile_sketch &, const metadata_type &) {}
+
+        void emit(const csi::quantile_sketch &sketch, const metadata_type &md) {
+            std::lock_guard lock{mutex};
+            sketch_counts[md.series] += sketch.count();
+        }
+    };
+
+    lp_metadata self_metadata(std::string_view name) {
+        return {"simple_instruments_" + std::string{name}};
+    }
+
+}
+
+TEST_SUITE("self_metrics") {
+    TEST_CASE("line_protocol_exporter counts the bytes and buffers it writes") {
+        csi::instrument_factory<csi::line_protocol_exporter<lp_metadata, memory_sink>> factory(64);
+        auto requests = factory.make_atomic_monotonic_counter<uint64_t>({"requests"});
+        for (int i = 0; i < 100; ++i) requests.add();
+        factory.exporter().flush();
+        std::uint64_t bytes = 0;
+        for (const auto &buffer : factory.exporter().sink().buffers) bytes += buffer.size();
+        auto &statistics = *factory.exporter().statistics();
+        CHECK(statistics.bytes_written() == bytes);
+        CHECK(statistics.batches_written() == factory.exporter().sink().buffers.size());
+        CHECK(statistics.errors() == 0);
+        factory.exporter().sink().fail = true;
+        requests.add();
+        CHECK_THROWS_AS(factory.exporter().flush(), std::runtime_error);
+        CHECK(statistics.errors() == 1);
+    }
+
+    TEST_CASE("queued_exporter reports drops and delivered batches") {
+        using inner_type = csi::line_protocol_exporter<lp_metadata, memory_sink>;
+        csi::instrument_factory<csi::queued_exporter<inner_type>> factory(4, std::size_t{1024});
+        auto requests = factory.make_atomic_monotonic_counter<uint64_t>({"requests"});
+        for (int i = 0; i < 1000; ++i) requests.add();
+        factory.exporter().drain();
+        auto &statistics = *factory.exporter().statistics();
+        CHECK(statistics.dropped() == factory.exporter().dropped());
+        CHECK(statistics.batches_written() >= 1);
+        CHECK(statistics.queue_depth() == 0);
+    }
+
+    TEST_CASE("Statistics are published as instruments") {
+        csi::instrument_factory<csi::double_buffered_line_protocol_exporter<lp_metadata, memory_sink>> measured(
+                256, 2);
+        csi::instrument_factory<recording_exporter> factory;
+        csi::self_metrics<recording_exporter> self{factory, measured.exporter().statistics(), self_metadata};
+        auto requests = measured.make_atomic_monotonic_counter<uint64_t>({"requests"});
+        for (int i = 0; i < 1000; ++i) requests.add();
+        measured.exporter().flush();
+        self.collect();
+        auto &statistics = *measured.exporter().statistics();
+        auto &recorded = factory.exporter();
+        std::lock_guard lock{recorded.mutex};
+        CHECK(recorded.values["simple_instruments_bytes_written"] == statistics.bytes_written());
+        CHECK(recorded.values["simple_instruments_batches_written"] == statistics.batches_written());
+        CHECK(recorded.values["simple_instruments_dropped_records"] == statistics.dropped());
+        CHECK(recorded.values["simple_instruments_queue_depth"] == 0);
+        CHECK(recorded.values["simple_instruments_write_errors"] == 0);
+        CHECK(recorded.sketch_counts["simple_instruments_flush_seconds"] == statistics.batches_written());
+        CHECK(recorded.sketch_counts["simple_instruments_batch_size"] == statistics.batches_written());
+        CHECK(self.last_batch_size().max() >= 256);
+    }
+
+    TEST_CASE("An exporter can record its own statistics") {
+        using exporter_type = csi::line_protocol_exporter<lp_metadata, memory_sink>;
+        csi::instrument_factory<exporter_type> factory(64);
+        csi::self_metrics<exporter_type> self{factory, factory.exporter().statistics(), self_metadata};
+        auto requests = factory.make_atomic_monotonic_counter<uint64_t>({"requests"});
+        for (int i = 0; i < 100; ++i) requests.add();
+        self.collect();
+        factory.exporter().flush();
+        std::string all;
+        for (const auto &buffer : factory.exporter().sink().buffers) all += buffer;
+        CHECK(all.find("simple_instruments_bytes_written value=") != std::string::npos);
+        CHECK(all.find("simple_instruments_flush_seconds ") != std::string::npos);
+    }
+}
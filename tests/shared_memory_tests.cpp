@@ -0,0 +1,206 @@
+#include "simple_instruments.h"
+#include "simple_instruments/queued_exporter.h"
+#include "simple_instruments/routing_exporter.h"
+#include "simple_instruments/shared_memory.h"
+#include "simple_instruments/tee_exporter.h"
+#include "doctest.h"
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct shm_metadata {
+        std::string name;
+    };
+
+    const std::string &unique_identifier(const shm_metadata &md) {
+        return md.name;
+    }
+
+    class ignoring_exporter {
+    public:
+        using metadata_type = shm_metadata;
+
+        template <typename Tvalue>
+        void emit_init(const Tvalue &, const metadata_type &) {}
+
+        template <typename Tvalue>
+        void emit(const Tvalue &, const metadata_type &) {}
+    };
+
+    struct first_router {
+        std::size_t operator()(const shm_metadata &) const {
+            return 0;
+        }
+    };
+
+    std::map<std::string, std::int64_t> sample(csi::shared_memory_reader &reader) {
+        std::map<std::string, std::int64_t> values;
+        reader.sample([&values](std::string_view name, const csi::encoded_value &value) {
+            values[std::string{name}] = value.visit([](auto v) { return static_cast<std::int64_t>(v); });
+        });
+        return values;
+    }
+
+}
+
+TEST_SUITE("shared_memory") {
+    TEST_CASE("Can sample instruments from a shared memory segment") {
+        auto name = "/simple_instruments_test_" + std::to_string(::getpid());
+        csi::instrument_factory<csi::shared_memory_exporter<shm_metadata>> factory(name, 3);
+        auto requests = factory.make_atomic_monotonic_counter<uint64_t>({"requests"});
+        auto active = factory.make_atomic_bidirectional_counter<int32_t>({"active"}, 5);
+        csi::shared_memory_reader reader{name};
+        SUBCASE("Initial values are visible") {
+            auto values = sample(reader);
+            REQUIRE(values.size() == 2);
+            CHECK(values["requests"] == 0);
+            CHECK(values["active"] == 5);
+        }
+        SUBCASE("Updates are visible") {
+            requests.add();
+            requests.add();
+            active.sub(7);
+            auto values = sample(reader);
+            CHECK(values["requests"] == 2);
+            CHECK(values["active"] == -2);
+        }
+        SUBCASE("Series beyond the segment capacity are dropped") {
+            auto third = factory.make_atomic_value_recorder_counter<double>({"third"});
+            auto dropped = factory.make_atomic_value_recorder_counter<double>({"dropped"});
+            dropped.set(1.0);
+            CHECK(factory.exporter().dropped_series() == 1);
+            CHECK(sample(reader).size() == 3);
+        }
+        SUBCASE("Destroyed instruments release their slot") {
+            {
+                auto temporary = factory.make_atomic_value_recorder_counter<double>({"temporary"});
+                CHECK(sample(reader).count("temporary") == 1);
+            }
+            CHECK(sample(reader).count("temporary") == 0);
+            auto replacement = factory.make_atomic_monotonic_counter<uint64_t>({"replacement"});
+            CHECK(factory.exporter().dropped_series() == 0);
+            CHECK(sample(reader).count("replacement") == 1);
+        }
+    }
+
+    TEST_CASE("Concurrent counter changes are all applied to the segment") {
+        auto name = "/simple_instruments_test_" + std::to_string(::getpid());
+        csi::instrument_factory<csi::shared_memory_exporter<shm_metadata>> factory(name, 2);
+        auto requests = factory.make_atomic_monotonic_counter<uint64_t>({"requests"});
+        auto active = factory.make_atomic_bidirectional_counter<int32_t>({"active"});
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&requests, &active] {
+                for (int i = 0; i < 10000; ++i) {
+                    requests.add();
+                    active.add(2);
+                    active.sub(3);
+                }
+            });
+        }
+        for (auto &t : threads) t.join();
+        csi::shared_memory_reader reader{name};
+        auto values = sample(reader);
+        CHECK(values["requests"] == 40000);
+        CHECK(values["active"] == -40000);
+    }
+
+    TEST_CASE("Counter changes reach the segment through composite exporters") {
+        auto name = "/simple_instruments_test_" + std::to_string(::getpid());
+        using shm_exporter = csi::shared_memory_exporter<shm_metadata>;
+        auto segment = std::make_shared<shm_exporter>(name, 4);
+        auto count = [&name](auto &factory) {
+            auto requests = factory.template make_atomic_wide_monotonic_counter<std::uint16_t>({"requests"});
+            auto active = factory.template make_atomic_bidirectional_counter<int32_t>({"active"});
+            std::vector<std::thread> threads;
+            for (int t = 0; t < 4; ++t) {
+                threads.emplace_back([&requests, &active] {
+                    for (int i = 0; i < 10000; ++i) {
+                        requests.add();
+                        active.add(2);
+                        active.sub(3);
+                    }
+                });
+            }
+            for (auto &t : threads) t.join();
+            csi::shared_memory_reader reader{name};
+            return sample(reader);
+        };
+        SUBCASE("tee_exporter") {
+            csi::instrument_factory<csi::tee_exporter<ignoring_exporter, shm_exporter>> factory(
+                    std::make_shared<ignoring_exporter>(), segment);
+            auto values = count(factory);
+            CHECK(values["requests"] == 40000);
+            CHECK(values["active"] == -40000);
+        }
+        SUBCASE("routing_exporter") {
+            csi::instrument_factory<csi::routing_exporter<first_router, shm_exporter, ignoring_exporter>> factory(
+                    first_router{}, segment, std::make_shared<ignoring_exporter>());
+            auto values = count(factory);
+            CHECK(values["requests"] == 40000);
+            CHECK(values["active"] == -40000);
+        }
+    }
+
+    TEST_CASE("Changes dropped by a queued exporter are carried to the next change") {
+        auto name = "/simple_instruments_test_" + std::to_string(::getpid());
+        csi::instrument_factory<csi::queued_exporter<csi::shared_memory_exporter<shm_metadata>>> factory(4, name, std::uint64_t{2});
+        auto active = factory.make_atomic_bidirectional_counter<int32_t>({"active"});
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&active] {
+                for (int i = 0; i < 10000; ++i) {
+                    active.add(2);
+                    active.sub(3);
+                }
+            });
+        }
+        for (auto &t : threads) t.join();
+        factory.exporter().drain();
+        active.add(0);
+        factory.exporter().drain();
+        csi::shared_memory_reader reader{name};
+        CHECK(sample(reader)["active"] == -40000);
+    }
+
+    TEST_CASE("Narrow counters wrap in the segment like the counter itself") {
+        auto name = "/simple_instruments_test_" + std::to_string(::getpid());
+        csi::instrument_factory<csi::shared_memory_exporter<shm_metadata>> factory(name, 2);
+        auto level = factory.make_atomic_bidirectional_counter<int16_t>({"level"}, 32767);
+        auto free = factory.make_atomic_bidirectional_counter<uint16_t>({"free"});
+        level.add(1);
+        free.sub(1);
+        csi::shared_memory_reader reader{name};
+        auto values = sample(reader);
+        CHECK(values["level"] == -32768);
+        CHECK(values["free"] == 65535);
+        level.sub(1);
+        free.add(1);
+        values = sample(reader);
+        CHECK(values["level"] == 32767);
+        CHECK(values["free"] == 0);
+    }
+
+    TEST_CASE("Readers give up on a segment that stays in a change") {
+        auto name = "/simple_instruments_test_" + std::to_string(::getpid());
+        csi::instrument_factory<csi::shared_memory_exporter<shm_metadata>> factory(name, 2);
+        auto requests = factory.make_atomic_monotonic_counter<uint64_t>({"requests"});
+        csi::shared_memory_reader reader{name};
+        REQUIRE(reader.series().size() == 1);
+        CHECK_FALSE(reader.stale());
+        // Leaves the segment in a change, as an owner that dies during one does.
+        csi::detail::file_descriptor fd{::shm_open(name.c_str(), O_RDWR, 0)};
+        csi::detail::mapped_region region{fd.get(), sizeof(csi::shared_memory_header), true};
+        static_cast<csi::shared_memory_header *>(region.data())->generation.fetch_add(1);
+        CHECK_FALSE(reader.sample([](std::string_view, const csi::encoded_value &) {}));
+        CHECK(reader.series().size() == 1);
+        CHECK(reader.stale());
+    }
+}
@@ -1,7 +1,12 @@
 #include "simple_instruments.h"
 #include "doctest.h"
 #include <sstream>
+#include <condition_variable>
+#include <mutex>
 #include <limits>
+#include <map>
+#include <thread>
+#include <vector>
 
 using namespace std::literals;
 
@@ -145,3 +150,232 @@ TEST_SUITE("simple_instruments") {
     }
 }
 
+
+struct handle_exporter {
+    using metadata_type = metadata;
+    using handle_type = int;
+    int next_handle{1};
+    std::stringstream ss;
+
+    template <typename Tvalue>
+    handle_type emit_init(const Tvalue &value, const metadata_type& md) {
+        ss << unique_identifier(md) << " init " << value << " handle " << next_handle << "\n";
+        return next_handle++;
+    }
+
+    template <typename Tvalue>
+    void emit(const Tvalue &value, const metadata_type& md, const handle_type &handle) {
+        ss << unique_identifier(md) << " " << value << " handle " << handle << "\n";
+    }
+
+    void release(const handle_type &handle, const metadata_type& md) {
+        ss << unique_identifier(md) << " release " << handle << "\n";
+    }
+};
+
+TEST_SUITE("simple_instruments") {
+    TEST_CASE("Exporters with a handle_type receive the handle of the instrument") {
+        csi::instrument_factory<handle_exporter> factory;
+        {
+            auto first = factory.make_atomic_monotonic_counter<int>({"first"});
+            auto second = factory.make_atomic_value_recorder_counter<int>({"second"});
+            second.set(7);
+            first.add();
+        }
+        REQUIRE(factory.exporter().ss.str()=="first init 0 handle 1\nsecond init 0 handle 2\nsecond 7 handle 2\n"
+                                              "first 1 handle 1\nsecond release 2\nfirst release 1\n");
+    }
+}
+
+class null_exporter {
+public:
+    using metadata_type = metadata;
+
+    template <typename Tvalue>
+    void emit_init(const Tvalue &, const metadata_type&) {}
+
+    template <typename Tvalue>
+    void emit(const Tvalue &, const metadata_type&) {}
+};
+
+/// Keeps the emitted values per emitting thread, in the order each thread emitted them.
+class thread_recording_exporter {
+public:
+    using metadata_type = metadata;
+private:
+    std::mutex mutex_;
+    std::map<std::thread::id, std::vector<std::uint64_t>> values_;
+public:
+    void emit_init(const std::uint64_t &, const metadata_type&) {}
+
+    void emit(const std::uint64_t &value, const metadata_type&) {
+        std::lock_guard lock{mutex_};
+        values_[std::this_thread::get_id()].push_back(value);
+    }
+
+    std::vector<std::vector<std::uint64_t>> values() {
+        std::lock_guard lock{mutex_};
+        std::vector<std::vector<std::uint64_t>> result;
+        for (auto &entry : values_) result.push_back(entry.second);
+        return result;
+    }
+};
+
+TEST_SUITE("simple_instruments") {
+    TEST_CASE("Wide monotonic counters do not wrap") {
+        std::stringstream ss;
+        csi::instrument_factory factory(exporter{&ss});
+        SUBCASE("int16_t counter continues past the range of uint16_t") {
+            auto counter = factory.make_atomic_wide_monotonic_counter<int16_t>({"test"}, 65534);
+            static_assert(std::is_same_v<decltype(counter)::value_type,std::uint64_t>,"wide counters export uint64_t");
+            counter.add();
+            counter.add();
+            counter.add();
+            REQUIRE(counter.value()==65537);
+            REQUIRE(ss.str()=="test 65534\ntest 65535\ntest 65536\ntest 65537\n");
+        }
+        SUBCASE("uint8_t counter with a large step stays monotonic") {
+            auto counter = factory.make_atomic_wide_monotonic_counter<uint8_t,100>({"test", false}, 1000000);
+            for (int i = 0; i < 1000; ++i) counter.add();
+            REQUIRE(counter.value()==1100000);
+            std::uint64_t previous = 1000000;
+            std::string name;
+            std::uint64_t value = 0;
+            bool monotonic = true;
+            while (ss >> name >> value) {
+                monotonic = monotonic && value == previous + 100;
+                previous = value;
+            }
+            REQUIRE(previous==1100000);
+            REQUIRE(monotonic);
+        }
+    }
+
+    TEST_CASE("Wide monotonic counters count concurrent adds") {
+        csi::instrument_factory<null_exporter> factory;
+        auto counter = factory.make_atomic_wide_monotonic_counter<uint16_t>({"test"});
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&counter] {
+                for (int i = 0; i < 100000; ++i) counter.add(std::memory_order_relaxed);
+            });
+        }
+        for (auto &t : threads) t.join();
+        REQUIRE(counter.value()==400000);
+    }
+
+    TEST_CASE("Wide monotonic counters never emit values ahead of the count") {
+        csi::instrument_factory<thread_recording_exporter> factory;
+        auto counter = factory.make_atomic_wide_monotonic_counter<uint16_t>({"test"});
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 8; ++t) {
+            threads.emplace_back([&counter] {
+                for (int i = 0; i < 50000; ++i) counter.add(std::memory_order_relaxed);
+            });
+        }
+        for (auto &t : threads) t.join();
+        REQUIRE(counter.value()==400000);
+        bool monotonic = true;
+        bool bounded = true;
+        for (const auto &values : factory.exporter().values()) {
+            REQUIRE(values.size()==50000);
+            for (std::size_t i = 0; i < values.size(); ++i) {
+                monotonic = monotonic && (i == 0 || values[i] > values[i - 1]);
+                bounded = bounded && values[i] <= 400000;
+            }
+        }
+        CHECK(monotonic);
+        CHECK(bounded);
+    }
+}
+
+TEST_SUITE("simple_instruments") {
+    TEST_CASE("Local counter handles add to their counter in batches") {
+        std::stringstream ss;
+        csi::instrument_factory factory(exporter{&ss});
+        auto counter = factory.make_atomic_monotonic_counter<uint64_t>({"test", false});
+        SUBCASE("Every flush_every increments") {
+            auto local = counter.local(3);
+            for (int i = 0; i < 7; ++i) local.add();
+            REQUIRE(counter.value()==6);
+            REQUIRE(local.pending()==1);
+            REQUIRE(ss.str()=="test 3\ntest 6\n");
+        }
+        SUBCASE("When the handle is destroyed") {
+            {
+                auto local = counter.local(100);
+                local.add();
+                local.add();
+                REQUIRE(counter.value()==0);
+            }
+            REQUIRE(counter.value()==2);
+            REQUIRE(ss.str()=="test 2\n");
+        }
+        SUBCASE("When a flush is requested") {
+            auto local = counter.local(100);
+            local.add();
+            csi::request_local_counter_flush();
+            REQUIRE(counter.value()==1);
+            REQUIRE(local.pending()==0);
+            local.add();
+            REQUIRE(counter.value()==1);
+            csi::request_local_counter_flush();
+            csi::request_local_counter_flush();
+            REQUIRE(counter.value()==2);
+        }
+        SUBCASE("Moved handles flush once") {
+            auto local = counter.local(100);
+            local.add();
+            auto moved = std::move(local);
+            moved.add();
+            moved.flush();
+            REQUIRE(counter.value()==2);
+        }
+    }
+
+    TEST_CASE("A requested flush counts the increments of idle threads") {
+        csi::instrument_factory<null_exporter> factory;
+        auto counter = factory.make_atomic_monotonic_counter<uint64_t>({"test"});
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool counted = false;
+        bool done = false;
+        std::thread idle{[&] {
+            auto local = counter.local(100);
+            for (int i = 0; i < 5; ++i) local.add();
+            std::unique_lock lock{mutex};
+            counted = true;
+            cv.notify_all();
+            cv.wait(lock, [&] { return done; });
+        }};
+        {
+            std::unique_lock lock{mutex};
+            cv.wait(lock, [&] { return counted; });
+        }
+        REQUIRE(counter.value()==0);
+        csi::request_local_counter_flush();
+        REQUIRE(counter.value()==5);
+        {
+            std::lock_guard lock{mutex};
+            done = true;
+        }
+        cv.notify_all();
+        idle.join();
+        REQUIRE(counter.value()==5);
+    }
+
+    TEST_CASE("Local counter handles on many threads lose no increments") {
+        csi::instrument_factory<null_exporter> factory;
+        auto counter = factory.make_atomic_monotonic_counter<uint64_t,5>({"test"});
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&counter] {
+                auto local = counter.local(64);
+                for (int i = 0; i < 10001; ++i) local.add();
+            });
+        }
+        for (int i = 0; i < 100; ++i) csi::request_local_counter_flush();
+        for (auto &thread : threads) thread.join();
+        REQUIRE(counter.value()==4*10001*5);
+    }
+}
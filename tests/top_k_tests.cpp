@@ -0,0 +1,143 @@
+#include "simple_instruments.h"
+#include "simple_instruments/top_k.h"
+#include "doctest.h"
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct top_k_metadata {
+        std::string name;
+    };
+
+    class top_k_exporter {
+    public:
+        using metadata_type = top_k_metadata;
+        std::vector<csi::heavy_hitters> sent;
+
+        void emit_init(const csi::heavy_hitters &values, const metadata_type &) {
+            CHECK(values.top.empty());
+        }
+
+        void emit(const csi::heavy_hitters &values, const metadata_type &) {
+            sent.push_back(values);
+        }
+    };
+
+}
+
+TEST_SUITE("atomic_top_k") {
+    TEST_CASE("The most frequent keys are reported exactly while they fit") {
+        csi::instrument_factory<top_k_exporter> factory;
+        auto paths = factory.make_atomic_top_k({"paths"}, 3);
+        for (int i = 0; i < 50; ++i) paths.add("/index");
+        for (int i = 0; i < 30; ++i) paths.add("/login");
+        paths.add("/search", 20);
+        paths.add("/about");
+        auto &result = paths.collect();
+        REQUIRE(result.top.size() == 3);
+        CHECK(result.top[0].key == "/index");
+        CHECK(result.top[0].count == 50);
+        CHECK(result.top[1].key == "/login");
+        CHECK(result.top[1].count == 30);
+        CHECK(result.top[2].key == "/search");
+        CHECK(result.top[2].error == 0);
+        CHECK(result.total == 101);
+        CHECK(factory.exporter().sent.size() == 1);
+    }
+
+    TEST_CASE("Heavy hitters are found among many keys with bounded counters") {
+        csi::instrument_factory<top_k_exporter> factory;
+        auto users = factory.make_atomic_top_k({"users"}, 5, 64);
+        std::map<std::string, std::uint64_t> exact;
+        std::mt19937 random{42};
+        std::uniform_int_distribution<int> noise{0, 9999};
+        for (int i = 0; i < 100000; ++i) {
+            auto key = i % 4 == 0 ? "heavy" + std::to_string(i % 20) : "user" + std::to_string(noise(random));
+            users.add(key);
+            ++exact[key];
+        }
+        auto &result = users.collect();
+        REQUIRE(result.top.size() == 5);
+        for (auto &hitter : result.top) {
+            CHECK(hitter.key.rfind("heavy", 0) == 0);
+            CHECK(hitter.count >= exact[hitter.key]);
+            CHECK(hitter.count - hitter.error <= exact[hitter.key]);
+        }
+    }
+
+    TEST_CASE("The error bound holds per shard when one shard gets most of the events") {
+        csi::instrument_factory<top_k_exporter> factory;
+        auto users = factory.make_atomic_top_k({"users"}, 3, 64);
+        using top_k = decltype(users);
+        constexpr std::uint64_t shard_capacity = 64 / top_k::shard_count;
+        auto shard = top_k::shard_of("heavy");
+        std::vector<std::string> crowded;
+        for (int i = 0; crowded.size() < 200; ++i) {
+            auto key = "user" + std::to_string(i);
+            if (top_k::shard_of(key) == shard) crowded.push_back(key);
+        }
+        std::map<std::string, std::uint64_t> exact;
+        std::mt19937 random{7};
+        std::uniform_int_distribution<std::size_t> pick{0, crowded.size() - 1};
+        std::uint64_t shard_total = 0;
+        for (int i = 0; i < 20000; ++i) {
+            auto key = i % 7 == 0 ? std::string{"heavy"} : crowded[pick(random)];
+            users.add(key);
+            ++exact[key];
+            ++shard_total;
+        }
+        for (int i = 0; i < 100; ++i) users.add("light" + std::to_string(i % 10));
+        REQUIRE(exact["heavy"] > shard_total / shard_capacity);
+        auto &result = users.collect();
+        auto heavy = std::find_if(result.top.begin(), result.top.end(),
+                                  [](const csi::heavy_hitter &hitter) { return hitter.key == "heavy"; });
+        REQUIRE(heavy != result.top.end());
+        CHECK(heavy->count >= exact["heavy"]);
+        CHECK(heavy->count - exact["heavy"] <= shard_total / shard_capacity);
+        CHECK(heavy->error <= shard_total / shard_capacity);
+    }
+
+    TEST_CASE("Concurrent adds are all counted") {
+        csi::instrument_factory<top_k_exporter> factory;
+        auto keys = factory.make_atomic_top_k({"keys"}, 4);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&keys] {
+                for (int i = 0; i < 10000; ++i) keys.add("key" + std::to_string(i % 4));
+            });
+        }
+        for (auto &thread : threads) thread.join();
+        auto &result = keys.collect();
+        REQUIRE(result.top.size() == 4);
+        for (auto &hitter : result.top) CHECK(hitter.count == 10000);
+        CHECK(result.total == 40000);
+    }
+
+    TEST_CASE("Every interval starts over and empty intervals are not sent") {
+        csi::instrument_factory<top_k_exporter> factory;
+        auto keys = factory.make_atomic_top_k({"keys"}, 2);
+        keys.add("a");
+        keys.collect();
+        keys.collect();
+        keys.add("b", 2);
+        auto &result = keys.collect();
+        REQUIRE(result.top.size() == 1);
+        CHECK(result.top[0].key == "b");
+        CHECK(result.top[0].count == 2);
+        CHECK(factory.exporter().sent.size() == 2);
+        CHECK(keys.last().total == 2);
+    }
+
+    TEST_CASE("k must be positive") {
+        csi::instrument_factory<top_k_exporter> factory;
+        CHECK_THROWS_AS(factory.make_atomic_top_k({"keys"}, 0), std::invalid_argument);
+    }
+}
@@ -0,0 +1,150 @@
+#include "simple_instruments.h"
+#include "simple_instruments/line_protocol.h"
+#include "simple_instruments/uring_sink.h"
+#include "doctest.h"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct lp_metadata {
+        std::string series;
+    };
+
+    const std::string &unique_identifier(const lp_metadata &md) {
+        return md.series;
+    }
+
+    std::string temporary_path(const std::string &name) {
+        auto path = (std::filesystem::temp_directory_path() / name).string();
+        std::remove(path.c_str());
+        return path;
+    }
+
+    std::string read_file(const std::string &path) {
+        std::ifstream in{path, std::ios::binary};
+        std::ostringstream content;
+        content << in.rdbuf();
+        return content.str();
+    }
+
+    /// Buffers of different sizes, some larger than a slot, with content that shows when they are reordered.
+    std::vector<std::string> numbered_buffers(std::size_t count) {
+        std::vector<std::string> buffers;
+        for (std::size_t i = 0; i < count; ++i) {
+            auto size = 1 + (i * 7919) % 20000;
+            std::string buffer;
+            while (buffer.size() < size) buffer += std::to_string(i) + ",";
+            buffers.push_back(buffer);
+        }
+        return buffers;
+    }
+
+    std::string joined(const std::vector<std::string> &buffers) {
+        std::string all;
+        for (const auto &buffer : buffers) all += buffer;
+        return all;
+    }
+
+    const csi::sink_backend backends[] = {csi::sink_backend::io_uring, csi::sink_backend::writev};
+
+}
+
+TEST_SUITE("uring_sink") {
+    TEST_CASE("Buffers are appended to a file in order") {
+        for (auto backend : backends) {
+            auto path = temporary_path("simple_instruments_uring_sink_test.lp");
+            {
+                std::ofstream{path} << "existing\n";
+            }
+            auto buffers = numbered_buffers(300);
+            {
+                csi::uring_sink sink{path, 4, 4096, backend};
+                for (auto buffer : buffers) sink.write(std::move(buffer));
+                sink.flush();
+            }
+            REQUIRE(read_file(path) == "existing\n" + joined(buffers));
+            std::remove(path.c_str());
+        }
+    }
+
+    TEST_CASE("Uses io_uring with registered buffers when the kernel allows it") {
+        auto path = temporary_path("simple_instruments_uring_sink_test.lp");
+        csi::uring_sink sink{path};
+        if (sink.backend() == csi::sink_backend::io_uring) {
+            REQUIRE(sink.registered());
+        }
+        csi::uring_sink fallback{path, 8, 4096, csi::sink_backend::writev};
+        REQUIRE(fallback.backend() == csi::sink_backend::writev);
+        std::remove(path.c_str());
+    }
+
+    TEST_CASE("Buffers are written to a socket in order") {
+        for (auto backend : backends) {
+            int fds[2];
+            REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+            int small = 4096;
+            setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+            std::string received;
+            std::thread reader{[&] {
+                char chunk[4096];
+                ssize_t size;
+                while ((size = ::read(fds[1], chunk, sizeof(chunk))) > 0) received.append(chunk, size);
+            }};
+            auto buffers = numbered_buffers(300);
+            {
+                csi::uring_sink sink{fds[0], 8, 4096, backend};
+                for (auto buffer : buffers) sink.write(std::move(buffer));
+            }
+            shutdown(fds[0], SHUT_WR);
+            reader.join();
+            ::close(fds[0]);
+            ::close(fds[1]);
+            REQUIRE(received == joined(buffers));
+        }
+    }
+
+    TEST_CASE("Write errors are thrown") {
+        for (auto backend : backends) {
+            auto path = temporary_path("simple_instruments_uring_sink_test.lp");
+            {
+                std::ofstream{path} << "read only\n";
+            }
+            auto fd = ::open(path.c_str(), O_RDONLY);
+            REQUIRE(fd >= 0);
+            {
+                csi::uring_sink sink{fd, 4, 4096, backend};
+                sink.write("line\n");
+                REQUIRE_THROWS_AS(sink.flush(), std::system_error);
+                sink.flush();
+            }
+            ::close(fd);
+            REQUIRE(read_file(path) == "read only\n");
+            std::remove(path.c_str());
+        }
+    }
+
+    TEST_CASE("Can be used as sink of a line protocol exporter") {
+        auto path = temporary_path("simple_instruments_uring_sink_test.lp");
+        {
+            csi::instrument_factory<csi::line_protocol_exporter<lp_metadata, csi::uring_sink>> factory(64, path);
+            auto requests = factory.make_atomic_monotonic_counter<uint32_t>({"requests"});
+            for (int i = 0; i < 100; ++i) requests.add();
+        }
+        auto content = read_file(path);
+        REQUIRE(content.find("requests value=0u ") == 0);
+        REQUIRE(content.find("\nrequests value=100u ") != std::string::npos);
+        std::remove(path.c_str());
+    }
+}
@@ -0,0 +1,82 @@
+#include "simple_instruments.h"
+#include "simple_instruments/line_protocol.h"
+#include "simple_instruments/zlib_sink.h"
+#include "doctest.h"
+#include <string>
+#include <zlib.h>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    struct zlib_metadata {
+        std::string series;
+    };
+
+    const std::string &unique_identifier(const zlib_metadata &md) {
+        return md.series;
+    }
+
+    struct string_sink {
+        std::string data;
+
+        void write(std::string &&buffer) {
+            data += buffer;
+        }
+
+        void flush() {}
+    };
+
+    std::string gunzip(const std::string &compressed) {
+        z_stream stream{};
+        inflateInit2(&stream, 15 + 16);
+        stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(compressed.data()));
+        stream.avail_in = static_cast<uInt>(compressed.size());
+        std::string result;
+        char buffer[4096];
+        int status;
+        do {
+            stream.next_out = reinterpret_cast<Bytef *>(buffer);
+            stream.avail_out = sizeof(buffer);
+            status = inflate(&stream, Z_NO_FLUSH);
+            result.append(buffer, sizeof(buffer) - stream.avail_out);
+        } while (status == Z_OK && (stream.avail_in > 0 || stream.avail_out == 0));
+        inflateEnd(&stream);
+        return result;
+    }
+
+}
+
+TEST_SUITE("zlib_sink") {
+    TEST_CASE("Compressed buffers decompress to the original data") {
+        std::string expected;
+        std::string compressed;
+        {
+            csi::zlib_sink<string_sink> sink{Z_DEFAULT_COMPRESSION};
+            for (int i = 0; i < 100; ++i) {
+                auto buffer = "series value=" + std::to_string(i) + "i\n";
+                expected += buffer;
+                sink.write(std::move(buffer));
+            }
+            SUBCASE("Flush makes everything written so far decompressable") {
+                sink.flush();
+                REQUIRE(gunzip(sink.sink().data) == expected);
+            }
+            sink.flush();
+            CHECK(sink.bytes_in() == expected.size());
+            CHECK(sink.bytes_out() == sink.sink().data.size());
+            CHECK(sink.bytes_out() < sink.bytes_in());
+        }
+    }
+
+    TEST_CASE("Can compose line_protocol_exporter with zlib_sink") {
+        using exporter_type = csi::line_protocol_exporter<zlib_metadata, csi::zlib_sink<string_sink>>;
+        csi::instrument_factory<exporter_type> factory(128, Z_BEST_SPEED);
+        auto counter = factory.make_atomic_monotonic_counter<uint64_t>({"requests"});
+        for (int i = 0; i < 1000; ++i) counter.add();
+        factory.exporter().flush();
+        auto text = gunzip(factory.exporter().sink().sink().data);
+        CHECK(text.rfind("requests value=0u ", 0) == 0);
+        CHECK(text.find("requests value=1000u ") != std::string::npos);
+    }
+}
@@ -0,0 +1,45 @@
+#include "simple_instruments/ring_file.h"
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+namespace csi = crosscode::simple_instruments;
+
+namespace {
+
+    void print(const csi::ring_file_entry &entry) {
+        std::cout << entry.timestamp << " " << entry.name << " ";
+        entry.value.visit([](auto value) { std::cout << value; });
+        std::cout << "\n";
+    }
+
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc > 3 || (argc == 3 && std::strcmp(argv[2], "-f") != 0)) {
+        std::cerr << "usage: " << argv[0] << " <ring file> [-f]\n"
+                  << "Dumps all records in the ring file. With -f new records are printed as they arrive.\n";
+        return 2;
+    }
+    bool follow = argc == 3;
+    try {
+        auto ring = csi::ring_file::open_read_only(argv[1]);
+        auto pending_timeout = follow ? std::chrono::steady_clock::duration{std::chrono::seconds(1)}
+                                      : std::chrono::steady_clock::duration::zero();
+        csi::ring_file_cursor cursor{ring, pending_timeout};
+        for (;;) {
+            cursor.poll(print, [](std::uint64_t sequence) {
+                std::cerr << "record " << sequence << " was never committed, skipped\n";
+            });
+            if (!follow) break;
+            std::cout.flush();
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,36 @@
+#include "simple_instruments/shared_memory.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+namespace csi = crosscode::simple_instruments;
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc > 4) {
+        std::cerr << "usage: " << argv[0] << " <segment name> [interval ms] [samples]\n"
+                  << "Samples all series in a shared memory segment. Without samples it runs until interrupted.\n";
+        return 2;
+    }
+    auto interval = std::chrono::milliseconds(argc > 2 ? std::atol(argv[2]) : 1000);
+    long samples = argc > 3 ? std::atol(argv[3]) : -1;
+    try {
+        csi::shared_memory_reader reader{argv[1]};
+        for (long i = 0; samples < 0 || i < samples; ++i) {
+            auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+            bool sampled = reader.sample([timestamp](std::string_view name, const csi::encoded_value &value) {
+                std::cout << timestamp << " " << name << " ";
+                value.visit([](auto v) { std::cout << v; });
+                std::cout << "\n";
+            });
+            if (!sampled) std::cerr << argv[1] << " did not become consistent, is its owner still running?\n";
+            std::cout.flush();
+            std::this_thread::sleep_for(interval);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}